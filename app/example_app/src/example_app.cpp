@@ -14,16 +14,10 @@
 #include <net/if.h>
 #include <linux/if.h>
 #include <netinet/ip6.h>
-#include <netinet/udp.h>
+#include <unistd.h>
 
 #include <bm_core/bcmp_messages.hpp>
 
-#include "lwip_pseudo.hpp"
-
-#define BM_MIDDLEWARE_PORT 4321
-#define STRESS_TEST_PORT 12357
-#define BM_BCL_PORT 2222
-
 // Polynomial used for Ethernet CRC-32
 constexpr uint32_t CRC32_POLYNOMIAL = 0xEDB88320;
 
@@ -56,96 +50,6 @@ uint32_t ethernet_fcs(const uint8_t* data, size_t length) {
 }
 
 
-bool recv_bcmp_message(const uint8_t* buffer, size_t length, bcmp_header_t& header, bcmp_heartbeat_t& heartbeat) {
-  // Make sure the buffer is at least large enough for the header
-  if (length < sizeof(bcmp_header_t)) {
-    spdlog::error("Buffer too small for BCMP header.");
-    return false;
-  }
-
-  // Copy the header from the buffer
-  std::memcpy(&header, buffer, sizeof(bcmp_header_t));
-
-  // Validate the type to ensure it's a heartbeat message, assuming 0xBC is the type for heartbeat
-  if (header.type != 0x01) {
-    spdlog::error("Not a BCMP heartbeat message.");
-    return false;
-  }
-
-  // Make sure the buffer is large enough for the entire heartbeat message
-  size_t expected_size = sizeof(bcmp_header_t) + sizeof(bcmp_heartbeat_t);
-  if (length < expected_size) {
-    spdlog::error("Buffer too small for BCMP heartbeat message.");
-    return false;
-  }
-
-  // Copy the heartbeat payload from the buffer
-  std::memcpy(&heartbeat, buffer + sizeof(bcmp_header_t), sizeof(bcmp_heartbeat_t));
-
-  spdlog::info( "Heartbeat: {}", spdlog::to_hex(buffer, buffer + 18) );
-
-  return true;
-}
-
-bool parse_packet(const uint8_t* buffer, size_t buffer_length, ethhdr& ethernetHeader, ip6_hdr& ipv6Header, udphdr& udpHeader) {
-    
-
-
-    if (buffer_length < sizeof(ethhdr)) {
-        spdlog::warn( "DROP: Too short to be ethernet frame" );
-        return false;
-    }
-
-    // Copy Ethernet header from buffer
-    std::memcpy(&ethernetHeader, buffer, sizeof(ethhdr));
-
-    // spdlog::info( "t: {}, dst: {} src: {}",
-    //     ntohs( ethernetHeader.h_proto ), 
-    //     spdlog::to_hex(ethernetHeader.h_dest, ethernetHeader.h_dest+6), 
-    //     spdlog::to_hex(ethernetHeader.h_source, ethernetHeader.h_source+6) );
-    
-    if (ethernetHeader.h_proto != htons(0x86DD)) { // Check if the EtherType is IPv6
-        spdlog::warn( "DROP: Ethertype not IPV6" );
-        return false;
-    }
-
-    if (buffer_length < sizeof(ethhdr) + sizeof(ip6_hdr)) {
-        spdlog::warn( "DROP: Too short to be IPV6 packet" );
-        return false;
-    }
-
-    // Copy IPv6 header from buffer
-    std::memcpy(&ipv6Header, buffer + sizeof(ethhdr), sizeof(ip6_hdr));
-    // spdlog::info( "ipv6 proto: {}", ipv6Header.ip6_ctlun.ip6_un1.ip6_un1_nxt );
-    if( ipv6Header.ip6_ctlun.ip6_un1.ip6_un1_nxt == 0xBC ){
-        spdlog::info( "Got BCMP packet of len={}", ntohs(ipv6Header.ip6_ctlun.ip6_un1.ip6_un1_plen) );
-
-        bcmp_header_t bcmp_hdr{};
-        bcmp_heartbeat_t bcmp_hb{};
-        
-        bool bcmp_ret = recv_bcmp_message( buffer + sizeof(ethhdr) + sizeof(ip6_hdr), ntohs(ipv6Header.ip6_ctlun.ip6_un1.ip6_un1_plen), bcmp_hdr, bcmp_hb );
-        if( bcmp_ret )
-        {
-            spdlog::info( "got bcmp heartbeat: {}", (uint64_t)bcmp_hb.time_since_boot_us );
-        }
-        return bcmp_ret;
-    }
-    if (ipv6Header.ip6_ctlun.ip6_un1.ip6_un1_nxt != 17) { // Check if the Next Header is UDP (17)
-        spdlog::warn( "DROP: Not UDP packet:" );
-        return false;
-    }
-
-    if (buffer_length < sizeof(ethhdr) + sizeof(ip6_hdr) + sizeof(udphdr)) {
-        spdlog::warn( "DROP: Too short to be UDP packet" );
-        return false;
-    }
-
-    // Copy UDP header from buffer
-    std::memcpy(&udpHeader, buffer + sizeof(ethhdr) + sizeof(ip6_hdr), sizeof(udphdr));
-
-    return true;
-}
-
 template<typename Mutex>
 class FTXUISink : public spdlog::sinks::base_sink<Mutex> {
 public:
@@ -183,11 +87,13 @@ namespace {
     }
 }
 
-ExampleApp::ExampleApp( const std::string& node_id, const std::string& interface, const std::string& mode )
+ExampleApp::ExampleApp( const std::string& node_id, const std::string& interface, const std::string& mode, const bm::core::NetDeviceConfig& dev_config, const PingConfig& ping_config )
     : exit_{false}
     , _signals{ _ioc, SIGINT, SIGTERM }
     , _update_timer{ _ioc, std::chrono::milliseconds( 0 ) }
     , _net_if_id{ interface }
+    , _dev_config{ dev_config }
+    , _ping_config{ ping_config }
     , screen_(ftxui::ScreenInteractive::TerminalOutput()) 
 {
 
@@ -209,13 +115,28 @@ ExampleApp::ExampleApp( const std::string& node_id, const std::string& interface
 
     // Create the counter display.
     auto counter_display = ftxui::Renderer([&] {
-        return ftxui::vbox({
+        ftxui::Elements elements{
             ftxui::text("Manual value: ") | ftxui::bold,
             ftxui::text(std::to_string(_counter_0.load())) | ftxui::color(ftxui::Color::Green),
             ftxui::separator(),
             ftxui::text("Auto counter: ") | ftxui::bold,
             ftxui::text(std::to_string(_counter_1.load())) | ftxui::color(ftxui::Color::Blue),
-        }) | ftxui::border;
+            ftxui::separator(),
+            ftxui::text("Neighbors: ") | ftxui::bold,
+            ftxui::text(std::to_string(_node ? _node->net().neighbors().snapshot()->size() : 0)),
+            ftxui::separator(),
+            ftxui::text("Network: ") | ftxui::bold,
+            ftxui::text(std::to_string(_node ? _node->net().topology().snapshot()->size() : 0) + " nodes, " + counter_holders()),
+            ftxui::separator(),
+            ftxui::text("Stress test rx: ") | ftxui::bold,
+            ftxui::text(std::to_string(_stress_rx_count.load()) + " datagrams, " + std::to_string(_stress_rx_bytes.load()) + " bytes"),
+        };
+        if( _app_mode == EAppMode::PING ) {
+            elements.push_back(ftxui::separator());
+            elements.push_back(ftxui::text("Ping " + _ping_config.target + ": ") | ftxui::bold);
+            elements.push_back(ftxui::text(ping_summary()));
+        }
+        return ftxui::vbox(std::move(elements)) | ftxui::border;
     });
 
     ftxui::MenuOption menu_option;
@@ -283,20 +204,74 @@ ExampleApp::ExampleApp( const std::string& node_id, const std::string& interface
     else if( mode == "sub" ){
         _app_mode = EAppMode::SUBSCRIBER;
     }
+    else if( mode == "ping" ){
+        _app_mode = EAppMode::PING;
+    }
     else {
         throw std::invalid_argument( "Unsupported app mode: " + mode );
     }
 
     // Create BM Node
-    _node = std::make_unique<bm::core::Node>( _node_id, std::vector<std::string>( { _net_if_id } ) );
+    _node = std::make_unique<bm::core::Node>( _node_id, std::vector<std::string>( { _net_if_id } ), _dev_config );
+
+    // One receive thread per fanout worker, each servicing every port
+    _rx_pool = std::make_unique<bm::core::ReactorPool>( _node->net(), [this]( bm::core::NetworkDevice& dev, const bm::core::FrameView& frame ){
+        _node->net().bm_rx( dev, frame );
+    }, _dev_config.fanout.pin_workers );
+
+    // Heartbeats are handled by the interface, just note anything else other nodes send us
+    _node->net().bcmp().set_default_handler( []( const bm::core::BcmpMessage& msg ){
+        spdlog::debug( "Unhandled BCMP message type {:#x} on port {} len={}", msg.header.type, msg.ingress_port, msg.len );
+    });
+
+    // Subscribers mirror the publisher's auto counter
+    if( _app_mode == EAppMode::SUBSCRIBER ) {
+        _node->middleware().subscribe( COUNTER_TOPIC_NAME, [this]( const bm::core::PubSubMessage& msg ){
+            int32_t value;
+            if( msg.len != sizeof( value ) ) {
+                spdlog::warn( "Malformed counter from {:016x}", msg.publisher );
+                return;
+            }
+            std::memcpy( &value, msg.payload, sizeof( value ) );
+            _counter_1 = value;
+        });
+    }
+
+    // Publishers list the counter topic so subscribers can find them in the resource table
+    if( _app_mode == EAppMode::PUBLISHER ) {
+        _node->middleware().advertise( COUNTER_TOPIC_NAME );
+    }
+
+    // Pings go to the target's link-local address, echo replies from anything else are ignored
+    if( _app_mode == EAppMode::PING ) {
+        uint64_t target;
+        if( !parse_hex_uint64( _ping_config.target, target ) ) {
+            throw std::invalid_argument( "Ping target can not be parsed as a valid hex 64-bit integer" );
+        }
+        _ping_target.s6_addr32[0] = htonl( 0xFE800000 );
+        _ping_target.s6_addr32[2] = htonl( static_cast<uint32_t>( target >> 32 ) );
+        _ping_target.s6_addr32[3] = htonl( static_cast<uint32_t>( target ) );
+        _ping_id = static_cast<uint16_t>( getpid() );
+
+        _node->net().echo().set_reply_handler( [this, target]( const bm::core::EchoReply& reply ){
+            if( reply.id != _ping_id || reply.node_id != target ) {
+                return;
+            }
+            _ping_latency.record( reply.rtt - reply.turnaround );
+            _ping_received.fetch_add( 1, std::memory_order_relaxed );
+        });
+    }
+
+    // Stress test traffic is only counted
+    _node->net().bind( bm::core::STRESS_TEST_PORT, [this]( const bm::core::UdpDatagram& dgram ){
+        _stress_rx_count.fetch_add( 1, std::memory_order_relaxed );
+        _stress_rx_bytes.fetch_add( dgram.len, std::memory_order_relaxed );
+    });
 }
 
 ExampleApp::~ExampleApp() {
     exit_ = true;
-    if (reader_thread_.joinable()) 
-    {
-        reader_thread_.join();
-    }
+    _rx_pool->stop();
     if (ftxui_thread_.joinable()) {
         ftxui_thread_.join();
     }
@@ -315,6 +290,7 @@ void ExampleApp::handle_signal( const boost::system::error_code& error, int sign
 
 void ExampleApp::exit() {
     exit_ = true;
+    _rx_pool->stop();
     screen_.ExitLoopClosure()();
     _ioc.stop();
 }
@@ -335,14 +311,7 @@ void ExampleApp::run()
         exit();
     });
 
-    reader_thread_ = std::thread([&] {
-        while (!exit_) {
-            auto ret = _node->net().dev(0)->read_frame( input_buffer_, bm::core::NetworkDevice::BM_MAX_FRAME_SIZE );
-            if( ret > 0 ){
-                process_frame( input_buffer_, ret );
-            }
-        }
-    });
+    _rx_pool->start();
 
     _last_hb = std::chrono::steady_clock::now();
 
@@ -379,22 +348,20 @@ void ExampleApp::update()
         _last_hb = now;
 
         send_bcmp_heartbeat();
+
+        if( _app_mode == EAppMode::PUBLISHER ) {
+            publish_counter();
+        }
     }
 
-    // TODO: Do stuff based on app type
-    screen_.Post(ftxui::Event::Custom);
-}
+    if( _app_mode == EAppMode::PING ) {
+        send_pings( now );
+    }
 
-void ExampleApp::process_frame( char* data, ssize_t len )
-{
-    ethhdr ethernet_header;
-    ip6_hdr ipv6_header;
-    udphdr udp_header;
+    // Merge neighbor updates from the receive workers
+    _node->net().update();
 
-    auto ret = parse_packet( (uint8_t*)data, len, ethernet_header, ipv6_header, udp_header );
-    if( ret ){
-        // spdlog::info( "Got udp packet, src dst len {} {} {}", ntohs(udp_header.source), ntohs(udp_header.dest), ntohs(udp_header.len) );
-    }
+    screen_.Post(ftxui::Event::Custom);
 }
 
 uint64_t get_nanosecond_timestamp() {
@@ -411,60 +378,101 @@ uint64_t get_nanosecond_timestamp() {
 }
 
 
+void ExampleApp::publish_counter()
+{
+    int32_t value = ++_counter_1;
+    if( _node->middleware().publish( COUNTER_TOPIC, &value, sizeof( value ) ) < 0 ) {
+        spdlog::warn( "Failed to publish counter: {}", std::strerror( errno ) );
+    }
+}
+
+void ExampleApp::send_pings( std::chrono::steady_clock::time_point now )
+{
+    if( _ping_done ) {
+        return;
+    }
+
+    auto send = [&](){
+        if( _node->net().echo().send_request( _ping_target, _ping_id, static_cast<uint16_t>( _ping_sent ), _ping_config.size ) < 0 ) {
+            spdlog::warn( "Failed to send echo request: {}", std::strerror( errno ) );
+            return false;
+        }
+        _ping_sent++;
+        _ping_last_sent = now;
+        return true;
+    };
+    auto remaining = [&](){ return _ping_config.count == 0 || _ping_sent < _ping_config.count; };
+
+    if( _ping_sent == 0 ) {
+        _ping_next = now;
+    }
+
+    if( _ping_config.interval.count() == 0 ) {
+        // Flood: keep the window full, and send at least one per update so losses don't stall it
+        bool sent_one = false;
+        while( remaining() && _ping_sent - _ping_received.load( std::memory_order_relaxed ) < PING_FLOOD_WINDOW && send() ) {
+            sent_one = true;
+        }
+        if( !sent_one && remaining() ) {
+            send();
+        }
+    }
+    else {
+        while( remaining() && now >= _ping_next && send() ) {
+            _ping_next += _ping_config.interval;
+        }
+    }
+
+    // Done once every reply is in, or a second after the last request for the ones that got lost
+    if( !remaining() && ( _ping_received.load( std::memory_order_relaxed ) >= _ping_sent || now - _ping_last_sent >= std::chrono::seconds( 1 ) ) ) {
+        _ping_done = true;
+        spdlog::info( "Ping {}: {}", _ping_config.target, ping_summary() );
+    }
+}
+
+std::string ExampleApp::counter_holders() const
+{
+    size_t publishers = 0;
+    size_t subscribers = 0;
+    if( _node ) {
+        auto index = _node->net().resources().snapshot();
+        auto it = index->find( std::string( COUNTER_TOPIC_NAME ) );
+        if( it != index->end() ) {
+            for( const auto& holder : *it->second ) {
+                publishers += ( holder.flags & BCMP_RESOURCE_PUBLISHER ) ? 1 : 0;
+                subscribers += ( holder.flags & BCMP_RESOURCE_SUBSCRIBER ) ? 1 : 0;
+            }
+        }
+    }
+    return fmt::format( "{} with {} publishers and {} subscribers", COUNTER_TOPIC_NAME, publishers, subscribers );
+}
+
+std::string ExampleApp::ping_summary() const
+{
+    auto us = []( std::chrono::nanoseconds ns ){ return fmt::format( "{:.1f}", ns.count() / 1000.0 ); };
+
+    uint32_t sent = _ping_sent.load( std::memory_order_relaxed );
+    uint32_t received = _ping_received.load( std::memory_order_relaxed );
+    double loss = sent ? 100.0 * ( sent - std::min( received, sent ) ) / sent : 0.0;
+    return fmt::format( "{} sent, {} received, {:.1f}% loss, us min/avg/p50/p99/p99.9/max {}/{}/{}/{}/{}/{}",
+                        sent, received, loss,
+                        us( _ping_latency.min() ), us( _ping_latency.mean() ), us( _ping_latency.percentile( 50.0 ) ),
+                        us( _ping_latency.percentile( 99.0 ) ), us( _ping_latency.percentile( 99.9 ) ), us( _ping_latency.max() ) );
+}
+
 void ExampleApp::send_bcmp_heartbeat()
 {
-    // Manually fill in the headers (Ethernet, IPv6, UDP) and data here
-    // Define Ethernet header
-    ethhdr *eth_header = (struct ethhdr *)output_buffer_;
-    ip6_hdr *ipv6_header;
-    bcmp_header_t *bcmp_header;
-    bcmp_heartbeat_t *bcmp_heartbeat;
-    // 5c:85:7e:32:c0:66
-	// 4c:cc:6a:d8:52:07
-	
-    // a0:ce:c8:8e:e0:ba
-    memcpy(eth_header->h_source, "\xa0\xce\xc8\x8e\xe0\xba", 6);  // Source MAC (Placeholder)
-	memcpy(eth_header->h_dest, "\x33\x33\x00\x00\x00\x01", 6);    // Destination MAC (Placeholder)
-    
-    eth_header->h_proto = htons(ETH_P_IPV6);
-
-    // Define IPv6 header
-    ipv6_header = (ip6_hdr *)(output_buffer_ + sizeof(ethhdr));
-    ipv6_header->ip6_flow = htonl((6 << 28) | (0 << 0));    // Version (6), Traffic class (0), Flow label (0)
-    ipv6_header->ip6_plen = htons(sizeof(bcmp_header_t) + sizeof(bcmp_heartbeat_t));    // UDP header size + "Hello" size
-    ipv6_header->ip6_nxt = 0xBC;                          // Next header: BCMP
-    ipv6_header->ip6_hops = 255;                                 // Hop limit
-
-    auto src_addr = "fe80::8aa5:f9b3:72a6:080c";
-    auto dest_addr = "ff02::1";
-
-    inet_pton(AF_INET6, src_addr, &ipv6_header->ip6_src);
-    inet_pton(AF_INET6, dest_addr, &ipv6_header->ip6_dst);
-
-    // BCMP Header
-    bcmp_header = (bcmp_header_t *)(output_buffer_ + sizeof(ethhdr) + sizeof(ip6_hdr));
-    bcmp_header->type = BCMP_HEARTBEAT;
-    bcmp_header->checksum = 0x0;
-    bcmp_header->flags = 0;
-    bcmp_header->rsvd = 0;
-
-    bcmp_heartbeat = (bcmp_heartbeat_t *)((uint8_t*)bcmp_header + sizeof( bcmp_header_t) );
-    bcmp_heartbeat->liveliness_lease_dur_s=10;
-    bcmp_heartbeat->time_since_boot_us = get_nanosecond_timestamp();
-
-    ip6_addr_t src_out{};
-    memcpy( reinterpret_cast<void*>(&src_out), ipv6_header->ip6_src.__in6_u.__u6_addr8, 16 );
-    ip6_addr_t dst_out{};
-    memcpy( reinterpret_cast<void*>(&dst_out), ipv6_header->ip6_dst.__in6_u.__u6_addr8, 16 );
-
-    bcmp_header->checksum = ip6_chksum_pseudo( (uint8_t*)bcmp_header, 0xBC, 18, 
-        &src_out,
-        &dst_out );
-
-    // Calculate checksums for bcmp message and ethernet frame
-    auto frame_size = sizeof(ethhdr) + sizeof(ip6_hdr) + sizeof(bcmp_header_t) + sizeof(bcmp_heartbeat_t);
-    spdlog::info( "Sending hb: {}", frame_size );
-    _node->net().dev(0)->write_frame( output_buffer_, frame_size );
+    // All nodes, link-local scope
+    static const in6_addr dest_addr{ { { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01 } } };
+
+    bcmp_heartbeat_t heartbeat{};
+    heartbeat.liveliness_lease_dur_s = 10;
+    heartbeat.time_since_boot_us = get_nanosecond_timestamp();
+
+    spdlog::info( "Sending hb" );
+    if( _node->net().send_bcmp_message( dest_addr, BCMP_HEARTBEAT, &heartbeat, sizeof( heartbeat ) ) < 0 ) {
+        spdlog::warn( "Failed to send heartbeat: {}", std::strerror( errno ) );
+    }
 }
 
 
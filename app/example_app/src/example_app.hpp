@@ -12,18 +12,28 @@
 #include "ftxui/component/screen_interactive.hpp"  // for ScreenInteractive
 #include "ftxui/dom/elements.hpp"  // for text, separator, Element, operator|, vbox, border
 
+#include <bm_core/latency_histogram.hpp>
 #include <bm_core/node.hpp>
+#include <bm_core/reactor_pool.hpp>
 
 enum class EAppMode {
     PUBLISHER,
-    SUBSCRIBER
+    SUBSCRIBER,
+    PING
+};
+
+struct PingConfig {
+    std::string                 target;                 // 64-bit node ID, hex
+    uint32_t                    count = 0;              // 0 pings until exit
+    std::chrono::milliseconds   interval{ 1000 };       // 0 floods
+    size_t                      size = bm::core::Echo::MIN_PAYLOAD;
 };
 
 class ExampleApp
 {
 public:
 
-    explicit ExampleApp( const std::string& node_id, const std::string& interface, const std::string& mode );
+    explicit ExampleApp( const std::string& node_id, const std::string& interface, const std::string& mode, const bm::core::NetDeviceConfig& dev_config, const PingConfig& ping_config = {} );
     virtual ~ExampleApp();
 
     void exit();
@@ -31,15 +41,23 @@ public:
 
 private:
     static constexpr std::chrono::milliseconds UPDATE_RATE_MS{ 10 };
+    static constexpr std::string_view COUNTER_TOPIC_NAME = "example/counter";
+    static constexpr uint32_t COUNTER_TOPIC = bm::core::Middleware::topic_id( COUNTER_TOPIC_NAME );
+
+    // Echoes a flood keeps outstanding, like ping -f it also sends one every update when replies stop
+    static constexpr uint32_t PING_FLOOD_WINDOW = 32;
 
     void handle_signal( const boost::system::error_code& error, int signal_id );
     void update_handler( const boost::system::error_code& ec );
 
     void update();
 
-    void process_frame( char* data, ssize_t len );
 
     void send_bcmp_heartbeat();
+    void publish_counter();
+    void send_pings( std::chrono::steady_clock::time_point now );
+    std::string ping_summary() const;
+    std::string counter_holders() const;
 
 
     // Attributes
@@ -52,9 +70,24 @@ private:
     uint64_t                        _node_id;
     std::string                     _net_if_id;
     EAppMode                        _app_mode;
+    bm::core::NetDeviceConfig       _dev_config;
 
     std::atomic<int>                _counter_0;
     std::atomic<int>                _counter_1;
+    std::atomic<uint64_t>           _stress_rx_count{ 0 };
+    std::atomic<uint64_t>           _stress_rx_bytes{ 0 };
+
+    PingConfig                      _ping_config;
+    in6_addr                        _ping_target{};
+    uint16_t                        _ping_id = 0;
+    std::atomic<uint32_t>           _ping_sent{ 0 };
+    std::atomic<uint32_t>           _ping_received{ 0 };
+    std::chrono::steady_clock::time_point _ping_next;
+    std::chrono::steady_clock::time_point _ping_last_sent;
+    bool                            _ping_done = false;
+
+    // Round trips without the responder's turnaround, i.e. per-hop latency
+    bm::core::LatencyHistogram      _ping_latency;
 
     ftxui::ScreenInteractive screen_;
 
@@ -62,16 +95,13 @@ private:
     std::vector<std::string> menu_entries_;
 
     std::unique_ptr<bm::core::Node> _node;
+    std::unique_ptr<bm::core::ReactorPool> _rx_pool;
     int selected_ = 0;
 
     std::vector<std::string> log_buffer_;
 
     std::thread ftxui_thread_;
-    std::thread reader_thread_;
 
     std::chrono::steady_clock::time_point _last_hb;
-
-    char input_buffer_[1600];
-    char output_buffer_[1600];
     
 };
\ No newline at end of file
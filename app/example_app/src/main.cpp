@@ -5,6 +5,7 @@
 
 // -n 0xDEADBEEFDEAD0001 -i enx001ec0d1b1a9 -m pub
 // -n 0xDEADBEEFDEAD0002 -i enx001ec0d1c003 -m sub
+// -n 0xDEADBEEFDEAD0003 -i enx001ec0d1c003 -m ping --ping-target 0xDEADBEEFDEAD0001 --ping-interval 0 --ping-count 100000
 
 namespace po = boost::program_options;
 
@@ -29,7 +30,19 @@ auto main(int argc, char ** argv) -> int
             ( "log-level,l",    po::value<std::string>()->default_value( "info" ),  "Logging level" )
             ( "node-id,n",      po::value<std::string>()->default_value( "" ),      "64-bit Node ID" )
             ( "interface,i",    po::value<std::string>()->required(),               "Network Interface ID to create Raw Socket on (ex: 'eth0')" )
-            ( "mode,m",         po::value<std::string>()->required(),               "ExampleApp mode [pub/sub]" );
+            ( "mode,m",         po::value<std::string>()->required(),               "ExampleApp mode [pub/sub/ping]" )
+            ( "ping-target",    po::value<std::string>()->default_value( "" ),      "64-bit Node ID to ping in ping mode" )
+            ( "ping-count",     po::value<uint32_t>()->default_value( 0 ),          "Echo requests to send, 0 until exit" )
+            ( "ping-interval",  po::value<uint32_t>()->default_value( 1000 ),       "Echo request interval in ms, 0 floods" )
+            ( "ping-size",      po::value<size_t>()->default_value( bm::core::Echo::MIN_PAYLOAD ), "Echo payload bytes, including the timestamp" )
+            ( "rx-ring",                                                            "Receive frames through a memory-mapped TPACKET_V3 ring" )
+            ( "rx-block-timeout", po::value<uint32_t>()->default_value( 10 ),       "RX ring block retire timeout in ms" )
+            ( "tx-ring",                                                            "Transmit frames through a memory-mapped TX ring" )
+            ( "xdp",                                                                "Use an AF_XDP socket (generic mode) instead of AF_PACKET" )
+            ( "io-uring",                                                           "Move frames through io_uring instead of recvmmsg/sendmmsg" )
+            ( "rx-workers",     po::value<uint32_t>()->default_value( 1 ),          "Receive worker threads, more than 1 enables PACKET_FANOUT" )
+            ( "fanout-mode",    po::value<std::string>()->default_value( "hash" ),  "PACKET_FANOUT mode [hash/cpu]" )
+            ( "promiscuous",                                                        "Receive all traffic on the interface (sniffing only)" );
 
         // Parse command line options
         po::store( po::parse_command_line( argc, argv, options ), arg_map );
@@ -51,8 +64,35 @@ auto main(int argc, char ** argv) -> int
             auto interface  = arg_map["interface"].as<std::string>();
             auto mode       = arg_map["mode"].as<std::string>();
 
+            bm::core::NetDeviceConfig dev_config;
+            dev_config.rx_ring.enabled          = arg_map.count( "rx-ring" ) > 0;
+            dev_config.rx_ring.block_timeout_ms = arg_map["rx-block-timeout"].as<uint32_t>();
+            dev_config.tx_ring.enabled          = arg_map.count( "tx-ring" ) > 0;
+            dev_config.promiscuous              = arg_map.count( "promiscuous" ) > 0;
+            if( arg_map.count( "xdp" ) ) {
+                dev_config.backend = bm::core::NetDeviceBackend::XDP_SOCKET;
+            }
+            if( arg_map.count( "io-uring" ) ) {
+                dev_config.io_engine = bm::core::IoEngine::IO_URING;
+            }
+
+            dev_config.fanout.workers = arg_map["rx-workers"].as<uint32_t>();
+            auto fanout_mode = arg_map["fanout-mode"].as<std::string>();
+            if( fanout_mode == "cpu" ) {
+                dev_config.fanout.mode = bm::core::FanoutMode::CPU;
+            }
+            else if( fanout_mode != "hash" ) {
+                throw std::invalid_argument( "Unsupported fanout mode: " + fanout_mode );
+            }
+
+            PingConfig ping_config;
+            ping_config.target      = arg_map["ping-target"].as<std::string>();
+            ping_config.count       = arg_map["ping-count"].as<uint32_t>();
+            ping_config.interval    = std::chrono::milliseconds( arg_map["ping-interval"].as<uint32_t>() );
+            ping_config.size        = arg_map["ping-size"].as<size_t>();
+
             // Create node
-            auto app = std::make_shared<ExampleApp>( node_id, interface, mode );
+            auto app = std::make_shared<ExampleApp>( node_id, interface, mode, dev_config, ping_config );
 
             app->run();
         }
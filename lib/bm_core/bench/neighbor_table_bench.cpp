@@ -0,0 +1,123 @@
+// Lookup, iteration and snapshot speed of NeighborMap against the std::unordered_map it replaced, at 10, 1k and 100k
+// neighbors. Hits on the unordered_map go through count() then at(), as NeighborTable used to.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "bm_core/neighbor_table.hpp"
+
+namespace {
+
+using namespace bm::core;
+using Clock = std::chrono::steady_clock;
+using LegacyMap = std::unordered_map<NodeId, NeighborEntry>;
+
+constexpr size_t LOOKUPS = 1 << 20;
+
+// Nanoseconds per operation of fn, run ops times
+template <typename Fn>
+double measure( size_t ops, Fn fn )
+{
+    auto start = Clock::now();
+    fn();
+    return std::chrono::duration<double, std::nano>( Clock::now() - start ).count() / ops;
+}
+
+}
+
+int main()
+{
+    uint64_t sink = 0;
+
+    std::printf( "%9s  %21s  %21s  %21s  %23s\n", "neighbors", "hit lookup ns", "miss lookup ns",
+                 "iterate ns/entry", "snapshot copy us" );
+    std::printf( "%9s  %10s %10s  %10s %10s  %10s %10s  %11s %11s\n", "", "flat", "unordered", "flat", "unordered",
+                 "flat", "unordered", "flat", "unordered" );
+
+    for( size_t n : { 10ul, 1000ul, 100000ul } ) {
+        std::mt19937_64 rng( n );
+        std::vector<NodeId> ids( n );
+        for( auto& id : ids ) {
+            id = rng();
+        }
+
+        NeighborMap flat;
+        LegacyMap legacy;
+        for( NodeId id : ids ) {
+            NeighborEntry entry{};
+            entry.node_id = id;
+            entry.liveliness_lease_dur_ms = 1;
+            flat.insert( entry );
+            legacy[ id ] = entry;
+        }
+
+        // Random IDs of present neighbors; flipping the low bit of a random 64-bit ID makes a miss
+        std::vector<NodeId> queries( LOOKUPS );
+        for( auto& q : queries ) {
+            q = ids[ rng() % n ];
+        }
+
+        double flat_hit = measure( LOOKUPS, [&]{
+            for( NodeId q : queries ) {
+                sink += flat.find( q )->liveliness_lease_dur_ms;
+            }
+        });
+        double legacy_hit = measure( LOOKUPS, [&]{
+            for( NodeId q : queries ) {
+                if( legacy.count( q ) ) {
+                    sink += legacy.at( q ).liveliness_lease_dur_ms;
+                }
+            }
+        });
+        double flat_miss = measure( LOOKUPS, [&]{
+            for( NodeId q : queries ) {
+                sink += flat.find( q ^ 1 ) != nullptr;
+            }
+        });
+        double legacy_miss = measure( LOOKUPS, [&]{
+            for( NodeId q : queries ) {
+                sink += legacy.count( q ^ 1 );
+            }
+        });
+
+        size_t passes = 20000000 / n;
+        double flat_iterate = measure( passes * n, [&]{
+            for( size_t i = 0; i < passes; i++ ) {
+                for( const auto& entry : flat ) {
+                    sink += entry.liveliness_lease_dur_ms;
+                }
+            }
+        });
+        double legacy_iterate = measure( passes * n, [&]{
+            for( size_t i = 0; i < passes; i++ ) {
+                for( const auto& kv : legacy ) {
+                    sink += kv.second.liveliness_lease_dur_ms;
+                }
+            }
+        });
+
+        // What NeighborTable::publish() does per change
+        size_t copies = std::max<size_t>( 1, 2000000 / n );
+        double flat_copy = measure( copies, [&]{
+            for( size_t i = 0; i < copies; i++ ) {
+                sink += std::make_shared<const NeighborMap>( flat )->size();
+            }
+        }) / 1000;
+        double legacy_copy = measure( copies, [&]{
+            for( size_t i = 0; i < copies; i++ ) {
+                sink += std::make_shared<const LegacyMap>( legacy )->size();
+            }
+        }) / 1000;
+
+        std::printf( "%9zu  %10.1f %10.1f  %10.1f %10.1f  %10.2f %10.2f  %11.1f %11.1f\n", n, flat_hit, legacy_hit,
+                     flat_miss, legacy_miss, flat_iterate, legacy_iterate, flat_copy, legacy_copy );
+    }
+
+    // Keeps the loops from being optimized away
+    return sink == 0 ? 1 : 0;
+}
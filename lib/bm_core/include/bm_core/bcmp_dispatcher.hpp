@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <functional>
+
+#include <netinet/ip6.h>
+
+#include "bcmp_messages.hpp"
+#include "network_device.hpp"
+
+namespace bm {
+namespace core {
+
+// A received BCMP message. Only valid for the duration of the handler call.
+struct BcmpMessage {
+    NetworkDevice&          dev;
+    uint8_t                 ingress_port;   // 1-based BM port
+    const ip6_hdr&          ip6;
+    const bcmp_header_t&    header;
+    const uint8_t*          payload;        // After the BCMP header
+    size_t                  len;
+};
+
+// Dense table from BCMP message type to handler. Every type owns one slot of a 256-entry array holding the handler
+// and the shortest payload it accepts, so dispatch is an index plus one length compare. Handlers must be registered
+// before frames are received; dispatch may then run on any number of receive workers.
+class BcmpDispatcher {
+public:
+    static constexpr size_t TABLE_SIZE = 256;
+    static constexpr size_t MAX_PAYLOAD = NetworkDevice::BM_MTU - sizeof( ip6_hdr ) - sizeof( bcmp_header_t );
+
+    using Handler = std::function<void( const BcmpMessage& msg )>;
+
+    // Fails for types outside the table and minimum lengths no BCMP message can reach. Replaces any earlier handler.
+    bool register_handler( uint16_t type, size_t min_len, Handler handler );
+
+    // Typed handler: the payload must hold at least a T, which is copied out so handlers need not care about
+    // alignment. Trailing bytes are still available through msg.payload/msg.len.
+    template<typename T, typename F>
+    bool register_handler( uint16_t type, F handler )
+    {
+        return register_handler( type, sizeof( T ), [handler]( const BcmpMessage& msg ){
+            T payload;
+            std::memcpy( &payload, msg.payload, sizeof( T ) );
+            handler( msg, payload );
+        });
+    }
+
+    void unregister_handler( uint16_t type );
+
+    // Called for types without a handler
+    void set_default_handler( Handler handler ) { _default = std::move( handler ); }
+
+    // Returns false if the message was dropped as too short or nobody handled it
+    bool dispatch( const BcmpMessage& msg ) const;
+
+    uint64_t dropped_short() const { return _dropped_short.load( std::memory_order_relaxed ); }
+    uint64_t unhandled() const { return _unhandled.load( std::memory_order_relaxed ); }
+
+private:
+    struct Entry {
+        Handler     handler;
+        uint32_t    min_len = 0;
+    };
+
+    std::array<Entry, TABLE_SIZE>   _table;
+    Handler                         _default;
+
+    mutable std::atomic<uint64_t>   _dropped_short{ 0 };
+    mutable std::atomic<uint64_t>   _unhandled{ 0 };
+};
+
+}
+}
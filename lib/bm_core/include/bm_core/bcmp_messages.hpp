@@ -12,6 +12,29 @@ typedef struct {
   uint8_t rsvd;
 } __attribute__((packed)) bcmp_header_t;
 
+// bcmp_header_t flags
+typedef enum {
+  // Sequenced and acknowledged, a bcmp_reliable_header_t follows the header
+  BCMP_FLAG_RELIABLE = 0x01,
+} bcmp_header_flags_t;
+
+// Precedes the payload of reliable messages, and of datagrams on reliable UDP ports
+typedef struct {
+  uint32_t seq;
+
+  // Oldest sequence number the sender has not seen acknowledged. Everything before it was delivered, which lets a
+  // receiver that lost its state, or never saw the start of the stream, pick it up again.
+  uint32_t base;
+} __attribute__((packed)) bcmp_reliable_header_t;
+
+typedef struct {
+  // Every sequence number before this one has been received
+  uint32_t cumulative_seq;
+
+  // Bit i set: cumulative_seq + i has been received as well (selective ACK)
+  uint32_t sack_bitmap;
+} __attribute__((packed)) bcmp_ack_t;
+
 typedef struct {
   // Microseconds since system has last reset/powered on.
   uint64_t time_since_boot_us;
@@ -20,6 +43,180 @@ typedef struct {
   uint32_t liveliness_lease_dur_s;
 } __attribute__((packed)) bcmp_heartbeat_t;
 
+// Followed by payload_len bytes, which the reply carries back unchanged
+typedef struct {
+  // Node that should answer, 0 for every node the request reaches
+  uint64_t target_node_id;
+  uint16_t id;
+  uint16_t seq_num;
+  uint16_t payload_len;
+} __attribute__((packed)) bcmp_echo_request_t;
+
+// Followed by the request's payload
+typedef struct {
+  uint64_t node_id;
+  uint16_t id;
+  uint16_t seq_num;
+
+  // Nanoseconds from receiving the request to sending the reply, saturating. The sender takes it out of the round
+  // trip to get the time spent on the network.
+  uint32_t turnaround_ns;
+  uint16_t payload_len;
+} __attribute__((packed)) bcmp_echo_reply_t;
+
+typedef struct {
+  // Node that should answer, 0 for every node the request reaches
+  uint64_t target_node_id;
+} __attribute__((packed)) bcmp_neighbor_table_request_t;
+
+typedef struct {
+  uint64_t node_id;
+
+  // Local port the neighbor was heard on. Heartbeats do not say which port they left from.
+  uint8_t port;
+} __attribute__((packed)) bcmp_neighbor_info_t;
+
+// Answers a request, or announces a change to all nodes. Followed by neighbor_count bcmp_neighbor_info_t.
+typedef struct {
+  uint64_t node_id;
+
+  // Changes whenever the node's set of neighbors does, so an announcement that is older than what a receiver
+  // already has can be told apart
+  uint32_t version;
+  uint16_t neighbor_count;
+} __attribute__((packed)) bcmp_neighbor_table_reply_t;
+
+// bcmp_resource_t flags. None set means the resource was removed.
+typedef enum {
+  BCMP_RESOURCE_PUBLISHER = 0x01,
+  BCMP_RESOURCE_SUBSCRIBER = 0x02,
+} bcmp_resource_flags_t;
+
+// Followed by name_len bytes of resource (topic) name
+typedef struct {
+  uint8_t flags;
+  uint8_t name_len;
+} __attribute__((packed)) bcmp_resource_t;
+
+// bcmp_resource_table_request_t and bcmp_resource_table_reply_t flags
+typedef enum {
+  // Request: the requester holds no table for the node. Reply: the whole table, not changes.
+  BCMP_RESOURCE_TABLE_FULL = 0x01,
+} bcmp_resource_table_flags_t;
+
+typedef struct {
+  uint64_t target_node_id;
+
+  // The table the requester holds, answered with the changes since
+  uint32_t epoch;
+  uint32_t version;
+  uint8_t flags;
+} __attribute__((packed)) bcmp_resource_table_request_t;
+
+// Answers a request, or announces changes to all nodes. Followed by resource_count bcmp_resource_t.
+typedef struct {
+  uint64_t node_id;
+
+  // Random for every start of the node, versions count the changes to its table since
+  uint32_t epoch;
+
+  // The resources that changed after base_version, bringing the table to version. Only to be applied on top of
+  // base_version, unless the reply is FULL.
+  uint32_t base_version;
+  uint32_t version;
+  uint8_t flags;
+
+  // Tables too large for one message are split, every chunk carrying the same header otherwise
+  uint8_t chunk;
+  uint8_t chunks;
+  uint16_t resource_count;
+} __attribute__((packed)) bcmp_resource_table_reply_t;
+
+// Outcome of a DFU transfer, carried by BCMP_DFU_END and BCMP_DFU_ABORT
+typedef enum {
+  BCMP_DFU_STATUS_OK = 0,
+  BCMP_DFU_STATUS_REJECTED = 1,
+  BCMP_DFU_STATUS_CRC_ERROR = 2,
+  BCMP_DFU_STATUS_IO_ERROR = 3,
+  BCMP_DFU_STATUS_BAD_STREAM = 4,
+  BCMP_DFU_STATUS_TIMEOUT = 5,
+  BCMP_DFU_STATUS_ABORTED = 6,
+} bcmp_dfu_status_t;
+
+// bcmp_dfu_start_t flags
+typedef enum {
+  // Offered to every node at once. Repeated to poll the receivers, which answer with what they are missing.
+  BCMP_DFU_FLAG_MULTICAST = 0x01,
+
+  // The sender can send a patch instead of the image: the receiver reports the image it has, if any
+  BCMP_DFU_FLAG_HAS_BASES = 0x02,
+
+  // The stream is a patch against the base image described by the bcmp_dfu_base_t after the name
+  BCMP_DFU_FLAG_DELTA = 0x04,
+} bcmp_dfu_start_flags_t;
+
+// An image a patch applies to, identified by its size and CRC
+typedef struct {
+  uint32_t size;
+  uint32_t crc;
+} __attribute__((packed)) bcmp_dfu_base_t;
+
+// Offers an image to a node. Followed by name_len bytes of image name.
+typedef struct {
+  uint32_t session_id;
+  uint32_t image_size;
+  uint32_t image_crc;
+
+  // The image is sent as a stream of compressed segments, in payloads of chunk_size bytes but for the last one
+  uint32_t stream_size;
+  uint16_t chunk_size;
+  uint8_t flags;
+  uint8_t name_len;
+} __attribute__((packed)) bcmp_dfu_start_t;
+
+// Accepts an offer: the sender is to stream from offset on, keeping at most window payloads unacknowledged. Offset
+// is 0 for a new transfer, or where an interrupted one can be resumed.
+//
+// For a multicast offer, where payloads start at multiples of chunk_size, it can be followed by a bitmap instead,
+// answering a poll: bit i (LSB first) set means the i-th payload from the one holding offset on is missing.
+// Payloads past the bitmap are not requested.
+//
+// Accepting a HAS_BASES offer from offset 0, it is followed by a bcmp_dfu_base_t for the image the receiver has,
+// which the sender can answer with a DELTA offer under the same session.
+typedef struct {
+  uint32_t session_id;
+  uint32_t offset;
+  uint16_t window;
+} __attribute__((packed)) bcmp_dfu_payload_req_t;
+
+// Followed by the stream's bytes from offset on
+typedef struct {
+  uint32_t session_id;
+  uint32_t offset;
+} __attribute__((packed)) bcmp_dfu_payload_t;
+
+typedef struct {
+  uint32_t session_id;
+
+  // Every byte of the stream before offset has been received
+  uint32_t offset;
+
+  // Bit i set: the payload at offset + i * chunk_size has been received as well
+  uint32_t sack_bitmap;
+} __attribute__((packed)) bcmp_dfu_ack_t;
+
+// From the receiver, once the whole stream is in
+typedef struct {
+  uint32_t session_id;
+  uint8_t status;
+} __attribute__((packed)) bcmp_dfu_end_t;
+
+// Either side giving up on a transfer
+typedef struct {
+  uint32_t session_id;
+  uint8_t status;
+} __attribute__((packed)) bcmp_dfu_abort_t;
+
 
 typedef enum {
   BCMP_ACK = 0x00,
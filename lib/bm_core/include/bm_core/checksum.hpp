@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <netinet/in.h>
+
+namespace bm {
+namespace core {
+
+// Internet checksum (RFC 1071). Partial sums are accumulated over 16-bit words as they sit in memory, which keeps
+// them byte order independent, and folded once at the end. Every chunk except the last must have an even length.
+
+// Add len bytes at data to a partial sum
+uint64_t inet_checksum_add( const void* data, size_t len, uint64_t sum = 0 );
+
+// Copy len bytes from src to dst and add them to a partial sum in the same pass
+uint64_t inet_checksum_copy( void* dst, const void* src, size_t len, uint64_t sum = 0 );
+
+// Partial sum of the IPv6 pseudo header (RFC 8200 section 8.1)
+uint64_t ip6_pseudo_header_sum( const in6_addr& src, const in6_addr& dst, uint32_t upper_layer_len, uint8_t next_header );
+
+// Fold a partial sum and complement it, ready to be stored in a header as is
+uint16_t inet_checksum_finish( uint64_t sum );
+
+}
+}
@@ -8,5 +8,10 @@ namespace core {
 // Types
 typedef uint64_t NodeId;
 
+// Well-known Bristlemouth UDP ports
+static constexpr uint16_t BM_MIDDLEWARE_PORT    = 4321;
+static constexpr uint16_t BM_BCL_PORT           = 2222;
+static constexpr uint16_t STRESS_TEST_PORT      = 12357;
+
 }
 }
\ No newline at end of file
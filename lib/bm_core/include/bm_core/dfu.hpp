@@ -0,0 +1,331 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <concurrentqueue.h>
+
+#include <netinet/in.h>
+#include <zlib.h>
+
+#include "bcmp_dispatcher.hpp"
+#include "bcmp_messages.hpp"
+#include "common.hpp"
+#include "dfu_patch.hpp"
+#include "dfu_stream.hpp"
+#include "pbuf.hpp"
+
+namespace bm {
+namespace core {
+
+class NetworkInterface;
+
+// An image offered to us
+struct DfuOffer {
+    NodeId      sender;
+    uint32_t    session_id;
+    std::string name;           // As the sender named it, not a path
+    uint32_t    image_size;
+    uint32_t    image_crc;
+    std::string path;           // Where it is written, once accepted
+};
+
+// Device firmware update, on Linux nodes the transfer of an image file from one node to another.
+//
+// The sender compresses the image into a DfuStream and offers it with BCMP_DFU_START; the receiver accepts with a
+// BCMP_DFU_PAYLOAD_REQ naming the offset to stream from. From there the sender keeps up to WINDOW payloads in
+// flight instead of waiting out a round trip per payload. The receiver acknowledges what it holds once per update,
+// cumulatively plus a selective bitmap, and the sender resends a payload as soon as one sent after it got through,
+// or when its retransmission timeout runs out.
+//
+// The receiver buffers payloads arriving out of order and feeds the stream, in order, through inflate and a running
+// CRC straight into <path>.part. After every segment it records the stream offset, image offset and CRC reached in
+// <path>.dfu, so an interrupted transfer of the same image resumes from the last complete segment rather than from
+// the start. At the end of the stream the CRC is checked and the file renamed to path.
+//
+// To update many nodes the image can be multicast instead, at the cost of one transfer rather than one per node. The
+// offer goes to every node and each accepts on its own, possibly resuming. Payloads are then multicast in bursts
+// without waiting for acknowledgements, and receivers put the ones arriving ahead of a gap aside in <path>.stream.
+// Once everything anyone asked for went out, the sender repeats the offer as a poll, and every few seconds before
+// that to hear from the targets during a long pass; a receiver answers with a bitmap of the payloads it is missing,
+// or END. The sender merges the bitmaps and multicasts only that union again, so a payload lost by many receivers
+// is still sent once, until every target has finished.
+//
+// A unicast transfer can also send a patch against the image the receiver already has. The sender is given the
+// images it could patch against, and says so in the offer; a receiver holding a file at the accepted path reports
+// its size and CRC instead of accepting. If that is one of the sender's, and the DfuPatch against it makes a smaller
+// stream, the sender offers the patch under the same session, otherwise the whole image again. The receiver applies
+// the patch as it is decoded, copying from the old file into <path>.part, and resumes like any other transfer.
+//
+// Messages are only queued by the receive workers; every file operation and transmission happens in update(), on
+// the owning thread, and so do the handlers.
+class Dfu {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Outcome of one of our transfers
+    using SendHandler = std::function<void( uint32_t session_id, bcmp_dfu_status_t status )>;
+
+    // Decides on an offer: the path to write the image to, or an empty string to reject it
+    using AcceptHandler = std::function<std::string( const DfuOffer& offer )>;
+
+    // Outcome of an accepted transfer
+    using ReceiveHandler = std::function<void( const DfuOffer& offer, bcmp_dfu_status_t status )>;
+
+    // Outcome of a multicast transfer, per target
+    using Results = std::unordered_map<NodeId, bcmp_dfu_status_t>;
+    using MulticastHandler = std::function<void( uint32_t session_id, const Results& results )>;
+
+    static constexpr uint16_t CHUNK_SIZE = BcmpDispatcher::MAX_PAYLOAD - sizeof( bcmp_dfu_payload_t );
+
+    // Payloads in flight, as many as an acknowledgement's bitmap covers
+    static constexpr uint16_t WINDOW = 32;
+
+    static constexpr std::chrono::milliseconds INITIAL_RTO{ 200 };
+    static constexpr std::chrono::milliseconds MIN_RTO{ 50 };
+    static constexpr std::chrono::milliseconds MAX_RTO{ 2000 };
+
+    // A transfer without progress for this long is given up; a finished one is remembered as long for late repeats
+    static constexpr std::chrono::seconds IDLE_TIMEOUT{ 30 };
+
+    // Payloads multicast per update, which paces a multicast transfer in place of a window
+    static constexpr size_t MULTICAST_BURST = WINDOW;
+
+    // Between polls of multicast receivers once there is nothing left to send
+    static constexpr std::chrono::milliseconds POLL_INTERVAL{ 200 };
+
+    // Between polls while payloads are still going out. Targets are only heard from when polled, so this keeps a
+    // pass longer than IDLE_TIMEOUT from timing them all out.
+    static constexpr std::chrono::seconds PASS_POLL_INTERVAL{ 5 };
+
+    // Registers the DFU message handlers on the interface
+    explicit Dfu( NetworkInterface& net );
+    ~Dfu();
+
+    Dfu( const Dfu& ) = delete;
+    Dfu& operator=( const Dfu& ) = delete;
+
+    // Offer the file at path to dst, owning thread. The file is read and compressed here. Returns the session ID,
+    // or 0 with errno set if it could not be read. done is called from update() with the outcome.
+    //
+    // bases are earlier versions of the image the receiver may have, to send a patch against instead. The patches
+    // are made here as well, which for large images takes a while, and kept if they are smaller than the image.
+    // Bases that cannot be read are left out.
+    uint32_t send( const in6_addr& dst, const std::string& path, SendHandler done = nullptr,
+                   const std::vector<std::string>& bases = {} );
+
+    // Offer the file at path to every node at once and multicast it. Other nodes may accept it as well, but the
+    // transfer is over, and done called from update(), once each of the targets finished or timed out. Returns the
+    // session ID, or 0 with errno set.
+    uint32_t multicast( const std::vector<NodeId>& targets, const std::string& path, MulticastHandler done = nullptr );
+
+    // Stop sending, without calling the handler
+    void cancel( uint32_t session_id );
+
+    // Stream bytes acknowledged and the stream's size, false for an unknown or multicast session. Owning thread.
+    bool progress( uint32_t session_id, uint32_t& acked, uint32_t& total ) const;
+
+    // Without an accept handler every offer is rejected. Set before the receive workers start.
+    void set_accept_handler( AcceptHandler handler ) { _accept_handler = std::move( handler ); }
+    void set_receive_handler( ReceiveHandler handler ) { _receive_handler = std::move( handler ); }
+
+    // Owning thread: handle what was received, send payloads and acknowledgements, time out transfers
+    void update( Clock::time_point now );
+
+    uint64_t retransmits() const { return _retransmits; }
+
+private:
+    // A message as received, copied out of the receive buffer
+    struct Message {
+        in6_addr    src;
+        bool        multicast;
+        uint16_t    type;
+        PbufPtr     pbuf;
+    };
+
+    // An image the receiver may have, and the patch against it
+    struct Base {
+        std::string     path;
+        bcmp_dfu_base_t id;
+        DfuStream       patch;
+    };
+
+    struct Outgoing {
+        in6_addr    dst;
+        std::string path;
+        std::string name;
+        SendHandler done;
+        DfuStream   stream;
+
+        // Until the receiver reported its image. Then stream may be a patch against base.
+        std::vector<Base>   bases;
+        bool                delta = false;
+        bcmp_dfu_base_t     base{};
+
+        bool        accepted = false;
+        uint32_t    origin = 0;         // Offset the receiver asked for, payloads start there
+        uint32_t    acked = 0;          // Everything before was received
+        uint32_t    next = 0;           // Next offset not sent yet
+
+        // Per payload in flight, by slot()
+        std::array<Clock::time_point, WINDOW>   sent{};
+        std::array<uint8_t, WINDOW>             transmissions{};
+        std::bitset<WINDOW>                     sacked;
+
+        Clock::time_point   delivered{};        // When the latest payload known to be received was sent
+        Clock::time_point   last_sent{};
+        Clock::time_point   progress{};
+        Clock::duration     srtt{};
+        Clock::duration     rto{ INITIAL_RTO };
+
+        size_t slot( uint32_t offset ) const { return ( ( offset - origin ) / CHUNK_SIZE ) % WINDOW; }
+    };
+
+    struct Target {
+        bool                finished = false;
+        bcmp_dfu_status_t   status = BCMP_DFU_STATUS_TIMEOUT;
+        Clock::time_point   heard{};
+    };
+
+    struct Multicast {
+        std::string         name;
+        MulticastHandler    done;
+        DfuStream           stream;
+        std::unordered_map<NodeId, Target>  targets;
+        size_t              unfinished = 0;
+
+        // Per payload: asked for by some receiver and not multicast since, and multicast at least once
+        std::vector<bool>   needed;
+        std::vector<bool>   sent;
+        size_t              pending = 0;        // Needed
+        size_t              cursor = 0;
+        Clock::time_point   last_poll{};
+    };
+
+    // What <path>.dfu holds, the last segment boundary reached
+    struct ResumeState {
+        uint32_t    magic;
+        uint32_t    image_size;
+        uint32_t    image_crc;
+        uint32_t    stream_size;
+        uint32_t    stream_offset;
+        uint32_t    image_offset;
+        uint32_t    crc;
+        uint32_t    base_crc;           // Of the image patched, 0 for a whole image
+        uint32_t    decoded_offset;     // Of the patch, image_offset for a whole image
+    };
+
+    struct Incoming {
+        in6_addr        src;
+        DfuOffer        offer;
+        uint32_t        stream_size = 0;
+        uint16_t        chunk_size = 0;
+
+        int             fd = -1;
+        int             state_fd = -1;
+        std::unique_ptr<DfuStreamDecoder>   decoder;
+
+        // The stream is a patch against the file at path, as it was
+        bool            delta = false;
+        bcmp_dfu_base_t base{};
+        int             base_fd = -1;
+        std::unique_ptr<DfuPatchApplier>    patch;
+
+        uLong           crc = 0;
+        bool            write_failed = false;
+        ResumeState     resume{};
+        bool            resume_dirty = false;
+
+        uint32_t        origin = 0;
+        uint32_t        received = 0;       // Everything before was fed to the decoder
+        std::array<PbufPtr, WINDOW>     pending;        // Received out of order, by slot()
+        bool            ack_due = false;
+
+        // Multicast: payloads ahead of received are written to <path>.stream, at their stream offset
+        bool                multicast = false;
+        int                 spill_fd = -1;
+        std::vector<bool>   spilled;
+
+        bool                finished = false;
+        bcmp_dfu_status_t   status = BCMP_DFU_STATUS_OK;
+        Clock::time_point   active{};
+
+        size_t slot( uint32_t offset ) const { return ( ( offset - origin ) / chunk_size ) % WINDOW; }
+    };
+
+    using IncomingKey = std::pair<NodeId, uint32_t>;
+
+    // An offer answered with the image we have, waiting for the sender to offer a patch or the whole image
+    struct Reported {
+        in6_addr            src;
+        std::string         path;
+        bcmp_dfu_base_t     base;
+        Clock::time_point   heard;
+    };
+
+    void handle_message( const BcmpMessage& msg );
+    uint32_t new_session_id();
+
+    // Sender
+    void handle_payload_req( const in6_addr& src, const Message& msg, Clock::time_point now );
+    void choose_stream( uint32_t session_id, Outgoing& out, const bcmp_dfu_base_t& base, Clock::time_point now );
+    void handle_ack( const in6_addr& src, const bcmp_dfu_ack_t& ack, Clock::time_point now );
+    void handle_result( const in6_addr& src, uint32_t session_id, uint8_t status );
+    void update_outgoing( uint32_t session_id, Outgoing& out, Clock::time_point now );
+    bool send_offer( uint32_t session_id, const Outgoing& out );
+    bool send_start( uint32_t session_id, const in6_addr& dst, const std::string& name, const DfuStream& stream,
+                     uint8_t flags = 0, const bcmp_dfu_base_t* base = nullptr );
+    bool send_chunk( uint32_t session_id, const in6_addr& dst, const DfuStream& stream, uint32_t offset );
+    bool send_payload( uint32_t session_id, Outgoing& out, uint32_t offset, Clock::time_point now );
+    void finish_outgoing( uint32_t session_id, bcmp_dfu_status_t status );
+
+    // Multicast sender
+    void handle_nack( const in6_addr& src, Multicast& mc, const Message& msg, Clock::time_point now );
+    void handle_target_result( const in6_addr& src, Multicast& mc, uint8_t status );
+    void need( Multicast& mc, size_t chunk );
+    void update_multicast( uint32_t session_id, Multicast& mc, Clock::time_point now );
+
+    // Receiver
+    void handle_start( const in6_addr& src, const Message& msg, Clock::time_point now );
+    void handle_payload( const in6_addr& src, Message& msg, Clock::time_point now );
+    void handle_abort( const in6_addr& src, const bcmp_dfu_abort_t& abort );
+    bool open_incoming( Incoming& in );
+    bool receive_multicast( Incoming& in, uint32_t offset, const uint8_t* data, size_t len );
+    void fail_incoming( std::map<IncomingKey, Incoming>::iterator it );
+    void complete_incoming( Incoming& in, Clock::time_point now );
+    void close_incoming( Incoming& in );
+    void setup_decoder( Incoming& in );
+    void send_base( const IncomingKey& key, const Reported& report );
+    void send_ack( const IncomingKey& key, Incoming& in );
+    void send_nack( const IncomingKey& key, Incoming& in );
+
+    void send_result( const in6_addr& dst, uint16_t type, uint32_t session_id, bcmp_dfu_status_t status );
+
+    NetworkInterface&   _net;
+    AcceptHandler       _accept_handler;
+    ReceiveHandler      _receive_handler;
+
+    // Owning thread
+    std::unordered_map<uint32_t, Outgoing>  _outgoing;
+    std::unordered_map<uint32_t, Multicast> _multicasts;
+    std::map<IncomingKey, Incoming>         _incoming;
+    std::map<IncomingKey, Clock::time_point> _declined;     // Multicast offers, which are polled repeatedly
+    std::map<IncomingKey, Reported>         _reported;
+    std::mt19937                            _rng{ std::random_device{}() };
+    uint64_t                                _retransmits = 0;
+
+    // From the receive workers
+    moodycamel::ConcurrentQueue<Message>    _messages;
+};
+
+}
+}
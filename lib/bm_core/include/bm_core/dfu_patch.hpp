@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dfu_stream.hpp"
+
+namespace bm {
+namespace core {
+
+// A patch rebuilds a new image from a base image the receiver already has: a sequence of COPY ops, each naming a
+// range of the base, and INSERT ops carrying literal bytes. It is sent as the decoded content of a DfuStream, and no
+// op spans two segments, so resuming at a segment boundary also resumes at an op boundary.
+struct DfuPatch {
+    enum Op : uint8_t {
+        COPY = 1,           // uint32_t base offset, uint32_t length
+        INSERT = 2,         // uint32_t length, then the bytes
+    };
+
+    // Matches are found at this granularity, and shorter ones not taken
+    static constexpr size_t BLOCK_SIZE = 32;
+
+    // Diff image against base into stream, with image_size and image_crc those of the image. Blocks of the base are
+    // indexed by a rolling hash, then every offset of the image is looked up, so content that moved is still found.
+    // Matches are extended both ways byte by byte before being emitted as COPY.
+    static void diff( const std::vector<uint8_t>& base, const std::vector<uint8_t>& image, DfuStream& stream );
+};
+
+// Applies a patch in a streaming fashion, as its bytes are decoded, reading COPY ranges from the base file
+class DfuPatchApplier {
+public:
+    using Sink = DfuStreamDecoder::Sink;
+
+    // The new image is limited to image_size bytes
+    DfuPatchApplier( int base_fd, uint32_t base_size, uint32_t image_size, Sink sink );
+
+    // Returns false for a malformed op or when reading the base or the sink failed
+    bool write( const uint8_t* data, size_t len );
+
+    // Between ops, e.g. at the end of a segment
+    bool idle() const { return _header_bytes == 0 && _remaining == 0; }
+
+    uint32_t image_offset() const { return _image_offset; }
+
+    // Resume at an op boundary
+    void reset( uint32_t image_offset );
+
+private:
+    bool copy( uint32_t offset, uint32_t len );
+
+    int         _base_fd;
+    uint32_t    _base_size;
+    uint32_t    _image_size;
+    Sink        _sink;
+
+    uint32_t    _image_offset = 0;
+    uint8_t     _header[ 9 ];
+    size_t      _header_bytes = 0;
+    uint32_t    _remaining = 0;         // Of an INSERT
+};
+
+}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+namespace bm {
+namespace core {
+
+// DFU images travel as a stream of segments, each holding up to SEGMENT_SIZE bytes of the image as its own raw
+// deflate stream (or stored, where deflate doesn't help) behind a 4-byte little-endian header: the segment's length
+// on the wire, with SEGMENT_STORED set for stored segments. Every segment starts with an empty dictionary, the same
+// as a full flush, so a receiver can pick the stream up again at any segment boundary after a restart.
+struct DfuStream {
+    static constexpr size_t SEGMENT_SIZE = 32 * 1024;
+    static constexpr size_t HEADER_SIZE = sizeof( uint32_t );
+    static constexpr uint32_t SEGMENT_STORED = 0x80000000;
+
+    std::vector<uint8_t>    data;
+    uint32_t                image_size = 0;
+    uint32_t                image_crc = 0;      // CRC-32 of the image
+
+    // Read and compress a whole file. Returns false with errno set if it can't be read or is 4 GiB or more.
+    static bool encode( const std::string& path, DfuStream& stream );
+};
+
+// Builds a stream from bytes written in order, cutting a segment every SEGMENT_SIZE bytes or where flushed
+class DfuStreamEncoder {
+public:
+    explicit DfuStreamEncoder( std::vector<uint8_t>& stream );
+    ~DfuStreamEncoder();
+
+    DfuStreamEncoder( const DfuStreamEncoder& ) = delete;
+    DfuStreamEncoder& operator=( const DfuStreamEncoder& ) = delete;
+
+    void write( const uint8_t* data, size_t len );
+
+    // Bytes the current segment still takes
+    size_t room() const { return DfuStream::SEGMENT_SIZE - _segment.size(); }
+
+    // End the current segment, e.g. before data that should start one
+    void flush();
+
+private:
+    std::vector<uint8_t>&   _stream;
+    std::vector<uint8_t>    _segment;
+    std::vector<uint8_t>    _compressed;
+    z_stream                _zs{};
+};
+
+// Turns segments back into image bytes as they arrive, in order but in pieces of any size.
+class DfuStreamDecoder {
+public:
+    // Image bytes out. Returning false stops decoding.
+    using Sink = std::function<bool( const uint8_t* data, size_t len )>;
+
+    // Called after every complete segment, a point to resume from
+    using SegmentHandler = std::function<void()>;
+
+    DfuStreamDecoder( Sink sink, SegmentHandler on_segment = nullptr );
+    ~DfuStreamDecoder();
+
+    DfuStreamDecoder( const DfuStreamDecoder& ) = delete;
+    DfuStreamDecoder& operator=( const DfuStreamDecoder& ) = delete;
+
+    // Start over at a segment boundary, which must be where the given offsets were reached
+    void reset( uint32_t stream_offset = 0, uint32_t image_offset = 0 );
+
+    // Returns false for a malformed segment or when the sink failed
+    bool write( const uint8_t* data, size_t len );
+
+    uint32_t stream_offset() const { return _stream_offset; }
+    uint32_t image_offset() const { return _image_offset; }
+
+    // Between segments
+    bool at_boundary() const { return _header_bytes == 0 && _remaining == 0; }
+
+private:
+    bool finish_segment();
+
+    Sink            _sink;
+    SegmentHandler  _on_segment;
+    z_stream        _zs{};
+
+    uint32_t    _stream_offset = 0;
+    uint32_t    _image_offset = 0;
+
+    uint8_t     _header[ DfuStream::HEADER_SIZE ];
+    size_t      _header_bytes = 0;
+    uint32_t    _remaining = 0;         // Of the current segment
+    bool        _stored = false;
+    bool        _ended = false;         // Inflate reached the end of the segment's deflate stream
+    size_t      _segment_out = 0;
+};
+
+}
+}
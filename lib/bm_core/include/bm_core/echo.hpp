@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include <concurrentqueue.h>
+
+#include <netinet/in.h>
+
+#include "bcmp_dispatcher.hpp"
+#include "bcmp_messages.hpp"
+#include "common.hpp"
+#include "pbuf.hpp"
+
+namespace bm {
+namespace core {
+
+class NetworkInterface;
+
+// A reply to one of our echo requests. The message refers to the receive buffer and is only valid during the callback.
+struct EchoReply {
+    NodeId                      node_id;
+    uint16_t                    id;
+    uint16_t                    seq_num;
+    std::chrono::nanoseconds    rtt;            // From sending the request to receiving the reply
+    std::chrono::nanoseconds    turnaround;     // Spent at the responder, part of rtt
+    const BcmpMessage&          msg;
+};
+
+// BCMP echo (ping). Requests are answered for every node on the interface, and replies to ours are timed: the request
+// payload starts with the steady clock time it was sent, which comes back in the reply, so nothing is kept per request
+// and any number may be outstanding.
+//
+// Replies go out from update() on the owning thread, like every other transmission, so a request waits at the
+// responder for up to one update period. The reply says how long, so besides the full round trip the sender gets
+// rtt - turnaround, the time spent on the wire and in the TX/RX paths of both nodes.
+class Echo {
+public:
+    using Clock = std::chrono::steady_clock;
+    using ReplyHandler = std::function<void( const EchoReply& reply )>;
+
+    // The send timestamp
+    static constexpr size_t MIN_PAYLOAD = sizeof( uint64_t );
+
+    // Requests waiting for update(), beyond which they are dropped
+    static constexpr size_t MAX_PENDING = 256;
+
+    // Registers the BCMP_ECHO_REQUEST and BCMP_ECHO_REPLY handlers on the interface
+    explicit Echo( NetworkInterface& net );
+
+    Echo( const Echo& ) = delete;
+    Echo& operator=( const Echo& ) = delete;
+
+    // Send a request with payload_len bytes of payload, at least MIN_PAYLOAD. For multicast every node that receives
+    // it answers. Call from the owning thread. Returns the number of ports sent on, or -1.
+    int send_request( const in6_addr& dst, uint16_t id, uint16_t seq_num, size_t payload_len = MIN_PAYLOAD );
+
+    // Called from the receive worker for each reply to one of our requests. Set before the receive workers start.
+    void set_reply_handler( ReplyHandler handler ) { _reply_handler = std::move( handler ); }
+
+    // Owning thread: answer the requests received since the last update
+    void update();
+
+    uint64_t requests() const { return _requests.load( std::memory_order_relaxed ); }
+    uint64_t dropped() const { return _dropped.load( std::memory_order_relaxed ); }
+
+private:
+    struct PendingReply {
+        PbufPtr             reply;      // bcmp_echo_reply_t and payload
+        in6_addr            dst;
+        Clock::time_point   received;
+    };
+
+    void handle_request( const BcmpMessage& msg, const bcmp_echo_request_t& request );
+    void handle_reply( const BcmpMessage& msg, const bcmp_echo_reply_t& reply );
+
+    NetworkInterface&   _net;
+    ReplyHandler        _reply_handler;
+
+    moodycamel::ConcurrentQueue<PendingReply> _pending;
+
+    std::atomic<uint64_t>   _requests{ 0 };
+    std::atomic<uint64_t>   _dropped{ 0 };
+};
+
+}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+
+#include <linux/io_uring.h>
+
+#include "network_device.hpp"
+
+namespace bm {
+namespace core {
+
+// io_uring frame I/O on a bound packet socket. Receive keeps one multishot recv armed, fed from a provided buffer
+// ring, so a single submission keeps delivering frames. Transmit queues a whole batch of sends and submits and
+// reaps them with one io_uring_enter. RX and TX use separate rings so the receive and send threads never share a
+// completion queue.
+class IoUringEngine {
+public:
+    // Failed recv completions in a row, without a frame between them, before receive is given up on
+    static constexpr uint32_t RECV_FAILURE_LIMIT = 8;
+
+    // Throws std::runtime_error when the kernel lacks io_uring, provided buffer rings or multishot recv
+    IoUringEngine( int sock_fd, const IoUringConfig& config );
+    ~IoUringEngine();
+
+    IoUringEngine( const IoUringEngine& ) = delete;
+    IoUringEngine& operator=( const IoUringEngine& ) = delete;
+
+    // The RX ring fd is readable whenever receive completions are pending
+    int fd() const { return _rx.fd; }
+
+    // Wait up to timeout_ms for frames and pass up to max_frames of them to the handler as views of the provided
+    // buffers, which are recycled afterwards. Returns the number of frames handled, or -1 on timeout/error.
+    // Once recv failed RECV_FAILURE_LIMIT times in a row it is no longer re-armed, and every call returns -1 with
+    // errno set to the failure instead of EAGAIN.
+    ssize_t read_batch( const NetworkDevice::FrameHandler& handler, size_t max_frames, int timeout_ms );
+
+    // Submit one send per frame and wait for all of them with a single io_uring_enter per queue_depth frames.
+    // Returns the number of frames sent, or -1 if none could be. Even when submitting fails partway, nothing is
+    // left in the ring on return, so the frames can be released.
+    ssize_t write_frames( const FrameView* frames, size_t count );
+
+private:
+    struct Ring {
+        int             fd          = -1;
+        uint32_t        entries     = 0;
+
+        void*           sq_map      = nullptr;
+        size_t          sq_map_size = 0;
+        void*           cq_map      = nullptr;
+        size_t          cq_map_size = 0;
+        io_uring_sqe*   sqes        = nullptr;
+        size_t          sqes_size   = 0;
+
+        uint32_t*       sq_head     = nullptr;
+        uint32_t*       sq_tail     = nullptr;
+        uint32_t*       sq_mask     = nullptr;
+        uint32_t*       cq_head     = nullptr;
+        uint32_t*       cq_tail     = nullptr;
+        uint32_t*       cq_mask     = nullptr;
+        io_uring_cqe*   cqes        = nullptr;
+
+        uint32_t        pending     = 0;    // SQEs queued but not yet submitted
+    };
+
+    static void setup_ring( Ring& ring, uint32_t entries, uint32_t cq_entries );
+    static void teardown_ring( Ring& ring );
+    static io_uring_sqe* next_sqe( Ring& ring );
+    static int enter( Ring& ring, uint32_t min_complete );
+
+    void release();
+    void setup_buffers();
+    void arm_recv();
+    void recycle_buffer( uint16_t bid );
+
+    int             _sock_fd;
+    IoUringConfig   _config;
+
+    Ring            _rx;
+    Ring            _tx;
+
+    // Provided buffer ring for receive
+    io_uring_buf_ring*      _buf_ring = nullptr;
+    size_t                  _buf_ring_size = 0;
+    uint16_t                _buf_tail = 0;
+    std::vector<uint8_t>    _buffers;
+    bool                    _recv_armed = false;
+    uint32_t                _recv_failures = 0;     // In a row
+    int                     _recv_error = 0;        // Receive given up on
+};
+
+}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace bm {
+namespace core {
+
+// Latency histogram in the style of HdrHistogram. Values are counted in log-linear buckets: every power of two range
+// is split into SUB_BUCKETS / 2 equal steps, so any value is kept to within 1/64 of itself whether it is a few hundred
+// nanoseconds or several seconds, in a fixed table with no allocation. Recording is a few integer operations and a
+// relaxed atomic increment, safe from any number of threads; the statistics read whatever has been recorded so far.
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 7;
+    static constexpr uint64_t SUB_BUCKETS = 1ull << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKETS = SUB_BUCKETS + ( 64 - SUB_BUCKET_BITS ) * ( SUB_BUCKETS / 2 );
+
+    void record( std::chrono::nanoseconds value );
+
+    uint64_t count() const { return _count.load( std::memory_order_relaxed ); }
+    std::chrono::nanoseconds min() const;
+    std::chrono::nanoseconds max() const;
+    std::chrono::nanoseconds mean() const;
+
+    // Value at a percentile from 0 to 100, reported as the highest value its bucket stands for (and no more than
+    // max()), like HdrHistogram does. Zero while empty.
+    std::chrono::nanoseconds percentile( double percent ) const;
+
+    // Not safe against concurrent record()
+    void reset();
+
+private:
+    static size_t bucket_of( uint64_t value );
+    static uint64_t highest_in( size_t bucket );
+
+    std::array<std::atomic<uint64_t>, BUCKETS> _buckets{};
+    std::atomic<uint64_t> _count{ 0 };
+    std::atomic<uint64_t> _sum{ 0 };
+    std::atomic<uint64_t> _min{ UINT64_MAX };
+    std::atomic<uint64_t> _max{ 0 };
+};
+
+}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <string_view>
+
+#include "common.hpp"
+#include "udp_demux.hpp"
+
+namespace bm {
+namespace core {
+
+class NetworkInterface;
+
+// Header in front of every publication on BM_MIDDLEWARE_PORT
+struct PubSubHeader {
+    uint8_t     version;
+    uint8_t     flags;
+    uint16_t    rsvd;
+    uint32_t    topic_id;
+    uint64_t    node_id;    // Publisher
+} __attribute__((packed));
+
+// A received publication. The payload points into the receive buffer and is only valid during the callback.
+struct PubSubMessage {
+    NodeId              publisher;
+    uint32_t            topic_id;
+    const uint8_t*      payload;
+    size_t              len;
+    const UdpDatagram&  dgram;
+};
+
+// Topic based publish/subscribe over UDP multicast. Topics are identified on the wire by a 32-bit FNV-1a hash of
+// their name, so nodes agree on IDs without any exchange. Publications go to the realm-local all-nodes group and
+// every node looks the topic up in its own subscription index, an open-addressing table kept at most half full so
+// a lookup is almost always a single probe.
+class Middleware {
+public:
+    static constexpr uint8_t VERSION = 1;
+    static constexpr size_t MAX_SUBSCRIPTIONS = 64;
+    static constexpr size_t TABLE_SIZE = MAX_SUBSCRIPTIONS * 2;
+
+    using Callback = std::function<void( const PubSubMessage& msg )>;
+
+    static constexpr uint32_t topic_id( std::string_view topic )
+    {
+        uint32_t hash = 2166136261u;
+        for( char c : topic ) {
+            hash ^= static_cast<uint8_t>( c );
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    // Binds BM_MIDDLEWARE_PORT on the interface
+    Middleware( NetworkInterface& net, NodeId node_id );
+
+    Middleware( const Middleware& ) = delete;
+    Middleware& operator=( const Middleware& ) = delete;
+
+    // Like UDP bindings, subscribe before the receive workers start; callbacks then run on whichever worker received
+    // the publication. Subscribing again replaces the callback. Fails once MAX_SUBSCRIPTIONS topics are subscribed.
+    // Topics subscribed by name are listed in the interface's resource table, so other nodes can find subscribers;
+    // names that are empty or longer than ResourceTable::MAX_NAME_LEN fail without subscribing.
+    bool subscribe( uint32_t topic_id, Callback callback );
+    bool subscribe( std::string_view topic, Callback callback );
+    void unsubscribe( uint32_t topic_id );
+    void unsubscribe( std::string_view topic );
+
+    // List a topic we publish in the resource table, or take it out again. Owning thread.
+    bool advertise( std::string_view topic );
+    void unadvertise( std::string_view topic );
+
+    // Multicast a publication. The header and payload are gathered straight into the frame, so nothing is copied or
+    // allocated on the way. Call from the interface's owning thread. Returns the number of ports sent on, or -1.
+    int publish( uint32_t topic_id, const void* data, size_t len );
+    int publish( std::string_view topic, const void* data, size_t len ) { return publish( topic_id( topic ), data, len ); }
+
+    uint64_t malformed() const { return _malformed.load( std::memory_order_relaxed ); }
+    uint64_t unsubscribed() const { return _unsubscribed.load( std::memory_order_relaxed ); }
+
+private:
+    enum class SlotState : uint8_t { EMPTY, USED, DELETED };
+
+    struct Slot {
+        uint32_t    topic_id = 0;
+        SlotState   state = SlotState::EMPTY;
+        Callback    callback;
+    };
+
+    void handle_datagram( const UdpDatagram& dgram );
+    const Slot* find( uint32_t topic_id ) const;
+
+    NetworkInterface&   _net;
+    NodeId              _node_id;
+
+    std::array<Slot, TABLE_SIZE>    _slots;
+    size_t                          _subscriptions = 0;
+
+    std::atomic<uint64_t>   _malformed{ 0 };
+    std::atomic<uint64_t>   _unsubscribed{ 0 };
+};
+
+}
+}
@@ -3,7 +3,9 @@
 #include "common.hpp"
 
 #include <chrono>
-#include <unordered_map>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 namespace bm {
 namespace core {
@@ -17,16 +19,86 @@ struct NeighborEntry {
     std::chrono::steady_clock::time_point last_heartbeat;
 };
 
+// Three to a 64-byte line, the ports sharing the lease's word
+static_assert( sizeof( NeighborEntry ) == 24, "NeighborEntry should stay compact" );
+
+// Open-addressing hash map from node ID to entry. The entries are kept dense in one array, so iterating and copying
+// the map are straight sequential passes. Lookups probe a separate power-of-two array of 4-byte slots, sixteen to a
+// cache line, each holding 7 bits of its entry's hash and the entry's index; a miss or a collision costs an integer
+// compare instead of a cache miss, and a hit almost always touches a single entry. Erasing moves the last entry into
+// the gap and shifts the following slots back instead of leaving tombstones, so probe lengths stay short under churn.
+class NeighborMap {
+public:
+    using const_iterator = std::vector<NeighborEntry>::const_iterator;
+
+    // Up to 2^24 entries
+    static constexpr size_t MAX_SIZE = 0x00ffffff;
+
+    // The entry stays valid until the next insert or erase
+    const NeighborEntry* find( NodeId id ) const;
+
+    // Inserts or replaces. Throws std::length_error beyond MAX_SIZE.
+    void insert( const NeighborEntry& entry );
+    bool erase( NodeId id );
+    void clear();
+
+    size_t size() const { return _entries.size(); }
+    bool empty() const { return _entries.empty(); }
+    size_t capacity() const { return _slots.size(); }
+
+    const_iterator begin() const { return _entries.begin(); }
+    const_iterator end() const { return _entries.end(); }
+
+private:
+    static constexpr size_t MIN_CAPACITY = 16;
+    static constexpr uint32_t EMPTY = 0;
+    static constexpr uint32_t INDEX_MASK = MAX_SIZE;
+    static constexpr size_t NONE = SIZE_MAX;
+
+    static uint64_t hash( NodeId id );
+
+    // Control byte with the top bit set, so a used slot is never EMPTY, above the entry index
+    static uint32_t control( uint64_t hash ) { return static_cast<uint32_t>( 0x80 | ( hash & 0x7f ) ) << 24; }
+    static size_t index_of( uint32_t slot ) { return slot & INDEX_MASK; }
+    size_t home( uint64_t hash ) const { return static_cast<size_t>( hash >> 7 ) & ( _slots.size() - 1 ); }
+
+    // Slot holding id, or NONE
+    size_t probe( NodeId id ) const;
+    void place( size_t index );
+    void grow();
+
+    std::vector<uint32_t>       _slots;
+    std::vector<NeighborEntry>  _entries;
+};
+
+// Neighbor table for one writer and any number of readers, RCU style. The writer edits a private copy and publish()
+// swaps in an immutable snapshot of it; readers take a reference to the current snapshot and keep using it for as
+// long as they hold it, so they never wait on the writer or see a half-applied update. Snapshots are released when
+// the last reader drops them.
 class NeighborTable {
 public:
-    void insert( NeighborEntry entry );
-    bool find( NodeId id, NeighborEntry& entry );
+    using Map = NeighborMap;
+    using Snapshot = std::shared_ptr<const Map>;
 
-    std::unordered_map<NodeId, NeighborEntry>& neighbors() { return _neighbors; }
+    NeighborTable();
+
+    // Writer side, all on one thread. Changes become visible to readers at the next publish().
+    void insert( const NeighborEntry& entry );
+    const NeighborEntry* find( NodeId id ) const { return _neighbors.find( id ); }
+    void erase( NodeId id );
+
+    // Publish the writer's table if it changed since the last publish. Returns true if it did.
+    bool publish();
+
+    // Reader side, any thread. Entries found through a snapshot stay valid for as long as it is held.
+    Snapshot snapshot() const { return std::atomic_load_explicit( &_published, std::memory_order_acquire ); }
+    bool lookup( NodeId id, NeighborEntry& entry ) const;
 
 private:
-    std::unordered_map<NodeId, NeighborEntry> _neighbors;
+    Map         _neighbors;
+    bool        _dirty = false;
+    Snapshot    _published;
 };
 
 }
-}
\ No newline at end of file
+}
@@ -3,20 +3,110 @@
 #include <string>
 #include <memory>
 #include <array>
+#include <functional>
+#include <vector>
 
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
 
+#include "common.hpp"
+#include "pbuf.hpp"
+
 namespace bm {
 namespace core {
 
 class NetworkInterface;
+class XdpSocket;
+class IoUringEngine;
 
 struct NetDeviceInfo {
     std::string if_name;
     uint8_t mac_address[6];
 };
 
+// Memory-mapped TPACKET_V3 receive ring. The kernel fills fixed-size blocks with frames and hands a block to
+// userspace once it is full or block_timeout_ms has elapsed, so the timeout trades latency for batching.
+struct RxRingConfig {
+    bool        enabled             = false;
+    uint32_t    block_size          = 1 << 18;  // Must be a multiple of the page size
+    uint32_t    block_count         = 8;
+    uint32_t    frame_size          = 2048;     // Must be a multiple of TPACKET_ALIGNMENT
+    uint32_t    block_timeout_ms    = 10;
+};
+
+// Memory-mapped PACKET_TX_RING. Frames are built in place in ring slots and a single send() transmits every
+// committed slot.
+struct TxRingConfig {
+    bool        enabled             = false;
+    uint32_t    block_size          = 1 << 18;  // Must be a multiple of the page size
+    uint32_t    block_count         = 4;
+    uint32_t    frame_size          = 2048;     // Must fit TX_RING_DATA_OFFSET + BM_MAX_FRAME_SIZE
+};
+
+// AF_XDP socket sharing one UMEM between RX and TX. Generic (SKB) mode works on any driver, including veth.
+struct XdpConfig {
+    uint32_t    queue_id            = 0;
+    uint32_t    frame_count         = 4096;     // UMEM frames, ring_size of them are used for RX
+    uint32_t    frame_size          = 2048;     // Must be a power of two
+    uint32_t    ring_size           = 2048;     // Must be a power of two
+    bool        skb_mode            = true;
+    bool        zero_copy           = false;
+};
+
+enum class NetDeviceBackend {
+    PACKET_SOCKET,  // AF_PACKET raw socket, optionally with mmap rings
+    XDP_SOCKET      // AF_XDP
+};
+
+// How a plain packet socket (no mmap rings) moves frames
+enum class IoEngine {
+    SYSCALL,        // recvmmsg/sendmmsg
+    IO_URING        // Multishot recv from provided buffers, batched sends, falls back to SYSCALL if unsupported
+};
+
+struct IoUringConfig {
+    uint32_t    queue_depth         = 64;       // SQ entries per ring, also the send batch size
+    uint32_t    buffer_count        = 256;      // Provided receive buffers, must be a power of two
+    uint32_t    buffer_size         = 2048;     // Should hold BM_MAX_FRAME_SIZE, longer frames are truncated
+};
+
+enum class FanoutMode {
+    HASH,           // Flow hash, frames from one neighbor always reach the same worker
+    CPU             // The socket matching the CPU that received the frame
+};
+
+// PACKET_FANOUT receive scaling. Every port gets `workers` sockets in one fanout group and the kernel spreads
+// incoming frames across them, one receive worker per socket.
+struct FanoutConfig {
+    uint32_t    workers             = 1;        // 1 disables fanout
+    FanoutMode  mode                = FanoutMode::HASH;
+    bool        pin_workers         = true;     // Pin worker w to the w-th CPU the process may run on
+};
+
+struct NetDeviceConfig {
+    NetDeviceBackend backend = NetDeviceBackend::PACKET_SOCKET;
+    IoEngine     io_engine = IoEngine::SYSCALL;
+    bool         promiscuous = false;   // Only for sniffing, normal operation relies on group membership
+    RxRingConfig rx_ring;
+    TxRingConfig tx_ring;
+    XdpConfig    xdp;
+    IoUringConfig io_uring;
+    FanoutConfig fanout;
+};
+
+// Caller-owned buffer for batched reads. len is set to the received frame length.
+struct FrameBuffer {
+    uint8_t*        data;
+    size_t          size;
+    size_t          len;
+};
+
+// Read-only view of a received frame. When it refers to ring memory, it is only valid until the block is released.
+struct FrameView {
+    const uint8_t*  data;
+    size_t          len;
+};
+
 class NetworkDevice {
 public:
     static constexpr size_t ETH_HEADER_BYTES = 14;
@@ -24,24 +114,106 @@ public:
     static constexpr size_t BM_MTU = 1500;
     static constexpr size_t BM_MAX_FRAME_SIZE = ETH_HEADER_BYTES + ETH_FCS_BYTES + BM_MTU;
 
-    explicit NetworkDevice( NetworkInterface& net_if, const std::string& interface );
+    static constexpr int RX_TIMEOUT_MS = 100;
+    static constexpr size_t MAX_BATCH = 64;
+
+    // Offset of frame data within a TX ring slot (tp_hdrlen minus the sockaddr_ll the kernel accounts for)
+    static constexpr size_t TX_RING_DATA_OFFSET = TPACKET_ALIGN( sizeof( tpacket3_hdr ) );
+
+    using FrameHandler = std::function<void( const FrameView& frame )>;
+
+    explicit NetworkDevice( NetworkInterface& net_if, const std::string& interface, const NetDeviceConfig& config = {} );
     virtual ~NetworkDevice();
 
     NetDeviceInfo info() const;
+    int ifindex() const { return _sock_addr.sll_ifindex; }
+
+    // Descriptor that becomes readable when frames are waiting, for use with poll/epoll
+    int fd() const;
+
+    // In non-blocking mode reads return -1/EAGAIN immediately instead of waiting up to RX_TIMEOUT_MS
+    bool set_nonblocking( bool nonblocking );
+
+    // Replace the in-kernel filter (classic BPF, or the XDP program) so that only BCMP and UDP to these ports
+    // reach userspace.
+    bool set_udp_ports( const std::vector<uint16_t>& udp_ports );
+
+    // Link-layer address membership (PACKET_MR_MULTICAST, PACKET_MR_UNICAST or PACKET_MR_PROMISC). The kernel
+    // reference counts memberships and releases them when the device is closed.
+    bool add_membership( int type, const uint8_t* mac = nullptr );
+    bool drop_membership( int type, const uint8_t* mac = nullptr );
+
+    // Join a PACKET_FANOUT group on this interface. A group_id of 0 asks the kernel for an unused one, which is
+    // written back so further sockets can join the same group. Not available with AF_XDP.
+    bool join_fanout( uint16_t& group_id, FanoutMode mode );
+
+    bool rx_ring_enabled() const { return _rx_ring != nullptr; }
+    bool tx_ring_enabled() const { return _tx_ring != nullptr; }
+    bool io_uring_enabled() const { return _uring != nullptr; }
+    bool zero_copy_rx() const { return _rx_ring != nullptr || _xdp != nullptr || _uring != nullptr; }
 
     ssize_t write_frame( const char* buffer, size_t len );
     ssize_t read_frame( char* buffer, size_t len );
 
+    // Send a pbuf holding a complete frame
+    ssize_t write_frame( const Pbuf& frame );
+
+    // Receive up to count frames into caller-provided buffers, waiting only for the first one. Without the RX ring
+    // this is a single recvmmsg() per MAX_BATCH frames. Returns the number of frames received, or -1 on timeout/error.
+    ssize_t read_frames( FrameBuffer* frames, size_t count );
+
+    // Transmit a batch of complete ethernet frames. With the TX ring enabled the whole batch costs one send(),
+    // otherwise one sendmmsg() per MAX_BATCH frames. Returns the number of frames sent, or -1 if none could be.
+    ssize_t write_frames( const FrameView* frames, size_t count );
+
+    // TX ring slot access for building frames in place. tx_slot returns nullptr when every slot is still queued;
+    // tx_commit marks the slot ready and flush_tx hands all committed slots to the kernel in one send().
+    uint8_t* tx_slot( size_t& capacity );
+    void tx_commit( size_t len );
+    ssize_t flush_tx();
+
+    // Zero-copy receive from the RX ring, AF_XDP socket or io_uring provided buffers. Waits for the next block (or
+    // batch of descriptors/completions), passes every frame in it to the handler and then returns the memory to the
+    // kernel. Returns the number of
+    // frames handled, or -1 on timeout/error.
+    ssize_t read_block( const FrameHandler& handler );
+
 private:
-    
-    NetworkInterface& _net_if;
+    void setup_rings( const NetDeviceConfig& config );
+    bool rx_ring_wait_block();
+    FrameView rx_ring_frame() const;
+    void rx_ring_advance();
+    tpacket3_hdr* tx_ring_frame( uint32_t index ) const;
 
-    std::array<uint8_t, BM_MAX_FRAME_SIZE> _output_buffer;
-    std::array<uint8_t, BM_MAX_FRAME_SIZE> _input_buffer;
+    NetworkInterface& _net_if;
 
     int             _sock_fd;
     sockaddr_ll     _sock_addr;
+    int             _rx_timeout_ms = RX_TIMEOUT_MS;
     NetDeviceInfo   _info;
+
+    std::unique_ptr<XdpSocket> _xdp;
+    std::unique_ptr<IoUringEngine> _uring;
+
+    // Packet ring mapping, RX ring first followed by TX ring
+    uint8_t*        _ring_map = nullptr;
+    size_t          _ring_map_size = 0;
+
+    // RX ring state
+    uint8_t*        _rx_ring = nullptr;
+    uint32_t        _rx_block_size = 0;
+    uint32_t        _rx_block_count = 0;
+    uint32_t        _rx_block = 0;
+    uint32_t        _rx_frames_left = 0;
+    tpacket3_hdr*   _rx_frame = nullptr;
+
+    // TX ring state
+    uint8_t*        _tx_ring = nullptr;
+    uint32_t        _tx_block_size = 0;
+    uint32_t        _tx_frame_size = 0;
+    uint32_t        _tx_frame_count = 0;
+    uint32_t        _tx_frame = 0;
+    uint32_t        _tx_pending = 0;
 };
 
 }
@@ -1,55 +1,214 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <string>
+#include <array>
 #include <memory>
+#include <shared_mutex>
 #include <unordered_map>
 #include <vector>
 #include <thread>
 
+#include <concurrentqueue.h>
+
 #include <linux/if_ether.h>
 #include <netinet/in.h>
 #include <netinet/ip6.h>
+#include <sys/uio.h>
 
+#include "bcmp_dispatcher.hpp"
+#include "dfu.hpp"
+#include "echo.hpp"
 #include "neighbor_table.hpp"
+#include "network_device.hpp"
+#include "pbuf.hpp"
+#include "reliable_transport.hpp"
+#include "resource_table.hpp"
+#include "timer_wheel.hpp"
+#include "topology.hpp"
+#include "udp_demux.hpp"
 
 namespace bm {
 namespace core {
 
 class Node;
-class NetworkDevice;
 
 class NetworkInterface {
 public:
     static constexpr uint16_t IP_PROTO_BCMP = (0xBC);
+    static constexpr size_t PBUF_POOL_SIZE = 1024;
+    static constexpr size_t BM_HEADER_BYTES = sizeof( ethhdr ) + sizeof( ip6_hdr );
+    static constexpr uint8_t BM_HOP_LIMIT = 255;
+    static constexpr std::chrono::milliseconds LEASE_TIMER_RESOLUTION{ 10 };
+
+    // ff03::1, realm-local all nodes. Where announcements and multicast transfers go, joined at construction. It
+    // reaches the nodes on our links, nothing forwards it further.
+    static constexpr in6_addr ALL_NODES_REALM_LOCAL{ { { 0xff, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01 } } };
 
-    NetworkInterface( Node& node, const std::vector<std::string>& interfaces );
+    using NeighborDownHandler = std::function<void( const NeighborEntry& entry )>;
+
+    NetworkInterface( Node& node, const std::vector<std::string>& interfaces, const NetDeviceConfig& dev_config = {} );
     auto& devs() { return _net_devices; }
     std::shared_ptr<NetworkDevice> dev( size_t i ){ return _net_devices[ i ]; }
-    // Send BCMP Message
-     // Takes a destination, data, len
 
-    // Send UDPv6 Message
-     // Takes an address, resource ID
+    // Receive sockets per fanout worker, one per port. Worker 0 is the port devices themselves, so without fanout
+    // rx_devs( 0 ) == devs().
+    size_t rx_workers() const { return _rx_devices.size(); }
+    const std::vector<std::shared_ptr<NetworkDevice>>& rx_devs( size_t worker ) const { return _rx_devices[ worker ]; }
+
+    // 1-based BM port a device (or one of its fanout sockets) belongs to, 0 if it is not ours
+    uint8_t port_of( const NetworkDevice& dev ) const;
+
+    // Safe to call from any receive worker. Queued updates are merged by the next update(); when several workers
+    // report the same neighbor the most recent heartbeat wins.
+    void update_neighbor( const NeighborEntry& entry );
+
+    // Periodic processing on the owning thread. Merges neighbor updates and expires neighbors whose liveliness lease
+    // has lapsed, which is only as late as the update period, then publishes the neighbor table once if it changed.
+    void update();
+
+    // Readers on any thread see the table as of the last update(), through snapshot() or lookup()
+    const NeighborTable& neighbors() const { return _neighbors; }
+
+    // Called from update() for each neighbor that expired, after it was removed from the table
+    void set_neighbor_down_handler( NeighborDownHandler handler ) { _neighbor_down = std::move( handler ); }
+
+    // Frame buffers for building and queueing packets. They must all be released before the interface goes away.
+    PbufPool& pbufs() { return _pbuf_pool; }
+
+    // UDP ports let through the in-kernel packet filters. Adding one regenerates the filter on every device. Fails
+    // with everything as it was beyond BM_FILTER_MAX_UDP_PORTS ports, or if a device does not take the new filter.
+    const std::vector<uint16_t>& udp_ports() const { return _udp_ports; }
+    bool add_udp_port( uint16_t port );
+
+    // IPv6 multicast group membership on every device, mapped to the 33:33:xx:xx:xx:xx link-layer group. The
+    // well-known BM groups are joined at construction.
+    bool join_multicast_group( const in6_addr& group );
+    bool leave_multicast_group( const in6_addr& group );
+
+    // Send a BCMP message. The header and payload are written straight into a pooled pbuf with the checksum summed
+    // during the copy, so once the header template for dst exists nothing is allocated. Multicast goes out on every
+    // port; unicast to a known neighbor only on the port it was heard on. With BCMP_FLAG_RELIABLE a unicast message
+    // is sequenced and retransmitted until acknowledged, see reliable(). Like update(), call it from the owning
+    // thread. Returns the number of ports sent on, or -1.
+    int send_bcmp_message( const in6_addr& dst, uint16_t type, const void* payload, size_t len, uint8_t flags = 0 );
+
+    // Deliver UDP datagrams for a port to the handler, from any receive worker, as views of the receive buffer. The
+    // port is added to the packet filters. On a reliable port every datagram must come from a reliable send_to() and
+    // each is delivered once. Bind before the receive workers start. Fails, leaving nothing bound, for ports already
+    // bound or once the packet filters are full. Unbinding takes the port out of the filters again, but for the
+    // well-known BM ports.
+    bool bind( uint16_t port, UdpDemux::Handler handler, bool reliable = false );
+    void unbind( uint16_t port );
+
+    // Send a UDP datagram, from src_port or else from port itself. Built like BCMP messages, with the checksum
+    // summed during the payload copy and nothing allocated. Reliable datagrams are for ports bound as reliable on
+    // the receiver. Same threading and return value as send_bcmp_message.
+    int send_to( const in6_addr& dst, uint16_t port, const void* data, size_t len, uint16_t src_port = 0, bool reliable = false );
+
+    // Gathering variant, e.g. for a protocol header in front of a caller's payload. Every chunk except the last must
+    // have an even length so the checksum can be summed across them.
+    int send_to( const in6_addr& dst, uint16_t port, const iovec* iov, size_t iovcnt, uint16_t src_port = 0, bool reliable = false );
 
-    // Transmit a Bristlemouth packet (IPv6 payload with Bristlemouth-conforming MAC header + IPv6 Header)
-    int bm_tx( const uint8_t* data, size_t len );
+    // Sequencing, acknowledgement and retransmission state behind reliable sends. While a peer's window is full,
+    // reliable sends to it fail with EAGAIN.
+    ReliableTransport& reliable() { return _reliable; }
 
-    // BCMP functions
+    // Receive path for a complete Ethernet frame from any of our devices, safe to call from every receive worker.
+    // BCMP messages and UDP datagrams are checksum verified and dispatched through bcmp() and the bound ports.
+    // Unicast to other nodes' addresses is dropped. Returns false if the frame was dropped or not handled.
+    bool bm_rx( NetworkDevice& dev, const FrameView& frame );
 
+    // BCMP handlers. Heartbeats are handled here already and feed the neighbor table, echo requests are answered.
+    BcmpDispatcher& bcmp() { return _bcmp; }
+
+    // Echo requests and their round trip times
+    Echo& echo() { return _echo; }
+
+    // Graph of the whole network, kept current by update()
+    const Topology& topology() const { return _topology; }
+
+    // Resources published and subscribed to by every node in the graph. Our own are added here, and synchronized by
+    // update().
+    ResourceTable& resources() { return _resources; }
+
+    // Image transfers to and from other nodes, driven by update()
+    Dfu& dfu() { return _dfu; }
+
+    // Transmit a Bristlemouth packet. The pbuf holds the IPv6 payload and needs BM_HEADER_BYTES of headroom, where
+    // the MAC and IPv6 headers are copied from a cached template for the (port, destination, next header) and only
+    // the payload length is patched. Port 0 sends on every port. The pbuf is left as it was passed in. Returns the
+    // number of ports the packet went out on, or -1 if none.
+    int bm_tx( Pbuf& pbuf, uint8_t next_header, const in6_addr& dst, uint8_t port = 0 );
+
+    // Our address in the scope of dst: link-local for link-local unicast and multicast, unique local otherwise
+    const in6_addr& source_address( const in6_addr& dst ) const;
+
+    NodeId node_id() const;
+
+    // The interface identifier of a BM address is the node ID
+    static NodeId node_id_of( const in6_addr& addr );
+    static in6_addr unique_local_address( NodeId id );
+
+    // Port a unicast destination is reached through, 0 (every port) for multicast and unknown neighbors
+    uint8_t egress_port( const in6_addr& dst );
 
 private:
-    void send_bcmp_message( const std::string& dest_addr, uint8_t* data, size_t len );
+    struct HeaderKey {
+        in6_addr    dst;
+        uint8_t     port;
+        uint8_t     next_header;
+
+        bool operator==( const HeaderKey& other ) const;
+    };
+
+    struct HeaderKeyHash {
+        size_t operator()( const HeaderKey& key ) const;
+    };
+
+    using HeaderTemplate = std::array<uint8_t, BM_HEADER_BYTES>;
+
+    void setup_fanout( const NetDeviceConfig& dev_config );
+    bool apply_udp_ports();
+    const HeaderTemplate& header_template( uint8_t port, uint8_t next_header, const in6_addr& dst );
+
+    bool bcmp_rx( NetworkDevice& dev, const ip6_hdr& ip6, const uint8_t* payload, size_t len );
+    bool udp_rx( NetworkDevice& dev, const ip6_hdr& ip6, const uint8_t* payload, size_t len );
+    void schedule_lease( const NeighborEntry& entry );
+    void expire_neighbor( NodeId id );
+    void handle_heartbeat( const BcmpMessage& msg, const bcmp_heartbeat_t& heartbeat );
 
     Node& _node;
+    PbufPool _pbuf_pool{ PBUF_POOL_SIZE };
+    std::vector<uint16_t> _udp_ports{ BM_MIDDLEWARE_PORT, BM_BCL_PORT, STRESS_TEST_PORT };
     std::vector<std::shared_ptr<NetworkDevice>> _net_devices;
+    std::vector<std::vector<std::shared_ptr<NetworkDevice>>> _rx_devices;
 
     in6_addr _lla;
     in6_addr _ula;
 
-    ethhdr _eth_header_out;
-    ip6_hdr _ipv6_header_out;
+    // Prebuilt Ethernet + IPv6 headers, filled on first use. Entries are never erased, so references stay valid
+    // after the lock is released.
+    std::unordered_map<HeaderKey, HeaderTemplate, HeaderKeyHash> _header_templates;
+    std::shared_mutex _header_mutex;
+
+    BcmpDispatcher _bcmp;
+    UdpDemux _udp;
 
     NeighborTable _neighbors;
+    moodycamel::ConcurrentQueue<NeighborEntry> _neighbor_updates;
+
+    // One timer per neighbor with a finite lease, pushed out by every heartbeat
+    TimerWheel _lease_timers{ LEASE_TIMER_RESOLUTION, [this]( uint64_t id ){ expire_neighbor( id ); } };
+    std::unordered_map<NodeId, TimerWheel::TimerId> _lease_timer_ids;
+    NeighborDownHandler _neighbor_down;
+
+    ReliableTransport _reliable{ *this };
+    Echo _echo{ *this };
+    Topology _topology{ *this };
+    ResourceTable _resources{ *this, _topology };
+    Dfu _dfu{ *this };
 
     std::thread _work_thread;
     std::thread _rx_thread;
@@ -4,6 +4,7 @@
 #include <string>
 
 #include "common.hpp"
+#include "middleware.hpp"
 #include "network_interface.hpp"
 
 namespace bm {
@@ -11,14 +12,16 @@ namespace core {
 
 class Node {
 public:
-    explicit Node( NodeId id, const std::vector<std::string>& interfaces );
+    explicit Node( NodeId id, const std::vector<std::string>& interfaces, const NetDeviceConfig& dev_config = {} );
     NodeId id() const { return _id; }
 
     NetworkInterface& net() { return _net_if; }
+    Middleware& middleware() { return _middleware; }
 
 private:
     NodeId _id;
     NetworkInterface _net_if;
+    Middleware _middleware;
 };
 
 }
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <linux/filter.h>
+
+namespace bm {
+namespace core {
+
+// Most UDP ports the packet filters test for: the program's conditional jumps have 8-bit offsets
+constexpr size_t BM_FILTER_MAX_UDP_PORTS = 250;
+
+// Classic BPF program for SO_ATTACH_FILTER that accepts only Bristlemouth traffic: IPv6 frames carrying BCMP, or UDP
+// addressed to one of the given ports. Everything else is dropped in the kernel before it is queued on the socket.
+// Throws std::length_error for more than BM_FILTER_MAX_UDP_PORTS ports.
+std::vector<sock_filter> bm_packet_filter( const std::vector<uint16_t>& udp_ports );
+
+}
+}
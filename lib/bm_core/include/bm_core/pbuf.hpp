@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+namespace bm {
+namespace core {
+
+class PbufPool;
+
+// Fixed-size frame buffer handed out by a PbufPool. The payload starts after some headroom so lower layers can
+// prepend their headers in place, pbuf style. Pbufs are reference counted through PbufPtr and go back to their pool
+// when the last reference is dropped, which may happen on any thread.
+class Pbuf {
+public:
+    Pbuf( const Pbuf& ) = delete;
+    Pbuf& operator=( const Pbuf& ) = delete;
+
+    uint8_t* data() { return _buffer + _offset; }
+    const uint8_t* data() const { return _buffer + _offset; }
+    size_t len() const { return _len; }
+
+    size_t headroom() const { return _offset; }
+    size_t tailroom() const { return _size - _offset - _len; }
+
+    // Grow at the front into the headroom, e.g. to add a header. Returns the new start, or nullptr if it doesn't fit.
+    uint8_t* push( size_t bytes );
+
+    // Strip bytes from the front, e.g. a parsed header. Returns false if the pbuf is shorter than that.
+    bool pull( size_t bytes );
+
+    // Grow at the end. Returns the start of the added bytes, or nullptr if they don't fit.
+    uint8_t* append( size_t bytes );
+
+    // Set the payload length, for data written straight into data(). Fails if it exceeds headroom + tailroom.
+    bool set_len( size_t len );
+
+    // Empty the pbuf with the given headroom
+    void reset( size_t headroom );
+
+private:
+    friend class PbufPool;
+    friend class PbufPtr;
+
+    Pbuf() = default;
+
+    std::atomic<uint32_t>   _refs{ 0 };
+    std::atomic<uint32_t>   _next{ 0 };     // Free list link, index of the next free pbuf
+
+    PbufPool*   _pool = nullptr;
+    uint8_t*    _buffer = nullptr;
+    uint32_t    _size = 0;
+    uint32_t    _offset = 0;
+    uint32_t    _len = 0;
+};
+
+// Shared handle to a Pbuf. Copies add a reference, so a frame can be queued or handed to another thread without
+// copying it.
+class PbufPtr {
+public:
+    PbufPtr() = default;
+    PbufPtr( const PbufPtr& other ) : _pbuf{ other._pbuf } { acquire(); }
+    PbufPtr( PbufPtr&& other ) noexcept : _pbuf{ other._pbuf } { other._pbuf = nullptr; }
+    ~PbufPtr() { reset(); }
+
+    PbufPtr& operator=( PbufPtr other ) noexcept { std::swap( _pbuf, other._pbuf ); return *this; }
+
+    void reset();
+
+    Pbuf* get() const { return _pbuf; }
+    Pbuf* operator->() const { return _pbuf; }
+    Pbuf& operator*() const { return *_pbuf; }
+    explicit operator bool() const { return _pbuf != nullptr; }
+
+    // Only meaningful while no other thread can take a reference
+    uint32_t use_count() const { return _pbuf ? _pbuf->_refs.load( std::memory_order_relaxed ) : 0; }
+
+private:
+    friend class PbufPool;
+
+    explicit PbufPtr( Pbuf* pbuf ) : _pbuf{ pbuf } {}
+
+    void acquire() { if( _pbuf ) { _pbuf->_refs.fetch_add( 1, std::memory_order_relaxed ); } }
+
+    Pbuf* _pbuf = nullptr;
+};
+
+// Preallocated pbufs with a lock-free free list, so allocating and freeing frames never touches the heap and is
+// safe from any thread. Every pbuf must be released before the pool is destroyed.
+class PbufPool {
+public:
+    // Room for the Ethernet and IPv6 headers, rounded up to keep payloads cache line aligned
+    static constexpr size_t DEFAULT_HEADROOM = 64;
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 2048;
+
+    explicit PbufPool( size_t count, size_t buffer_size = DEFAULT_BUFFER_SIZE, size_t headroom = DEFAULT_HEADROOM );
+
+    PbufPool( const PbufPool& ) = delete;
+    PbufPool& operator=( const PbufPool& ) = delete;
+
+    // Returns an empty pbuf with the pool's headroom, or a null PbufPtr when the pool is exhausted
+    PbufPtr alloc();
+
+    size_t size() const { return _count; }
+    size_t available() const { return _available.load( std::memory_order_relaxed ); }
+    size_t buffer_size() const { return _buffer_size; }
+    size_t headroom() const { return _headroom; }
+
+private:
+    friend class PbufPtr;
+
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    void free( Pbuf* pbuf );
+
+    size_t  _count;
+    size_t  _buffer_size;
+    size_t  _headroom;
+
+    std::unique_ptr<uint8_t[]>  _storage;
+    std::unique_ptr<Pbuf[]>     _pbufs;
+
+    // Treiber stack of free pbuf indices. The upper 32 bits count pops so a stale head can't be swapped back in (ABA).
+    std::atomic<uint64_t>   _free_head;
+    std::atomic<size_t>     _available;
+};
+
+inline void PbufPtr::reset()
+{
+    if( _pbuf && _pbuf->_refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) {
+        _pbuf->_pool->free( _pbuf );
+    }
+    _pbuf = nullptr;
+}
+
+}
+}
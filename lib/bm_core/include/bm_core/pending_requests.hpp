@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+
+#include "common.hpp"
+
+namespace bm {
+namespace core {
+
+// Nodes to ask for state they otherwise announce, like their neighbor or resource table, until they answer. A request
+// left unanswered is repeated with exponential backoff, as the node may be unreachable for a while, and only a few
+// go out per update so that a large network is asked gradually. Not thread-safe.
+class PendingRequests {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Sends the request to a node, false if it could not go out
+    using Sender = std::function<bool( NodeId node_id )>;
+
+    static constexpr std::chrono::seconds REQUEST_TIMEOUT{ 1 };
+    static constexpr std::chrono::seconds MAX_REQUEST_BACKOFF{ 60 };
+
+    // State that has not changed for this long is asked for again, announcements may have been lost
+    static constexpr std::chrono::minutes REFRESH_INTERVAL{ 10 };
+
+    static constexpr size_t MAX_REQUESTS_PER_UPDATE = 8;
+
+    // Asked on the next send(), unless the node is pending already
+    void add( NodeId node_id );
+
+    // Answered, or not to be asked any more
+    void remove( NodeId node_id ) { _pending.erase( node_id ); }
+
+    template<typename Predicate>
+    void remove_if( Predicate pred )
+    {
+        for( auto it = _pending.begin(); it != _pending.end(); ) {
+            it = pred( it->first ) ? _pending.erase( it ) : std::next( it );
+        }
+    }
+
+    bool contains( NodeId node_id ) const { return _pending.count( node_id ) != 0; }
+    size_t size() const { return _pending.size(); }
+
+    // Send the requests that are due, up to MAX_REQUESTS_PER_UPDATE, and back off until the next try
+    void send( Clock::time_point now, const Sender& sender );
+
+private:
+    struct Pending {
+        Clock::time_point   retry = Clock::time_point::min();
+        Clock::duration     backoff{ REQUEST_TIMEOUT };
+    };
+
+    std::unordered_map<NodeId, Pending> _pending;
+};
+
+}
+}
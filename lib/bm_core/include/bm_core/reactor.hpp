@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "network_device.hpp"
+
+namespace bm {
+namespace core {
+
+// Receive loop for any number of NetworkDevices on one thread. Every device fd plus an eventfd used for wakeup and
+// shutdown sit in one epoll set; ready devices are drained in batches and each frame is passed to the handler.
+class Reactor {
+public:
+    static constexpr size_t MAX_EVENTS = 16;
+
+    // Frames read per device per wakeup before moving on to the next ready one
+    static constexpr size_t RX_BUDGET = 256;
+
+    using FrameHandler = std::function<void( NetworkDevice& dev, const FrameView& frame )>;
+
+    explicit Reactor( FrameHandler handler );
+    virtual ~Reactor();
+
+    // Devices are switched to non-blocking mode
+    void add( std::shared_ptr<NetworkDevice> dev );
+
+    // Dispatch until stop() is called
+    void run();
+
+    // Safe to call from any thread, run() returns without waiting for a timeout
+    void stop();
+
+private:
+    void drain( NetworkDevice& dev );
+
+    FrameHandler        _handler;
+    std::atomic<bool>   _stop{ false };
+
+    int                 _epoll_fd;
+    int                 _event_fd;
+
+    std::vector<std::shared_ptr<NetworkDevice>> _devices;
+
+    // Receive buffers for devices without zero-copy RX
+    std::vector<uint8_t>                            _rx_storage;
+    std::array<FrameBuffer, NetworkDevice::MAX_BATCH> _rx_frames;
+};
+
+}
+}
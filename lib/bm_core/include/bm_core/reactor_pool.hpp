@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "reactor.hpp"
+
+namespace bm {
+namespace core {
+
+class NetworkInterface;
+
+// One Reactor per fanout worker, each on its own thread. Worker w serves the w-th fanout socket of every port, so
+// receive processing scales with the number of workers. The handler is called concurrently from all of them.
+class ReactorPool {
+public:
+    ReactorPool( NetworkInterface& net_if, const Reactor::FrameHandler& handler, bool pin_workers = true );
+    virtual ~ReactorPool();
+
+    size_t size() const { return _reactors.size(); }
+
+    void start();
+
+    // Stops and joins every worker. Must not be called from a worker thread.
+    void stop();
+
+private:
+    void pin( std::thread& thread, size_t worker );
+
+    bool _pin_workers;
+
+    std::vector<std::unique_ptr<Reactor>>   _reactors;
+    std::vector<std::thread>                _threads;
+};
+
+}
+}
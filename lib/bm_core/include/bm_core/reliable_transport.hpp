@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <concurrentqueue.h>
+
+#include <netinet/in.h>
+
+#include "bcmp_messages.hpp"
+#include "common.hpp"
+#include "pbuf.hpp"
+#include "timer_wheel.hpp"
+
+namespace bm {
+namespace core {
+
+class NetworkInterface;
+
+// Reliable delivery for unicast BCMP messages and UDP datagrams. Each message carries a per-peer sequence number,
+// receivers answer with a cumulative ACK plus a bitmap of what they got beyond it (BCMP_ACK), and senders keep up to
+// WINDOW messages in flight per peer, retransmitting only the ones not yet acknowledged when their RFC 6298
+// retransmission timer runs out. Delivery is exactly once but not ordered.
+//
+// Sending, ACK processing and timers belong to the interface's owning thread. Receive workers only touch the
+// receive windows, under a mutex, and queue the ACKs they hear for update(). ACKs go out from update() as well, so
+// measured round trips include up to one update period.
+class ReliableTransport {
+public:
+    using Clock = TimerWheel::Clock;
+
+    static constexpr uint32_t WINDOW = 32;
+    static constexpr uint32_t MAX_RETRIES = 8;
+
+    static constexpr std::chrono::milliseconds INITIAL_RTO{ 200 };
+    static constexpr std::chrono::milliseconds MIN_RTO{ 20 };
+    static constexpr std::chrono::milliseconds MAX_RTO{ 5000 };
+    static constexpr std::chrono::milliseconds TIMER_RESOLUTION{ 1 };
+
+    // A base this far from what a receiver expects means the sender started over, e.g. after a restart or after
+    // giving up on the peer. Initial sequence numbers are random, so that is almost always the case.
+    static constexpr uint32_t RESYNC_DISTANCE = 1u << 16;
+
+    explicit ReliableTransport( NetworkInterface& net );
+
+    ReliableTransport( const ReliableTransport& ) = delete;
+    ReliableTransport& operator=( const ReliableTransport& ) = delete;
+
+    // Sender side, owning thread. next_seq() fills in the header for the next message to dst, failing with EINVAL
+    // for multicast and EAGAIN while the peer's window is full. send() must follow with the packet carrying it; the
+    // packet is transmitted with bm_tx and held until acknowledged. Returns the number of ports the first
+    // transmission went out on, where 0 means it is left to the retransmission timer.
+    bool next_seq( const in6_addr& dst, bcmp_reliable_header_t& header );
+    int send( const in6_addr& dst, uint8_t next_header, uint32_t seq, PbufPtr pbuf );
+
+    // Receive side, any worker. Returns true the first time a sequence number arrives from a peer, false for
+    // duplicates and messages beyond the window. Either way an ACK is sent on the next update().
+    bool receive( const in6_addr& src, const bcmp_reliable_header_t& header );
+
+    // A BCMP_ACK from src, any worker
+    void ack_received( const in6_addr& src, const bcmp_ack_t& ack );
+
+    // Owning thread: apply received ACKs, send pending ones and retransmit what timed out
+    void update( Clock::time_point now );
+
+    // Messages to dst not acknowledged yet, owning thread
+    uint32_t in_flight( const in6_addr& dst ) const;
+
+    uint64_t retransmits() const { return _retransmits; }
+    uint64_t failures() const { return _failures; }
+    uint64_t duplicates() const { return _duplicates.load( std::memory_order_relaxed ); }
+
+private:
+    struct InFlight {
+        PbufPtr             pbuf;           // Released once acknowledged
+        Clock::time_point   sent;
+        uint8_t             next_header = 0;
+        uint8_t             retries = 0;
+    };
+
+    struct TxPeer {
+        in6_addr                        addr;
+        uint32_t                        base = 0;   // Oldest unacknowledged
+        uint32_t                        next = 0;   // Next to send
+        std::array<InFlight, WINDOW>    window;     // Indexed by seq % WINDOW
+
+        Clock::duration                 srtt{ 0 };
+        Clock::duration                 rttvar{ 0 };
+        Clock::duration                 rto{ INITIAL_RTO };
+        TimerWheel::TimerId             timer = TimerWheel::INVALID_TIMER;
+    };
+
+    struct RxPeer {
+        in6_addr    addr;
+        uint32_t    expected = 0;       // Lowest sequence number not received yet
+        uint32_t    received = 0;       // Bit i: expected + i received
+        bool        ack_pending = false;
+    };
+
+    struct AckEvent {
+        NodeId              peer;
+        bcmp_ack_t          ack;
+        Clock::time_point   time;
+    };
+
+    void apply_ack( const AckEvent& event );
+    void retransmit( NodeId peer );
+    void rearm( NodeId peer, TxPeer& tx );
+    void rtt_sample( TxPeer& tx, Clock::duration rtt );
+
+    NetworkInterface&   _net;
+    std::mt19937        _isn_rng{ std::random_device{}() };
+
+    std::unordered_map<NodeId, TxPeer>  _tx_peers;
+    TimerWheel                          _timers;
+
+    std::mutex                          _rx_mutex;
+    std::unordered_map<NodeId, RxPeer>  _rx_peers;
+    std::vector<NodeId>                 _ack_pending;       // Peers owed an ACK, under _rx_mutex
+    std::vector<std::pair<in6_addr, bcmp_ack_t>> _outgoing_acks;
+
+    moodycamel::ConcurrentQueue<AckEvent>   _acks;
+
+    uint64_t                _retransmits = 0;
+    uint64_t                _failures = 0;
+    std::atomic<uint64_t>   _duplicates{ 0 };
+};
+
+}
+}
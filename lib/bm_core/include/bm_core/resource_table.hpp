@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <concurrentqueue.h>
+
+#include <netinet/in.h>
+
+#include "bcmp_dispatcher.hpp"
+#include "bcmp_messages.hpp"
+#include "common.hpp"
+#include "pending_requests.hpp"
+#include "topology.hpp"
+
+namespace bm {
+namespace core {
+
+class NetworkInterface;
+
+struct ResourceHolder {
+    NodeId      node_id;
+    uint8_t     flags;      // BCMP_RESOURCE_PUBLISHER and/or BCMP_RESOURCE_SUBSCRIBER
+};
+
+// Which resources (pub/sub topics) every node publishes and subscribes to, synchronized over
+// BCMP_RESOURCE_TABLE_REQUEST/REPLY with deltas.
+//
+// Each node versions its own table, counting changes within a random epoch. When it changes, the node multicasts only
+// the resources that changed since its last announcement; a peer holding the version the announcement starts from
+// applies it, anyone else asks for the changes since the version it does hold. A full table is only sent to a node
+// that has none yet, from another epoch, or is so far behind that the removals it missed were forgotten. Nodes are
+// discovered through the topology graph, and dropped along with their resources when they leave it.
+//
+// Everything is merged into an index from resource name to the nodes holding it, published to readers as an
+// immutable snapshot like the topology.
+class ResourceTable {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Holders = std::vector<ResourceHolder>;
+    using Index = std::unordered_map<std::string, std::shared_ptr<const Holders>>;
+    using Snapshot = std::shared_ptr<const Index>;
+
+    static constexpr size_t MAX_NAME_LEN = 255;
+
+    // Removed resources remembered, to be sent as removals to peers catching up
+    static constexpr size_t MAX_TOMBSTONES = 256;
+
+    // Registers the resource table request and reply handlers on the interface
+    ResourceTable( NetworkInterface& net, const Topology& topology );
+
+    ResourceTable( const ResourceTable& ) = delete;
+    ResourceTable& operator=( const ResourceTable& ) = delete;
+
+    // Our own table, owning thread. Flags are added to or removed from the resource's; changes are announced on the
+    // next update(). Fails for names longer than MAX_NAME_LEN.
+    bool add( std::string_view name, uint8_t flags );
+    void remove( std::string_view name, uint8_t flags );
+
+    uint32_t epoch() const { return _epoch; }
+    uint32_t version() const { return _version; }
+
+    // Owning thread: announce our changes, answer requests, apply what peers sent and publish the index
+    void update( Clock::time_point now );
+
+    // Any thread. Includes this node's resources.
+    Snapshot snapshot() const { return std::atomic_load_explicit( &_published, std::memory_order_acquire ); }
+
+    uint64_t full_tables_sent() const { return _full_tables_sent; }
+    uint64_t deltas_sent() const { return _deltas_sent; }
+
+private:
+    struct LocalResource {
+        uint8_t     flags;
+        uint32_t    version;        // Of the last change
+    };
+
+    // A reply as parsed by a receive worker
+    struct Chunk {
+        bcmp_resource_table_reply_t                     header;
+        std::vector<std::pair<std::string, uint8_t>>    resources;
+    };
+
+    struct Request {
+        in6_addr                        src;
+        bcmp_resource_table_request_t   request;
+    };
+
+    // A reply being put back together from its chunks
+    struct Assembly {
+        bcmp_resource_table_reply_t                     header{};
+        std::bitset<256>                                received;
+        std::vector<std::pair<std::string, uint8_t>>    resources;
+    };
+
+    struct Peer {
+        bool                                        known = false;  // Holding some version of its table
+        uint32_t                                    epoch = 0;
+        uint32_t                                    version = 0;
+        uint32_t                                    latest_epoch = 0;       // Last announced
+        uint32_t                                    latest_version = 0;
+        std::unordered_map<std::string, uint8_t>    resources;
+        Assembly                                    assembly;
+        Clock::time_point                           synced{};
+    };
+
+    void handle_request( const BcmpMessage& msg, const bcmp_resource_table_request_t& request );
+    void handle_reply( const BcmpMessage& msg, const bcmp_resource_table_reply_t& reply );
+
+    void set_local( const std::string& name, uint8_t flags );
+    void sync_peers();
+    void receive( Chunk& chunk, Clock::time_point now );
+    void apply( NodeId node_id, Peer& peer, Clock::time_point now );
+    void send_requests( Clock::time_point now );
+    bool send_request( NodeId node_id );
+
+    // Resources changed after base, or all of them
+    void send_table( const in6_addr& dst, uint32_t base, bool full );
+    void set_holder( const std::string& name, NodeId node_id, uint8_t flags );
+
+    NetworkInterface&   _net;
+    const Topology&     _topology;
+    NodeId              _node_id;
+
+    // Our table, owning thread
+    std::unordered_map<std::string, LocalResource>  _local;
+    std::deque<std::pair<uint32_t, std::string>>    _tombstones;    // Oldest first
+    uint32_t                                        _epoch;
+    uint32_t                                        _version = 0;
+    uint32_t                                        _forgotten = 0;     // Newest version whose removals are gone
+    uint32_t                                        _announced = 0;
+
+    // Peers and the index, owning thread
+    std::unordered_map<NodeId, Peer>    _peers;
+    PendingRequests                     _pending;       // Peers we are behind or have not synced with in a while
+    Topology::Snapshot                  _topology_seen;
+    std::unordered_map<std::string, std::shared_ptr<const Holders>> _index;
+    bool                                _dirty = false;
+    Snapshot                            _published;
+
+    uint64_t    _full_tables_sent = 0;
+    uint64_t    _deltas_sent = 0;
+
+    // From the receive workers
+    moodycamel::ConcurrentQueue<Chunk>      _chunks;
+    moodycamel::ConcurrentQueue<Request>    _requests;
+};
+
+}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+namespace bm {
+namespace core {
+
+// Hierarchical timing wheel (Varghese & Lauck). Four levels of 64 slots cover 2^24 ticks; a timer sits in the level
+// matching how far away it is and is cascaded one level down each time the wheel below wraps, so scheduling,
+// rescheduling and cancelling are O(1) and a tick only touches the timers that are due. Timers further out than the
+// wheel reaches are parked at the top and re-placed until they are due. Not thread-safe.
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Generation-tagged handle, so a stale ID of a fired or cancelled timer is simply rejected
+    using TimerId = uint64_t;
+    static constexpr TimerId INVALID_TIMER = 0;
+
+    // Called with the key the timer was scheduled with
+    using ExpiryHandler = std::function<void( uint64_t key )>;
+
+    static constexpr size_t LEVELS = 4;
+    static constexpr size_t SLOT_BITS = 6;
+    static constexpr size_t SLOTS = 1 << SLOT_BITS;
+
+    TimerWheel( Clock::duration resolution, ExpiryHandler handler, Clock::time_point start = Clock::now() );
+
+    // Timers never fire early: expiries are rounded up to the next tick. Already expired timers fire on the next
+    // tick.
+    TimerId schedule( uint64_t key, Clock::time_point expiry );
+    bool reschedule( TimerId id, Clock::time_point expiry );
+    bool cancel( TimerId id );
+
+    // Run the wheel up to now, calling the handler for every timer due on the way. The handler may schedule and
+    // cancel timers. Returns the number of timers fired.
+    size_t advance( Clock::time_point now );
+
+    size_t size() const { return _active; }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+    static constexpr uint64_t MAX_DELTA = ( 1ull << ( SLOT_BITS * LEVELS ) ) - 1;
+
+    struct Timer {
+        uint64_t    key         = 0;
+        uint64_t    expiry      = 0;        // Tick
+        uint32_t    generation  = 1;
+        uint32_t    prev        = NONE;
+        uint32_t    next        = NONE;     // Also links the free list
+        uint32_t    bucket      = NONE;     // level * SLOTS + slot while scheduled
+    };
+
+    uint64_t to_tick( Clock::time_point time, bool round_up ) const;
+    Timer* lookup( TimerId id );
+
+    void place( uint32_t index );
+    void link( uint32_t index, uint32_t bucket );
+    void unlink( uint32_t index );
+    void release( uint32_t index );
+    void cascade( size_t level );
+
+    Clock::duration     _resolution;
+    ExpiryHandler       _handler;
+    Clock::time_point   _start;
+    uint64_t            _now = 0;           // Last tick processed
+
+    std::vector<Timer>                      _timers;
+    uint32_t                                _free = NONE;
+    size_t                                  _active = 0;
+    std::array<uint32_t, LEVELS * SLOTS>    _buckets;
+};
+
+}
+}
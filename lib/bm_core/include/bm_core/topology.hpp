@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <concurrentqueue.h>
+
+#include <netinet/in.h>
+
+#include "bcmp_dispatcher.hpp"
+#include "bcmp_messages.hpp"
+#include "common.hpp"
+#include "pending_requests.hpp"
+
+namespace bm {
+namespace core {
+
+class NetworkInterface;
+
+struct TopologyLink {
+    NodeId      neighbor;
+    uint8_t     port;           // Port of the node the link is listed under
+
+    bool operator==( const TopologyLink& other ) const
+    {
+        return neighbor == other.neighbor && port == other.port;
+    }
+};
+
+// One node of the graph, as that node last reported its neighbors
+struct TopologyNode {
+    NodeId                                  node_id;
+    uint32_t                                version;
+    std::vector<TopologyLink>               links;
+    std::chrono::steady_clock::time_point   updated;
+};
+
+// Network topology discovery over BCMP_NEIGHBOR_TABLE_REQUEST/REPLY, kept current with deltas rather than re-crawls.
+//
+// Every node answers requests for its own neighbor table, and multicasts it unrequested whenever a heartbeat brings
+// a new neighbor or one goes down, once per change and not per heartbeat. Other nodes replace their copy of that one
+// node's entry, and only send requests for neighbors the graph has no entry for, i.e. nodes that joined while no
+// announcement reached us, once when we start out, or to refresh an entry that has not changed in a long while in
+// case announcements were lost. Nodes no longer reachable from us are dropped from the graph.
+//
+// Nothing forwards BCMP from one link to the next, so only our neighbors' tables reach us. Nodes two or more hops
+// away appear as the neighbors of those, without an entry of their own, and are never asked for one.
+//
+// The graph is published like the neighbor table: readers on any thread get an immutable snapshot, and publishing
+// one copies only pointers, nodes that did not change are shared between snapshots.
+class Topology {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Graph = std::unordered_map<NodeId, std::shared_ptr<const TopologyNode>>;
+    using Snapshot = std::shared_ptr<const Graph>;
+
+    // Registers the neighbor table request and reply handlers on the interface
+    explicit Topology( NetworkInterface& net );
+
+    Topology( const Topology& ) = delete;
+    Topology& operator=( const Topology& ) = delete;
+
+    // Called from the interface's update() when a neighbor was added, changed ports or went down
+    void neighbors_changed() { _local_changed = true; }
+
+    // Owning thread: announce our own changes, answer requests, merge what other nodes reported, request the
+    // entries still missing and publish the graph if it changed
+    void update( Clock::time_point now );
+
+    // Any thread. Includes this node.
+    Snapshot snapshot() const { return std::atomic_load_explicit( &_published, std::memory_order_acquire ); }
+
+    uint32_t local_version() const { return _local_version; }
+    uint64_t requests_sent() const { return _requests_sent; }
+    uint64_t announcements() const { return _announcements; }
+
+private:
+    struct Report {
+        NodeId                      node_id;
+        uint32_t                    version;
+        bool                        solicited;      // Unicast answer to a request, as opposed to an announcement
+        std::vector<TopologyLink>   links;
+    };
+
+    void handle_request( const BcmpMessage& msg, const bcmp_neighbor_table_request_t& request );
+    void handle_reply( const BcmpMessage& msg, const bcmp_neighbor_table_reply_t& reply );
+
+    void update_local( Clock::time_point now );
+    void merge( Report& report, Clock::time_point now );
+    void prune();
+    bool is_neighbor( NodeId node_id ) const;
+    void send_requests( Clock::time_point now );
+    bool send_request( NodeId node_id );
+    void send_table( const in6_addr& dst );
+
+    NetworkInterface&   _net;
+    NodeId              _node_id;
+
+    // Owning thread
+    Graph                                       _graph;
+    bool                                        _dirty = false;
+    bool                                        _local_changed = true;
+    uint32_t                                    _local_version;
+    std::vector<TopologyLink>                   _local_links;
+    PendingRequests                             _pending;
+    Clock::time_point                           _next_refresh{};
+    uint64_t                                    _requests_sent = 0;
+    uint64_t                                    _announcements = 0;
+
+    Snapshot    _published;
+
+    // From the receive workers
+    moodycamel::ConcurrentQueue<Report>     _reports;
+    moodycamel::ConcurrentQueue<in6_addr>   _requesters;
+};
+
+}
+}
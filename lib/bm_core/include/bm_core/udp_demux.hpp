@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include <netinet/ip6.h>
+
+#include "network_device.hpp"
+#include "packet_filter.hpp"
+
+namespace bm {
+namespace core {
+
+// A received UDP datagram. The payload points into the receive buffer, so it is only valid for the duration of the
+// handler call; copy out whatever has to outlive it.
+struct UdpDatagram {
+    NetworkDevice&  dev;
+    uint8_t         ingress_port;   // 1-based BM port
+    const ip6_hdr&  ip6;
+    uint16_t        src_port;       // Host byte order
+    uint16_t        dst_port;
+    const uint8_t*  payload;        // After the UDP header
+    size_t          len;
+};
+
+// Flat table from destination port to handler. Every port maps to a one byte slot, so demultiplexing is a single
+// index with no hashing or searching. Like BCMP handlers, bind before frames are received; dispatch may then run on
+// any number of receive workers.
+class UdpDemux {
+public:
+    static constexpr size_t PORT_COUNT = 65536;
+
+    // No more ports than the packet filters let through
+    static constexpr size_t MAX_BINDINGS = BM_FILTER_MAX_UDP_PORTS;
+
+    using Handler = std::function<void( const UdpDatagram& dgram )>;
+
+    UdpDemux();
+
+    // Fails for port 0, ports that are already bound and when all MAX_BINDINGS slots are taken
+    bool bind( uint16_t port, Handler handler );
+    void unbind( uint16_t port );
+    bool bound( uint16_t port ) const { return _slots[ port ] != 0; }
+
+    // Returns false if nothing is bound to the destination port
+    bool dispatch( const UdpDatagram& dgram ) const;
+
+    uint64_t unbound() const { return _unbound.load( std::memory_order_relaxed ); }
+
+private:
+    std::unique_ptr<uint8_t[]>              _slots;         // Port to 1-based handler slot, 0 when unbound
+    std::array<Handler, MAX_BINDINGS>       _handlers;
+
+    mutable std::atomic<uint64_t>           _unbound{ 0 };
+};
+
+}
+}
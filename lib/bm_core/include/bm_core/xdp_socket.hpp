@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <linux/if_xdp.h>
+
+#include "network_device.hpp"
+
+namespace bm {
+namespace core {
+
+// AF_XDP socket bound to one queue of an interface. RX and TX share a single UMEM: the first ring_size frames
+// circulate through the fill/RX rings, the rest are used for transmit. A small XDP program redirects only
+// Bristlemouth traffic (BCMP and the BM UDP ports) to the socket and passes everything else to the kernel stack.
+class XdpSocket {
+public:
+    XdpSocket( int ifindex, const XdpConfig& config, const std::vector<uint16_t>& udp_ports );
+    ~XdpSocket();
+
+    XdpSocket( const XdpSocket& ) = delete;
+    XdpSocket& operator=( const XdpSocket& ) = delete;
+
+    int fd() const { return _xsk_fd; }
+
+    // Regenerate the XDP program for a new port set and swap it in on the existing link
+    bool set_udp_ports( const std::vector<uint16_t>& udp_ports );
+
+    // Wait up to timeout_ms for frames, pass up to max_frames of them to the handler as zero-copy views of UMEM and
+    // then hand the buffers back to the fill ring. Returns the number of frames handled, or -1 on timeout/error.
+    ssize_t read_batch( const NetworkDevice::FrameHandler& handler, size_t max_frames, int timeout_ms );
+
+    // Copy frames into free TX buffers and kick the kernel once. Returns the number of frames queued, or -1 if none:
+    // EINVAL for a first frame larger than a UMEM frame, ENOBUFS when the ring or the buffers are full.
+    ssize_t write_frames( const FrameView* frames, size_t count );
+
+private:
+    // Producer/consumer ring shared with the kernel
+    struct Ring {
+        uint32_t*   producer    = nullptr;
+        uint32_t*   consumer    = nullptr;
+        uint32_t*   flags       = nullptr;
+        void*       descs       = nullptr;
+        uint32_t    mask        = 0;
+        void*       map         = nullptr;
+        size_t      map_size    = 0;
+    };
+
+    void release();
+    void setup_umem();
+    void setup_rings();
+    void map_ring( Ring& ring, const xdp_ring_offset& off, uint64_t pgoff, size_t desc_size );
+    void create_map();
+    int load_program( const std::vector<uint16_t>& udp_ports );
+    void attach_program();
+
+    void reclaim_tx();
+    bool wait_rx( int timeout_ms );
+
+    XdpConfig   _config;
+    int         _ifindex;
+
+    int         _xsk_fd = -1;
+    int         _map_fd = -1;
+    int         _prog_fd = -1;
+    int         _link_fd = -1;
+
+    uint8_t*    _umem = nullptr;
+    size_t      _umem_size = 0;
+
+    Ring        _fill;
+    Ring        _completion;
+    Ring        _rx;
+    Ring        _tx;
+
+    // UMEM addresses of TX buffers not currently owned by the kernel
+    std::vector<uint64_t>   _tx_free;
+};
+
+}
+}
@@ -0,0 +1,53 @@
+#include "bm_core/bcmp_dispatcher.hpp"
+
+#include <spdlog/spdlog.h>
+
+namespace bm {
+namespace core {
+
+bool BcmpDispatcher::register_handler( uint16_t type, size_t min_len, Handler handler )
+{
+    if( type >= TABLE_SIZE ) {
+        spdlog::error( "BCMP type {:#x} is outside the dispatch table", type );
+        return false;
+    }
+    if( min_len > MAX_PAYLOAD ) {
+        spdlog::error( "BCMP type {:#x}: minimum length {} exceeds the largest possible payload {}", type, min_len, MAX_PAYLOAD );
+        return false;
+    }
+
+    _table[ type ].handler = std::move( handler );
+    _table[ type ].min_len = static_cast<uint32_t>( min_len );
+    return true;
+}
+
+void BcmpDispatcher::unregister_handler( uint16_t type )
+{
+    if( type < TABLE_SIZE ) {
+        _table[ type ] = Entry{};
+    }
+}
+
+bool BcmpDispatcher::dispatch( const BcmpMessage& msg ) const
+{
+    const Entry* entry = msg.header.type < TABLE_SIZE ? &_table[ msg.header.type ] : nullptr;
+
+    if( !entry || !entry->handler ) {
+        _unhandled.fetch_add( 1, std::memory_order_relaxed );
+        if( _default ) {
+            _default( msg );
+        }
+        return false;
+    }
+
+    if( msg.len < entry->min_len ) {
+        _dropped_short.fetch_add( 1, std::memory_order_relaxed );
+        return false;
+    }
+
+    entry->handler( msg );
+    return true;
+}
+
+}
+}
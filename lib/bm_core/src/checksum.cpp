@@ -0,0 +1,88 @@
+#include "bm_core/checksum.hpp"
+
+#include <arpa/inet.h>
+
+#include <cstring>
+
+namespace bm {
+namespace core {
+
+namespace {
+
+// 32-bit words are summed into a 64-bit accumulator, folding them down later gives the same 16-bit ones' complement
+// sum as adding 16-bit words one at a time
+inline uint64_t add_tail( const uint8_t* p, size_t len, uint64_t sum )
+{
+    if( len >= 4 ) {
+        uint32_t word;
+        std::memcpy( &word, p, 4 );
+        sum += word;
+        p += 4;
+        len -= 4;
+    }
+    if( len >= 2 ) {
+        uint16_t half;
+        std::memcpy( &half, p, 2 );
+        sum += half;
+        p += 2;
+        len -= 2;
+    }
+    if( len ) {
+        // Pad the odd byte with a zero byte after it
+        uint8_t last[2] = { *p, 0 };
+        uint16_t half;
+        std::memcpy( &half, last, 2 );
+        sum += half;
+    }
+    return sum;
+}
+
+}
+
+uint64_t inet_checksum_add( const void* data, size_t len, uint64_t sum )
+{
+    auto* p = static_cast<const uint8_t*>( data );
+    for( ; len >= 8; p += 8, len -= 8 ) {
+        uint64_t word;
+        std::memcpy( &word, p, 8 );
+        sum += ( word & 0xffffffff ) + ( word >> 32 );
+    }
+    return add_tail( p, len, sum );
+}
+
+uint64_t inet_checksum_copy( void* dst, const void* src, size_t len, uint64_t sum )
+{
+    auto* out = static_cast<uint8_t*>( dst );
+    auto* in = static_cast<const uint8_t*>( src );
+    for( ; len >= 8; in += 8, out += 8, len -= 8 ) {
+        uint64_t word;
+        std::memcpy( &word, in, 8 );
+        std::memcpy( out, &word, 8 );
+        sum += ( word & 0xffffffff ) + ( word >> 32 );
+    }
+    std::memcpy( out, in, len );
+    return add_tail( in, len, sum );
+}
+
+uint64_t ip6_pseudo_header_sum( const in6_addr& src, const in6_addr& dst, uint32_t upper_layer_len, uint8_t next_header )
+{
+    uint64_t sum = inet_checksum_add( &src, sizeof( src ) );
+    sum = inet_checksum_add( &dst, sizeof( dst ), sum );
+
+    // Length and next header as 32-bit big endian fields, the zero padding adds nothing
+    uint32_t len = htonl( upper_layer_len );
+    uint32_t nxt = htonl( next_header );
+    sum = inet_checksum_add( &len, sizeof( len ), sum );
+    return inet_checksum_add( &nxt, sizeof( nxt ), sum );
+}
+
+uint16_t inet_checksum_finish( uint64_t sum )
+{
+    while( sum >> 16 ) {
+        sum = ( sum & 0xffff ) + ( sum >> 16 );
+    }
+    return static_cast<uint16_t>( ~sum );
+}
+
+}
+}
@@ -0,0 +1,1224 @@
+#include "bm_core/dfu.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "bm_core/network_interface.hpp"
+
+namespace bm {
+namespace core {
+
+static constexpr uint32_t RESUME_MAGIC = 0x42444655;    // "BDFU"
+
+namespace {
+
+bool write_all( int fd, const uint8_t* data, size_t len )
+{
+    while( len > 0 ) {
+        ssize_t n = ::write( fd, data, len );
+        if( n < 0 && errno == EINTR ) {
+            continue;
+        }
+        if( n <= 0 ) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool read_file( const std::string& path, std::vector<uint8_t>& data )
+{
+    int fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if( fd < 0 ) {
+        return false;
+    }
+
+    data.clear();
+    uint8_t buffer[ 32 * 1024 ];
+    bool ok = true;
+    for( ;; ) {
+        ssize_t n = ::read( fd, buffer, sizeof( buffer ) );
+        if( n < 0 && errno == EINTR ) {
+            continue;
+        }
+        if( n <= 0 ) {
+            ok = n == 0;
+            break;
+        }
+        if( data.size() + n > UINT32_MAX ) {
+            errno = EFBIG;
+            ok = false;
+            break;
+        }
+        data.insert( data.end(), buffer, buffer + n );
+    }
+    ::close( fd );
+    return ok;
+}
+
+// Size and CRC of an image, as a patch names its base
+bcmp_dfu_base_t image_identity( const std::vector<uint8_t>& data )
+{
+    bcmp_dfu_base_t id;
+    id.size = static_cast<uint32_t>( data.size() );
+    id.crc  = static_cast<uint32_t>( crc32( crc32( 0, Z_NULL, 0 ), data.data(), data.size() ) );
+    return id;
+}
+
+bool image_identity( const std::string& path, bcmp_dfu_base_t& id )
+{
+    std::vector<uint8_t> data;
+    if( !read_file( path, data ) ) {
+        return false;
+    }
+    id = image_identity( data );
+    return true;
+}
+
+}
+
+Dfu::Dfu( NetworkInterface& net )
+    : _net{ net }
+{
+    static const std::pair<uint16_t, size_t> messages[] = {
+        { BCMP_DFU_START, sizeof( bcmp_dfu_start_t ) },
+        { BCMP_DFU_PAYLOAD_REQ, sizeof( bcmp_dfu_payload_req_t ) },
+        { BCMP_DFU_PAYLOAD, sizeof( bcmp_dfu_payload_t ) },
+        { BCMP_DFU_END, sizeof( bcmp_dfu_end_t ) },
+        { BCMP_DFU_ACK, sizeof( bcmp_dfu_ack_t ) },
+        { BCMP_DFU_ABORT, sizeof( bcmp_dfu_abort_t ) },
+    };
+    for( auto& m : messages ) {
+        _net.bcmp().register_handler( m.first, m.second, [this]( const BcmpMessage& msg ){
+            handle_message( msg );
+        });
+    }
+}
+
+Dfu::~Dfu()
+{
+    for( auto& in : _incoming ) {
+        close_incoming( in.second );
+    }
+}
+
+void Dfu::handle_message( const BcmpMessage& msg )
+{
+    // Only offers, payloads and aborts of multicast transfers are multicast. Everything beyond the copy is left to
+    // update().
+    uint16_t type = msg.header.type;
+    if( IN6_IS_ADDR_MULTICAST( &msg.ip6.ip6_dst ) && type != BCMP_DFU_START && type != BCMP_DFU_PAYLOAD && type != BCMP_DFU_ABORT ) {
+        return;
+    }
+    if( NetworkInterface::node_id_of( msg.ip6.ip6_src ) == _net.node_id() ) {
+        return;
+    }
+    PbufPtr pbuf = _net.pbufs().alloc();
+    if( !pbuf || pbuf->tailroom() < msg.len ) {
+        return;
+    }
+    std::memcpy( pbuf->append( msg.len ), msg.payload, msg.len );
+    _messages.enqueue( Message{ msg.ip6.ip6_src, IN6_IS_ADDR_MULTICAST( &msg.ip6.ip6_dst ), type, std::move( pbuf ) } );
+}
+
+uint32_t Dfu::send( const in6_addr& dst, const std::string& path, SendHandler done,
+                    const std::vector<std::string>& bases )
+{
+    Outgoing out;
+    if( !DfuStream::encode( path, out.stream ) ) {
+        return 0;
+    }
+    out.dst     = dst;
+    out.path    = path;
+    out.name    = path.substr( path.find_last_of( '/' ) + 1 ).substr( 0, UINT8_MAX );
+    out.done    = std::move( done );
+    if( sizeof( bcmp_dfu_start_t ) + out.name.size() + sizeof( bcmp_dfu_base_t ) > BcmpDispatcher::MAX_PAYLOAD ) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+
+    // Patches are made here, not once the receiver reported its image, so update() never waits on a diff
+    std::vector<uint8_t> image, old_image;
+    if( !bases.empty() && !read_file( path, image ) ) {
+        return 0;
+    }
+    for( const std::string& base : bases ) {
+        if( !read_file( base, old_image ) ) {
+            spdlog::warn( "DFU: failed to read {} to patch against: {}", base, std::strerror( errno ) );
+            continue;
+        }
+        Base b{ base, image_identity( old_image ), {} };
+        DfuPatch::diff( old_image, image, b.patch );
+
+        // The file may have changed since it was compressed, and the patch has to rebuild what is offered
+        if( b.patch.image_size != out.stream.image_size || b.patch.image_crc != out.stream.image_crc ) {
+            spdlog::warn( "DFU: {} changed while being read, not patching it", path );
+            break;
+        }
+        if( b.patch.data.size() < out.stream.data.size() ) {
+            out.bases.push_back( std::move( b ) );
+        }
+        else {
+            spdlog::info( "DFU: a patch against {} is no smaller than {}", base, out.name );
+        }
+    }
+
+    uint32_t session_id = new_session_id();
+    spdlog::info( "DFU session {:08x}: offering {} ({} bytes, {} compressed)", session_id, out.name,
+                  out.stream.image_size, out.stream.data.size() );
+
+    // The START itself goes out on the next update
+    _outgoing.emplace( session_id, std::move( out ) );
+    return session_id;
+}
+
+uint32_t Dfu::multicast( const std::vector<NodeId>& targets, const std::string& path, MulticastHandler done )
+{
+    if( targets.empty() ) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    Multicast mc;
+    if( !DfuStream::encode( path, mc.stream ) ) {
+        return 0;
+    }
+    mc.name = path.substr( path.find_last_of( '/' ) + 1 ).substr( 0, UINT8_MAX );
+    mc.done = std::move( done );
+    if( sizeof( bcmp_dfu_start_t ) + mc.name.size() > BcmpDispatcher::MAX_PAYLOAD ) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+
+    auto now = Clock::now();
+    for( NodeId target : targets ) {
+        mc.targets[ target ].heard = now;
+    }
+    mc.unfinished = mc.targets.size();
+
+    size_t chunks = ( mc.stream.data.size() + CHUNK_SIZE - 1 ) / CHUNK_SIZE;
+    mc.needed.resize( chunks );
+    mc.sent.resize( chunks );
+
+    uint32_t session_id = new_session_id();
+    spdlog::info( "DFU session {:08x}: multicasting {} to {} nodes ({} bytes, {} compressed)", session_id, mc.name,
+                  mc.targets.size(), mc.stream.image_size, mc.stream.data.size() );
+
+    // Offered on the next update, payloads follow once receivers accept
+    _multicasts.emplace( session_id, std::move( mc ) );
+    return session_id;
+}
+
+uint32_t Dfu::new_session_id()
+{
+    uint32_t session_id;
+    do {
+        session_id = _rng();
+    } while( session_id == 0 || _outgoing.count( session_id ) || _multicasts.count( session_id ) );
+    return session_id;
+}
+
+void Dfu::cancel( uint32_t session_id )
+{
+    auto it = _outgoing.find( session_id );
+    if( it != _outgoing.end() ) {
+        send_result( it->second.dst, BCMP_DFU_ABORT, session_id, BCMP_DFU_STATUS_ABORTED );
+        _outgoing.erase( it );
+    }
+    if( _multicasts.erase( session_id ) ) {
+        send_result( NetworkInterface::ALL_NODES_REALM_LOCAL, BCMP_DFU_ABORT, session_id, BCMP_DFU_STATUS_ABORTED );
+    }
+}
+
+bool Dfu::progress( uint32_t session_id, uint32_t& acked, uint32_t& total ) const
+{
+    auto it = _outgoing.find( session_id );
+    if( it == _outgoing.end() ) {
+        return false;
+    }
+    acked = it->second.acked;
+    total = static_cast<uint32_t>( it->second.stream.data.size() );
+    return true;
+}
+
+void Dfu::update( Clock::time_point now )
+{
+    Message messages[ 32 ];
+    size_t count;
+    while( ( count = _messages.try_dequeue_bulk( messages, 32 ) ) > 0 ) {
+        for( size_t i = 0; i < count; i++ ) {
+            Message& msg = messages[ i ];
+            const uint8_t* data = msg.pbuf->data();
+            switch( msg.type ) {
+            case BCMP_DFU_START:
+                handle_start( msg.src, msg, now );
+                break;
+            case BCMP_DFU_PAYLOAD_REQ: {
+                bcmp_dfu_payload_req_t req;
+                std::memcpy( &req, data, sizeof( req ) );
+                auto it = _multicasts.find( req.session_id );
+                if( it != _multicasts.end() ) {
+                    handle_nack( msg.src, it->second, msg, now );
+                }
+                else {
+                    handle_payload_req( msg.src, msg, now );
+                }
+                break;
+            }
+            case BCMP_DFU_PAYLOAD:
+                handle_payload( msg.src, msg, now );
+                break;
+            case BCMP_DFU_ACK: {
+                bcmp_dfu_ack_t ack;
+                std::memcpy( &ack, data, sizeof( ack ) );
+                handle_ack( msg.src, ack, now );
+                break;
+            }
+            case BCMP_DFU_END: {
+                bcmp_dfu_end_t end;
+                std::memcpy( &end, data, sizeof( end ) );
+                auto it = _multicasts.find( end.session_id );
+                if( it != _multicasts.end() ) {
+                    handle_target_result( msg.src, it->second, end.status );
+                }
+                else {
+                    handle_result( msg.src, end.session_id, end.status );
+                }
+                break;
+            }
+            case BCMP_DFU_ABORT: {
+                bcmp_dfu_abort_t abort;
+                std::memcpy( &abort, data, sizeof( abort ) );
+                // Either side may abort, a session ID names ours if we are sending it to that node
+                auto it = _outgoing.find( abort.session_id );
+                auto mc = _multicasts.find( abort.session_id );
+                if( it != _outgoing.end() && std::memcmp( &it->second.dst, &msg.src, sizeof( in6_addr ) ) == 0 ) {
+                    handle_result( msg.src, abort.session_id, abort.status );
+                }
+                else if( mc != _multicasts.end() ) {
+                    handle_target_result( msg.src, mc->second, abort.status );
+                }
+                else {
+                    handle_abort( msg.src, abort );
+                }
+                break;
+            }
+            }
+            msg.pbuf.reset();
+        }
+    }
+
+    // By ID, as finishing a transfer calls a handler that may start another
+    std::vector<uint32_t> sessions;
+    sessions.reserve( _outgoing.size() );
+    for( auto& out : _outgoing ) {
+        sessions.push_back( out.first );
+    }
+    for( uint32_t session_id : sessions ) {
+        auto it = _outgoing.find( session_id );
+        if( it != _outgoing.end() ) {
+            update_outgoing( session_id, it->second, now );
+        }
+    }
+
+    sessions.clear();
+    for( auto& mc : _multicasts ) {
+        sessions.push_back( mc.first );
+    }
+    for( uint32_t session_id : sessions ) {
+        auto it = _multicasts.find( session_id );
+        if( it != _multicasts.end() ) {
+            update_multicast( session_id, it->second, now );
+        }
+    }
+
+    for( auto it = _incoming.begin(); it != _incoming.end(); ) {
+        Incoming& in = it->second;
+        if( in.resume_dirty && in.state_fd >= 0 ) {
+            if( ::pwrite( in.state_fd, &in.resume, sizeof( in.resume ), 0 ) != sizeof( in.resume ) ) {
+                spdlog::warn( "DFU: failed to record progress of {}: {}", in.offer.path, std::strerror( errno ) );
+            }
+            in.resume_dirty = false;
+        }
+        if( in.ack_due ) {
+            send_ack( it->first, in );
+        }
+
+        if( now - in.active >= IDLE_TIMEOUT ) {
+            if( !in.finished ) {
+                spdlog::warn( "DFU session {:08x}: {} timed out, {} of {} bytes", in.offer.session_id,
+                              in.offer.name, in.received, in.stream_size );
+                close_incoming( in );
+                if( _receive_handler ) {
+                    _receive_handler( in.offer, BCMP_DFU_STATUS_TIMEOUT );
+                }
+            }
+            it = _incoming.erase( it );
+        }
+        else {
+            ++it;
+        }
+    }
+
+    for( auto it = _declined.begin(); it != _declined.end(); ) {
+        it = now - it->second >= IDLE_TIMEOUT ? _declined.erase( it ) : std::next( it );
+    }
+    for( auto it = _reported.begin(); it != _reported.end(); ) {
+        it = now - it->second.heard >= IDLE_TIMEOUT ? _reported.erase( it ) : std::next( it );
+    }
+}
+
+void Dfu::update_outgoing( uint32_t session_id, Outgoing& out, Clock::time_point now )
+{
+    if( out.progress == Clock::time_point{} ) {
+        out.progress = now;
+    }
+    if( now - out.progress >= IDLE_TIMEOUT ) {
+        spdlog::warn( "DFU session {:08x}: no progress, giving up", session_id );
+        send_result( out.dst, BCMP_DFU_ABORT, session_id, BCMP_DFU_STATUS_TIMEOUT );
+        finish_outgoing( session_id, BCMP_DFU_STATUS_TIMEOUT );
+        return;
+    }
+
+    // Offer until accepted
+    if( !out.accepted ) {
+        if( now - out.last_sent >= out.rto && send_offer( session_id, out ) ) {
+            if( out.last_sent != Clock::time_point{} ) {
+                out.rto = std::min<Clock::duration>( out.rto * 2, MAX_RTO );
+            }
+            out.last_sent = now;
+        }
+        return;
+    }
+
+    uint32_t size = static_cast<uint32_t>( out.stream.data.size() );
+
+    // All acknowledged and waiting for the receiver's END, which may have been lost. Repeating the last payload
+    // brings it back.
+    if( out.acked == size ) {
+        if( now - out.last_sent >= out.rto ) {
+            uint32_t last = size > out.origin ? size - 1 - ( size - 1 - out.origin ) % CHUNK_SIZE : size;
+            if( size == out.origin ? send_offer( session_id, out ) : send_payload( session_id, out, last, now ) ) {
+                out.rto = std::min<Clock::duration>( out.rto * 2, MAX_RTO );
+                out.last_sent = now;
+            }
+        }
+        return;
+    }
+
+    // Resend what is lost: sent before a payload that got through, allowing a quarter round trip for reordering,
+    // or not acknowledged within the retransmission timeout
+    bool timed_out = false;
+    for( uint32_t offset = out.acked; offset < out.next; offset += CHUNK_SIZE ) {
+        size_t slot = out.slot( offset );
+        if( out.sacked[ slot ] ) {
+            continue;
+        }
+        auto sent = out.sent[ slot ];
+        bool lost = sent < out.delivered && now - sent >= out.srtt + out.srtt / 4;
+        if( now - sent >= out.rto ) {
+            lost = timed_out = true;
+        }
+        if( lost ) {
+            if( !send_payload( session_id, out, offset, now ) ) {
+                return;
+            }
+            _retransmits++;
+        }
+    }
+    if( timed_out ) {
+        out.rto = std::min<Clock::duration>( out.rto * 2, MAX_RTO );
+    }
+
+    // And fill the window
+    while( out.next < size && out.next - out.acked < static_cast<uint32_t>( WINDOW ) * CHUNK_SIZE ) {
+        if( !send_payload( session_id, out, out.next, now ) ) {
+            return;
+        }
+        out.next = std::min<uint32_t>( out.next + CHUNK_SIZE, size );
+    }
+}
+
+bool Dfu::send_offer( uint32_t session_id, const Outgoing& out )
+{
+    if( out.delta ) {
+        return send_start( session_id, out.dst, out.name, out.stream, BCMP_DFU_FLAG_DELTA, &out.base );
+    }
+    return send_start( session_id, out.dst, out.name, out.stream, out.bases.empty() ? 0 : BCMP_DFU_FLAG_HAS_BASES );
+}
+
+bool Dfu::send_start( uint32_t session_id, const in6_addr& dst, const std::string& name, const DfuStream& stream,
+                      uint8_t flags, const bcmp_dfu_base_t* base )
+{
+    uint8_t buffer[ BcmpDispatcher::MAX_PAYLOAD ];
+    bcmp_dfu_start_t start{};
+    start.session_id    = session_id;
+    start.image_size    = stream.image_size;
+    start.image_crc     = stream.image_crc;
+    start.stream_size   = static_cast<uint32_t>( stream.data.size() );
+    start.chunk_size    = CHUNK_SIZE;
+    start.flags         = flags;
+    start.name_len      = static_cast<uint8_t>( name.size() );
+    std::memcpy( buffer, &start, sizeof( start ) );
+    std::memcpy( buffer + sizeof( start ), name.data(), name.size() );
+    size_t len = sizeof( start ) + name.size();
+    if( base ) {
+        std::memcpy( buffer + len, base, sizeof( *base ) );
+        len += sizeof( *base );
+    }
+
+    return _net.send_bcmp_message( dst, BCMP_DFU_START, buffer, len ) > 0;
+}
+
+bool Dfu::send_chunk( uint32_t session_id, const in6_addr& dst, const DfuStream& stream, uint32_t offset )
+{
+    uint8_t buffer[ BcmpDispatcher::MAX_PAYLOAD ];
+    bcmp_dfu_payload_t payload{ session_id, offset };
+    size_t len = std::min<size_t>( CHUNK_SIZE, stream.data.size() - offset );
+    std::memcpy( buffer, &payload, sizeof( payload ) );
+    std::memcpy( buffer + sizeof( payload ), stream.data.data() + offset, len );
+    return _net.send_bcmp_message( dst, BCMP_DFU_PAYLOAD, buffer, sizeof( payload ) + len ) > 0;
+}
+
+bool Dfu::send_payload( uint32_t session_id, Outgoing& out, uint32_t offset, Clock::time_point now )
+{
+    // Out of pbufs or TX ring space, so leave the rest of the window for the next update
+    if( !send_chunk( session_id, out.dst, out.stream, offset ) ) {
+        return false;
+    }
+
+    size_t slot = out.slot( offset );
+    out.sent[ slot ] = now;
+    out.transmissions[ slot ] = offset < out.next ? out.transmissions[ slot ] + 1 : 1;
+    out.last_sent = now;
+    return true;
+}
+
+void Dfu::handle_payload_req( const in6_addr& src, const Message& msg, Clock::time_point now )
+{
+    bcmp_dfu_payload_req_t req;
+    std::memcpy( &req, msg.pbuf->data(), sizeof( req ) );
+    auto it = _outgoing.find( req.session_id );
+    if( it == _outgoing.end() || std::memcmp( &it->second.dst, &src, sizeof( src ) ) != 0 || it->second.accepted ) {
+        return;
+    }
+    Outgoing& out = it->second;
+
+    // Not an acceptance, the receiver reports the image it has. Only the first report counts, later ones were
+    // repeated before our next offer got through.
+    if( msg.pbuf->len() >= sizeof( req ) + sizeof( bcmp_dfu_base_t ) ) {
+        if( !out.bases.empty() ) {
+            bcmp_dfu_base_t base;
+            std::memcpy( &base, msg.pbuf->data() + sizeof( req ), sizeof( base ) );
+            choose_stream( req.session_id, out, base, now );
+        }
+        return;
+    }
+    if( req.offset > out.stream.data.size() ) {
+        send_result( src, BCMP_DFU_ABORT, req.session_id, BCMP_DFU_STATUS_BAD_STREAM );
+        finish_outgoing( req.session_id, BCMP_DFU_STATUS_BAD_STREAM );
+        return;
+    }
+
+    uint32_t session_id = req.session_id;
+    uint32_t offset = req.offset;
+    if( offset > 0 ) {
+        spdlog::info( "DFU session {:08x}: resuming at {} of {} bytes", session_id, offset,
+                      out.stream.data.size() );
+    }
+    out.accepted    = true;
+    out.origin      = req.offset;
+    out.acked       = req.offset;
+    out.next        = req.offset;
+    out.progress    = now;
+    out.rto         = INITIAL_RTO;
+}
+
+void Dfu::choose_stream( uint32_t session_id, Outgoing& out, const bcmp_dfu_base_t& base, Clock::time_point now )
+{
+    auto match = std::find_if( out.bases.begin(), out.bases.end(), [&base]( const Base& b ){
+        return b.id.size == base.size && b.id.crc == base.crc;
+    });
+
+    if( match == out.bases.end() ) {
+        spdlog::info( "DFU session {:08x}: receiver has no known version of {}", session_id, out.name );
+    }
+    else {
+        spdlog::info( "DFU session {:08x}: sending {} as a patch against {}, {} bytes instead of {}", session_id,
+                      out.name, match->path, match->patch.data.size(), out.stream.data.size() );
+        out.stream  = std::move( match->patch );
+        out.delta   = true;
+        out.base    = base;
+    }
+
+    // Offer again right away, the patch or the whole image without bases
+    out.bases.clear();
+    out.last_sent   = Clock::time_point{};
+    out.rto         = INITIAL_RTO;
+    out.progress    = now;
+}
+
+void Dfu::handle_ack( const in6_addr& src, const bcmp_dfu_ack_t& ack, Clock::time_point now )
+{
+    auto it = _outgoing.find( ack.session_id );
+    if( it == _outgoing.end() || std::memcmp( &it->second.dst, &src, sizeof( src ) ) != 0 || !it->second.accepted ) {
+        return;
+    }
+    Outgoing& out = it->second;
+    // ACKs are not kept in order across receive workers, and the bitmap of an older one would mark payloads past
+    // its offset that are still missing
+    if( ack.offset < out.acked || ack.offset > out.next ||
+        ( ack.offset != out.next && ( ack.offset - out.origin ) % CHUNK_SIZE != 0 ) ) {
+        return;
+    }
+
+    if( ack.offset > out.acked ) {
+        // A round trip sample from the newest payload acknowledged, unless it was resent (Karn)
+        uint32_t newest = ack.offset - 1 - ( ack.offset - 1 - out.origin ) % CHUNK_SIZE;
+        size_t newest_slot = out.slot( newest );
+        if( out.transmissions[ newest_slot ] == 1 ) {
+            auto sample = now - out.sent[ newest_slot ];
+            out.srtt = out.srtt == Clock::duration{} ? sample : ( out.srtt * 7 + sample ) / 8;
+            out.rto = std::clamp<Clock::duration>( out.srtt * 2, MIN_RTO, MAX_RTO );
+        }
+
+        for( uint32_t offset = out.acked; offset < ack.offset; offset += CHUNK_SIZE ) {
+            size_t slot = out.slot( offset );
+            out.delivered = std::max( out.delivered, out.sent[ slot ] );
+            out.sacked[ slot ] = false;
+            out.transmissions[ slot ] = 0;
+        }
+        out.acked = ack.offset;
+        out.progress = now;
+    }
+
+    for( size_t i = 1; i < WINDOW; i++ ) {
+        uint32_t offset = out.acked + i * CHUNK_SIZE;
+        if( offset >= out.next ) {
+            break;
+        }
+        if( ack.sack_bitmap & ( 1u << i ) ) {
+            size_t slot = out.slot( offset );
+            out.sacked[ slot ] = true;
+            out.delivered = std::max( out.delivered, out.sent[ slot ] );
+        }
+    }
+}
+
+void Dfu::handle_result( const in6_addr& src, uint32_t session_id, uint8_t status )
+{
+    auto it = _outgoing.find( session_id );
+    if( it == _outgoing.end() || std::memcmp( &it->second.dst, &src, sizeof( src ) ) != 0 ) {
+        return;
+    }
+    finish_outgoing( session_id, static_cast<bcmp_dfu_status_t>( status ) );
+}
+
+void Dfu::finish_outgoing( uint32_t session_id, bcmp_dfu_status_t status )
+{
+    auto it = _outgoing.find( session_id );
+    SendHandler done = std::move( it->second.done );
+    if( status == BCMP_DFU_STATUS_OK ) {
+        spdlog::info( "DFU session {:08x}: {} delivered", session_id, it->second.name );
+    }
+    else {
+        spdlog::warn( "DFU session {:08x}: {} failed with status {}", session_id, it->second.name, status );
+    }
+    _outgoing.erase( it );
+
+    // Last, the handler may start another transfer
+    if( done ) {
+        done( session_id, status );
+    }
+}
+
+void Dfu::update_multicast( uint32_t session_id, Multicast& mc, Clock::time_point now )
+{
+    // Targets silent for too long are given up on
+    for( auto& target : mc.targets ) {
+        if( !target.second.finished && now - target.second.heard >= IDLE_TIMEOUT ) {
+            spdlog::warn( "DFU session {:08x}: {:016x} timed out", session_id, target.first );
+            target.second.finished = true;
+            target.second.status = BCMP_DFU_STATUS_TIMEOUT;
+            mc.unfinished--;
+        }
+    }
+    if( mc.unfinished == 0 ) {
+        spdlog::info( "DFU session {:08x}: multicast of {} done", session_id, mc.name );
+
+        MulticastHandler done = std::move( mc.done );
+        Results results;
+        for( auto& target : mc.targets ) {
+            results.emplace( target.first, target.second.status );
+        }
+        _multicasts.erase( session_id );
+        if( done ) {
+            done( session_id, results );
+        }
+        return;
+    }
+
+    // Multicast a burst of what was asked for, in stream order, one pass after the other
+    for( size_t burst = 0; mc.pending > 0 && burst < MULTICAST_BURST; burst++ ) {
+        while( !mc.needed[ mc.cursor ] ) {
+            mc.cursor = ( mc.cursor + 1 ) % mc.needed.size();
+        }
+        uint32_t offset = static_cast<uint32_t>( mc.cursor * CHUNK_SIZE );
+        if( !send_chunk( session_id, NetworkInterface::ALL_NODES_REALM_LOCAL, mc.stream, offset ) ) {
+            return;
+        }
+        if( mc.sent[ mc.cursor ] ) {
+            _retransmits++;
+        }
+        mc.sent[ mc.cursor ] = true;
+        mc.needed[ mc.cursor ] = false;
+        mc.pending--;
+    }
+
+    // Offer again, which doubles as the poll for what receivers are still missing. Rarely while a pass is still
+    // going out, which only has the targets answer within IDLE_TIMEOUT.
+    if( now - mc.last_poll >= ( mc.pending == 0 ? Clock::duration{ POLL_INTERVAL } : Clock::duration{ PASS_POLL_INTERVAL } ) ) {
+        if( send_start( session_id, NetworkInterface::ALL_NODES_REALM_LOCAL, mc.name, mc.stream, BCMP_DFU_FLAG_MULTICAST ) ) {
+            mc.last_poll = now;
+        }
+    }
+}
+
+void Dfu::need( Multicast& mc, size_t chunk )
+{
+    if( chunk < mc.needed.size() && !mc.needed[ chunk ] ) {
+        mc.needed[ chunk ] = true;
+        mc.pending++;
+    }
+}
+
+void Dfu::handle_nack( const in6_addr& src, Multicast& mc, const Message& msg, Clock::time_point now )
+{
+    bcmp_dfu_payload_req_t req;
+    std::memcpy( &req, msg.pbuf->data(), sizeof( req ) );
+
+    // Anyone may join in, but only targets are waited for
+    auto target = mc.targets.find( NetworkInterface::node_id_of( src ) );
+    if( target != mc.targets.end() ) {
+        target->second.heard = now;
+    }
+
+    size_t first = req.offset / CHUNK_SIZE;
+    size_t bitmap_len = msg.pbuf->len() - sizeof( req );
+    if( bitmap_len == 0 ) {
+        // Accepted, everything from offset on
+        for( size_t chunk = first; chunk < mc.needed.size(); chunk++ ) {
+            need( mc, chunk );
+        }
+        return;
+    }
+
+    // Union with what others are missing
+    const uint8_t* bitmap = msg.pbuf->data() + sizeof( req );
+    for( size_t i = 0; i < bitmap_len * 8 && first + i < mc.needed.size(); i++ ) {
+        if( bitmap[ i / 8 ] & ( 1u << ( i % 8 ) ) ) {
+            need( mc, first + i );
+        }
+    }
+}
+
+void Dfu::handle_target_result( const in6_addr& src, Multicast& mc, uint8_t status )
+{
+    auto target = mc.targets.find( NetworkInterface::node_id_of( src ) );
+    if( target == mc.targets.end() || target->second.finished ) {
+        return;
+    }
+    target->second.finished = true;
+    target->second.status = static_cast<bcmp_dfu_status_t>( status );
+    mc.unfinished--;
+}
+
+void Dfu::handle_start( const in6_addr& src, const Message& msg, Clock::time_point now )
+{
+    bcmp_dfu_start_t start;
+    std::memcpy( &start, msg.pbuf->data(), sizeof( start ) );
+    bool delta = start.flags & BCMP_DFU_FLAG_DELTA;
+    if( msg.pbuf->len() < sizeof( start ) + start.name_len + ( delta ? sizeof( bcmp_dfu_base_t ) : 0 ) ) {
+        spdlog::debug( "Malformed DFU start, name of {} bytes", start.name_len );
+        return;
+    }
+
+    uint32_t session_id = start.session_id;
+    IncomingKey key{ NetworkInterface::node_id_of( src ), session_id };
+    auto it = _incoming.find( key );
+    if( it != _incoming.end() ) {
+        // Our answer was lost, or the sender of a multicast transfer polls for what we are missing
+        Incoming& in = it->second;
+        in.active = now;
+        if( in.finished ) {
+            send_result( src, BCMP_DFU_END, start.session_id, in.status );
+        }
+        else if( in.multicast ) {
+            send_nack( key, in );
+        }
+        else {
+            bcmp_dfu_payload_req_t req{ start.session_id, in.origin, WINDOW };
+            _net.send_bcmp_message( src, BCMP_DFU_PAYLOAD_REQ, &req, sizeof( req ) );
+        }
+        return;
+    }
+
+    // Declined multicast offers are answered once, not every poll
+    bool multicast = start.flags & BCMP_DFU_FLAG_MULTICAST;
+    if( multicast && _declined.count( key ) ) {
+        _declined[ key ] = now;
+        return;
+    }
+
+    // Patches are only made for one receiver
+    if( start.chunk_size == 0 || start.chunk_size > BcmpDispatcher::MAX_PAYLOAD - sizeof( bcmp_dfu_payload_t ) ||
+        ( delta && multicast ) ) {
+        send_result( src, BCMP_DFU_ABORT, start.session_id, BCMP_DFU_STATUS_BAD_STREAM );
+        return;
+    }
+
+    Incoming in;
+    in.src          = src;
+    in.multicast    = multicast;
+    in.stream_size  = start.stream_size;
+    in.chunk_size   = start.chunk_size;
+    in.active       = now;
+    in.delta        = delta;
+    in.offer        = DfuOffer{ key.first, start.session_id,
+                                std::string( reinterpret_cast<const char*>( msg.pbuf->data() ) + sizeof( start ), start.name_len ),
+                                start.image_size, start.image_crc, {} };
+    if( delta ) {
+        std::memcpy( &in.base, msg.pbuf->data() + sizeof( start ) + start.name_len, sizeof( in.base ) );
+    }
+
+    // Accepted already if we reported our image, and this is the sender's answer or a repeat of the offer
+    auto reported = _reported.find( key );
+    if( reported != _reported.end() ) {
+        in.offer.path = reported->second.path;
+        if( start.flags & BCMP_DFU_FLAG_HAS_BASES ) {
+            reported->second.heard = now;
+            send_base( key, reported->second );
+            return;
+        }
+        _reported.erase( reported );
+    }
+    else {
+        in.offer.path = _accept_handler ? _accept_handler( in.offer ) : std::string();
+    }
+    if( in.offer.path.empty() ) {
+        spdlog::info( "DFU session {:08x}: rejected {} from {:016x}", session_id, in.offer.name, key.first );
+        send_result( src, BCMP_DFU_ABORT, start.session_id, BCMP_DFU_STATUS_REJECTED );
+        if( multicast ) {
+            _declined[ key ] = now;
+        }
+        return;
+    }
+
+    // The sender can patch what we have instead of sending the whole image, which it decides on hearing what that is
+    Reported report{ src, in.offer.path, {}, now };
+    if( ( start.flags & BCMP_DFU_FLAG_HAS_BASES ) && !multicast && image_identity( in.offer.path, report.base ) ) {
+        uint32_t size = report.base.size;
+        spdlog::info( "DFU session {:08x}: offered {}, reporting {} ({} bytes)", session_id, in.offer.name,
+                      in.offer.path, size );
+        send_base( key, _reported.emplace( key, std::move( report ) ).first->second );
+        return;
+    }
+
+    // And a patch is only of use against the same image
+    bcmp_dfu_base_t have;
+    if( delta && !( image_identity( in.offer.path, have ) && have.size == in.base.size && have.crc == in.base.crc ) ) {
+        spdlog::warn( "DFU session {:08x}: patch for {} does not apply to {}", session_id, in.offer.name,
+                      in.offer.path );
+        send_result( src, BCMP_DFU_ABORT, start.session_id, BCMP_DFU_STATUS_BAD_STREAM );
+        return;
+    }
+
+    if( !open_incoming( in ) ) {
+        spdlog::warn( "DFU: failed to open {}: {}", in.offer.path, std::strerror( errno ) );
+        close_incoming( in );
+        send_result( src, BCMP_DFU_ABORT, start.session_id, BCMP_DFU_STATUS_IO_ERROR );
+        if( multicast ) {
+            _declined[ key ] = now;
+        }
+        return;
+    }
+
+    spdlog::info( "DFU session {:08x}: receiving {}{} into {}{}", session_id, in.offer.name,
+                  multicast ? " (multicast)" : delta ? " (patch)" : "", in.offer.path,
+                  in.received > 0 ? fmt::format( ", resuming at {} of {} bytes", in.received, in.stream_size ) : "" );
+
+    Incoming& stored = _incoming.emplace( key, std::move( in ) ).first->second;
+    setup_decoder( stored );
+
+    bcmp_dfu_payload_req_t req{ start.session_id, stored.received, WINDOW };
+    _net.send_bcmp_message( src, BCMP_DFU_PAYLOAD_REQ, &req, sizeof( req ) );
+
+    if( stored.received == stored.stream_size ) {
+        complete_incoming( stored, now );
+    }
+}
+
+void Dfu::setup_decoder( Incoming& in )
+{
+    // The decoder writes through the session, which has its final address by now
+    DfuStreamDecoder::Sink write_image = [&in]( const uint8_t* data, size_t len ){
+        in.crc = crc32( in.crc, data, len );
+        if( !write_all( in.fd, data, len ) ) {
+            in.write_failed = true;
+            return false;
+        }
+        return true;
+    };
+
+    // A patch is decoded, then applied to the old image
+    DfuStreamDecoder::Sink sink = write_image;
+    if( in.delta ) {
+        uint32_t base_size = in.base.size;
+        in.patch = std::make_unique<DfuPatchApplier>( in.base_fd, base_size, in.offer.image_size,
+                                                      std::move( write_image ) );
+        in.patch->reset( in.resume.image_offset );
+        sink = [&in]( const uint8_t* data, size_t len ){
+            return in.patch->write( data, len );
+        };
+    }
+
+    in.decoder = std::make_unique<DfuStreamDecoder>( std::move( sink ), [&in](){
+        // Ops do not span segments, so this holds for any patch we made
+        if( in.patch && !in.patch->idle() ) {
+            return;
+        }
+        in.resume.stream_offset     = in.decoder->stream_offset();
+        in.resume.decoded_offset    = in.decoder->image_offset();
+        in.resume.image_offset      = in.patch ? in.patch->image_offset() : in.decoder->image_offset();
+        in.resume.crc               = static_cast<uint32_t>( in.crc );
+        in.resume_dirty             = true;
+    });
+    in.decoder->reset( in.resume.stream_offset, in.resume.decoded_offset );
+}
+
+void Dfu::send_base( const IncomingKey& key, const Reported& report )
+{
+    uint8_t buffer[ sizeof( bcmp_dfu_payload_req_t ) + sizeof( bcmp_dfu_base_t ) ];
+    bcmp_dfu_payload_req_t req{ key.second, 0, WINDOW };
+    std::memcpy( buffer, &req, sizeof( req ) );
+    std::memcpy( buffer + sizeof( req ), &report.base, sizeof( report.base ) );
+    _net.send_bcmp_message( report.src, BCMP_DFU_PAYLOAD_REQ, buffer, sizeof( buffer ) );
+}
+
+bool Dfu::open_incoming( Incoming& in )
+{
+    std::string part = in.offer.path + ".part";
+    std::string state = in.offer.path + ".dfu";
+    in.fd = ::open( part.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+    in.state_fd = ::open( state.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+    if( in.fd < 0 || in.state_fd < 0 ) {
+        return false;
+    }
+
+    // The old image is read while the new one is written beside it, and stays open once replaced
+    if( in.delta ) {
+        in.base_fd = ::open( in.offer.path.c_str(), O_RDONLY | O_CLOEXEC );
+        if( in.base_fd < 0 ) {
+            return false;
+        }
+    }
+
+    // Pick up an earlier transfer of the same image where it stopped
+    ResumeState resume{};
+    struct stat st;
+    bool resumable = ::pread( in.state_fd, &resume, sizeof( resume ), 0 ) == sizeof( resume ) &&
+                     resume.magic == RESUME_MAGIC &&
+                     resume.image_size == in.offer.image_size && resume.image_crc == in.offer.image_crc &&
+                     resume.stream_size == in.stream_size && resume.stream_offset <= in.stream_size &&
+                     resume.image_offset <= resume.image_size &&
+                     resume.base_crc == ( in.delta ? in.base.crc : 0 ) &&
+                     ( in.delta || resume.decoded_offset == resume.image_offset ) &&
+                     ::fstat( in.fd, &st ) == 0 && static_cast<uint64_t>( st.st_size ) >= resume.image_offset;
+    if( !resumable ) {
+        resume = ResumeState{ RESUME_MAGIC, in.offer.image_size, in.offer.image_crc, in.stream_size, 0, 0,
+                              static_cast<uint32_t>( crc32( 0, Z_NULL, 0 ) ), in.delta ? in.base.crc : 0, 0 };
+        in.resume_dirty = true;
+    }
+
+    if( ::ftruncate( in.fd, resume.image_offset ) < 0 || ::lseek( in.fd, resume.image_offset, SEEK_SET ) < 0 ) {
+        return false;
+    }
+    in.resume   = resume;
+    in.crc      = resume.crc;
+    in.origin   = resume.stream_offset;
+    in.received = resume.stream_offset;
+
+    // Multicast payloads start at multiples of the chunk size, wherever we resume
+    if( in.multicast ) {
+        in.origin -= in.origin % in.chunk_size;
+        in.spilled.resize( ( in.stream_size + in.chunk_size - 1 ) / in.chunk_size );
+        in.spill_fd = ::open( ( in.offer.path + ".stream" ).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+        if( in.spill_fd < 0 ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Dfu::handle_payload( const in6_addr& src, Message& msg, Clock::time_point now )
+{
+    bcmp_dfu_payload_t payload;
+    std::memcpy( &payload, msg.pbuf->data(), sizeof( payload ) );
+    size_t len = msg.pbuf->len() - sizeof( payload );
+    uint32_t session_id = payload.session_id;
+
+    // Multicast payloads reach every node, answered only by polls
+    auto it = _incoming.find( IncomingKey{ NetworkInterface::node_id_of( src ), session_id } );
+    if( it == _incoming.end() ) {
+        // We lost the session, e.g. to a restart. The sender can offer again and we resume.
+        if( !msg.multicast ) {
+            send_result( src, BCMP_DFU_ABORT, session_id, BCMP_DFU_STATUS_ABORTED );
+        }
+        return;
+    }
+    Incoming& in = it->second;
+    if( in.finished ) {
+        if( !msg.multicast ) {
+            send_result( src, BCMP_DFU_END, session_id, in.status );
+        }
+        return;
+    }
+
+    in.active = now;
+    if( in.multicast ) {
+        if( !receive_multicast( in, payload.offset, msg.pbuf->data() + sizeof( payload ), len ) ) {
+            fail_incoming( it );
+        }
+        else if( in.received == in.stream_size ) {
+            complete_incoming( in, now );
+        }
+        return;
+    }
+
+    in.ack_due = true;
+    uint64_t end = static_cast<uint64_t>( payload.offset ) + len;
+    if( payload.offset < in.received || payload.offset >= in.received + static_cast<uint32_t>( WINDOW ) * in.chunk_size ||
+        ( payload.offset - in.origin ) % in.chunk_size != 0 || end > in.stream_size ||
+        ( len != in.chunk_size && end != in.stream_size ) ) {
+        return;
+    }
+    in.pending[ in.slot( payload.offset ) ] = std::move( msg.pbuf );
+
+    // Feed whatever is now in order
+    while( in.received < in.stream_size && in.pending[ in.slot( in.received ) ] ) {
+        PbufPtr pbuf = std::move( in.pending[ in.slot( in.received ) ] );
+        size_t chunk_len = pbuf->len() - sizeof( payload );
+        if( !in.decoder->write( pbuf->data() + sizeof( payload ), chunk_len ) ) {
+            fail_incoming( it );
+            return;
+        }
+        in.received += chunk_len;
+    }
+
+    if( in.received == in.stream_size ) {
+        complete_incoming( in, now );
+    }
+}
+
+bool Dfu::receive_multicast( Incoming& in, uint32_t offset, const uint8_t* data, size_t len )
+{
+    uint64_t end = static_cast<uint64_t>( offset ) + len;
+    if( offset % in.chunk_size != 0 || end > in.stream_size || ( len != in.chunk_size && end != in.stream_size ) ||
+        end <= in.received ) {
+        return true;
+    }
+
+    // Ahead of a gap, so put aside
+    if( offset > in.received ) {
+        size_t chunk = offset / in.chunk_size;
+        if( !in.spilled[ chunk ] ) {
+            if( ::pwrite( in.spill_fd, data, len, offset ) != static_cast<ssize_t>( len ) ) {
+                in.write_failed = true;
+                return false;
+            }
+            in.spilled[ chunk ] = true;
+        }
+        return true;
+    }
+
+    // The payload holding received, where we may have resumed partway into it. Then whatever was put aside behind.
+    if( !in.decoder->write( data + ( in.received - offset ), end - in.received ) ) {
+        return false;
+    }
+    in.received = static_cast<uint32_t>( end );
+
+    uint8_t buffer[ BcmpDispatcher::MAX_PAYLOAD ];
+    while( in.received < in.stream_size && in.spilled[ in.received / in.chunk_size ] ) {
+        size_t n = std::min<size_t>( in.chunk_size, in.stream_size - in.received );
+        if( ::pread( in.spill_fd, buffer, n, in.received ) != static_cast<ssize_t>( n ) ) {
+            in.write_failed = true;
+            return false;
+        }
+        if( !in.decoder->write( buffer, n ) ) {
+            return false;
+        }
+        in.received += n;
+    }
+    return true;
+}
+
+void Dfu::fail_incoming( std::map<IncomingKey, Incoming>::iterator it )
+{
+    Incoming& in = it->second;
+    bcmp_dfu_status_t status = in.write_failed ? BCMP_DFU_STATUS_IO_ERROR : BCMP_DFU_STATUS_BAD_STREAM;
+    spdlog::warn( "DFU session {:08x}: {} failed at {} of {} bytes, status {}", in.offer.session_id,
+                  in.offer.name, in.received, in.stream_size, status );
+    send_result( in.src, BCMP_DFU_ABORT, in.offer.session_id, status );
+
+    // Nothing of a broken stream is worth resuming
+    close_incoming( in );
+    ::unlink( ( in.offer.path + ".part" ).c_str() );
+    ::unlink( ( in.offer.path + ".dfu" ).c_str() );
+    if( _receive_handler ) {
+        _receive_handler( in.offer, status );
+    }
+    _incoming.erase( it );
+}
+
+void Dfu::complete_incoming( Incoming& in, Clock::time_point now )
+{
+    std::string part = in.offer.path + ".part";
+    std::string state = in.offer.path + ".dfu";
+
+    in.status = BCMP_DFU_STATUS_OK;
+    uint32_t image_offset = in.patch ? in.patch->image_offset() : in.decoder->image_offset();
+    if( !in.decoder->at_boundary() || ( in.patch && !in.patch->idle() ) || image_offset != in.offer.image_size ) {
+        in.status = BCMP_DFU_STATUS_BAD_STREAM;
+    }
+    else if( static_cast<uint32_t>( in.crc ) != in.offer.image_crc ) {
+        in.status = BCMP_DFU_STATUS_CRC_ERROR;
+    }
+    else if( ::fsync( in.fd ) < 0 || ::rename( part.c_str(), in.offer.path.c_str() ) < 0 ) {
+        in.status = BCMP_DFU_STATUS_IO_ERROR;
+    }
+
+    close_incoming( in );
+    ::unlink( state.c_str() );
+    if( in.status != BCMP_DFU_STATUS_OK ) {
+        ::unlink( part.c_str() );
+        spdlog::warn( "DFU session {:08x}: {} failed, status {}", in.offer.session_id, in.offer.name, in.status );
+    }
+    else {
+        spdlog::info( "DFU session {:08x}: {} received, {} bytes", in.offer.session_id, in.offer.path,
+                      in.offer.image_size );
+    }
+
+    in.finished = true;
+    in.ack_due = false;
+    in.resume_dirty = false;
+    in.active = now;
+    send_result( in.src, BCMP_DFU_END, in.offer.session_id, in.status );
+    if( _receive_handler ) {
+        _receive_handler( in.offer, in.status );
+    }
+}
+
+void Dfu::close_incoming( Incoming& in )
+{
+    if( in.state_fd >= 0 ) {
+        if( in.resume_dirty ) {
+            ::pwrite( in.state_fd, &in.resume, sizeof( in.resume ), 0 );
+            in.resume_dirty = false;
+        }
+        ::close( in.state_fd );
+        in.state_fd = -1;
+    }
+    if( in.fd >= 0 ) {
+        ::close( in.fd );
+        in.fd = -1;
+    }
+    if( in.base_fd >= 0 ) {
+        ::close( in.base_fd );
+        in.base_fd = -1;
+    }
+
+    // Only what was decoded is kept for resuming
+    if( in.spill_fd >= 0 ) {
+        ::close( in.spill_fd );
+        in.spill_fd = -1;
+        ::unlink( ( in.offer.path + ".stream" ).c_str() );
+    }
+    for( auto& pbuf : in.pending ) {
+        pbuf.reset();
+    }
+}
+
+void Dfu::handle_abort( const in6_addr& src, const bcmp_dfu_abort_t& abort )
+{
+    auto it = _incoming.find( IncomingKey{ NetworkInterface::node_id_of( src ), abort.session_id } );
+    if( it == _incoming.end() || it->second.finished ) {
+        return;
+    }
+
+    // What was received so far stays for the next offer of the image
+    Incoming& in = it->second;
+    spdlog::info( "DFU session {:08x}: {} aborted by the sender", abort.session_id, in.offer.name );
+    close_incoming( in );
+    if( _receive_handler ) {
+        _receive_handler( in.offer, BCMP_DFU_STATUS_ABORTED );
+    }
+    _incoming.erase( it );
+}
+
+void Dfu::send_ack( const IncomingKey& key, Incoming& in )
+{
+    bcmp_dfu_ack_t ack{ key.second, in.received, 0 };
+    for( size_t i = 1; i < WINDOW; i++ ) {
+        uint64_t offset = in.received + static_cast<uint64_t>( i ) * in.chunk_size;
+        if( offset >= in.stream_size ) {
+            break;
+        }
+        if( in.pending[ in.slot( static_cast<uint32_t>( offset ) ) ] ) {
+            ack.sack_bitmap |= 1u << i;
+        }
+    }
+    if( _net.send_bcmp_message( in.src, BCMP_DFU_ACK, &ack, sizeof( ack ) ) > 0 ) {
+        in.ack_due = false;
+    }
+}
+
+void Dfu::send_nack( const IncomingKey& key, Incoming& in )
+{
+    uint8_t buffer[ BcmpDispatcher::MAX_PAYLOAD ] = {};
+    bcmp_dfu_payload_req_t req{ key.second, in.received, WINDOW };
+    std::memcpy( buffer, &req, sizeof( req ) );
+
+    // From the payload holding received, which is always missing, on as far as the bitmap reaches
+    uint8_t* bitmap = buffer + sizeof( req );
+    size_t max_bits = ( sizeof( buffer ) - sizeof( req ) ) * 8;
+    size_t first = in.received / in.chunk_size;
+    size_t bitmap_len = 0;
+    for( size_t i = 0; i < max_bits && first + i < in.spilled.size(); i++ ) {
+        if( !in.spilled[ first + i ] ) {
+            bitmap[ i / 8 ] |= 1u << ( i % 8 );
+            bitmap_len = i / 8 + 1;
+        }
+    }
+    _net.send_bcmp_message( in.src, BCMP_DFU_PAYLOAD_REQ, buffer, sizeof( req ) + bitmap_len );
+}
+
+void Dfu::send_result( const in6_addr& dst, uint16_t type, uint32_t session_id, bcmp_dfu_status_t status )
+{
+    // END and ABORT share a layout
+    bcmp_dfu_end_t result{ session_id, static_cast<uint8_t>( status ) };
+    if( _net.send_bcmp_message( dst, type, &result, sizeof( result ) ) < 0 ) {
+        spdlog::debug( "Failed to send DFU result: {}", std::strerror( errno ) );
+    }
+}
+
+}
+}
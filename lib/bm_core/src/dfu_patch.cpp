@@ -0,0 +1,223 @@
+#include "bm_core/dfu_patch.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+
+#include <unistd.h>
+#include <zlib.h>
+
+namespace bm {
+namespace core {
+
+namespace {
+
+struct __attribute__((packed)) CopyOp {
+    uint8_t     op;
+    uint32_t    offset;
+    uint32_t    len;
+};
+
+struct __attribute__((packed)) InsertOp {
+    uint8_t     op;
+    uint32_t    len;
+};
+
+// Polynomial rolling hash over BLOCK_SIZE bytes, modulo 2^32
+constexpr uint32_t HASH_BASE = 0x01000193;
+
+uint32_t block_hash( const uint8_t* p )
+{
+    uint32_t h = 0;
+    for( size_t i = 0; i < DfuPatch::BLOCK_SIZE; i++ ) {
+        h = h * HASH_BASE + p[ i ];
+    }
+    return h;
+}
+
+uint32_t hash_top()
+{
+    uint32_t top = 1;
+    for( size_t i = 1; i < DfuPatch::BLOCK_SIZE; i++ ) {
+        top *= HASH_BASE;
+    }
+    return top;
+}
+
+// Writes ops so that none spans two segments
+class PatchWriter {
+public:
+    explicit PatchWriter( std::vector<uint8_t>& stream ) : _encoder{ stream } {}
+
+    void copy( uint32_t offset, uint32_t len )
+    {
+        CopyOp op{ DfuPatch::COPY, offset, len };
+        if( _encoder.room() < sizeof( op ) ) {
+            _encoder.flush();
+        }
+        _encoder.write( reinterpret_cast<const uint8_t*>( &op ), sizeof( op ) );
+    }
+
+    // Split where a segment ends
+    void insert( const uint8_t* data, size_t len )
+    {
+        while( len > 0 ) {
+            if( _encoder.room() <= sizeof( InsertOp ) ) {
+                _encoder.flush();
+            }
+            uint32_t n = static_cast<uint32_t>( std::min( len, _encoder.room() - sizeof( InsertOp ) ) );
+            InsertOp op{ DfuPatch::INSERT, n };
+            _encoder.write( reinterpret_cast<const uint8_t*>( &op ), sizeof( op ) );
+            _encoder.write( data, n );
+            data += n;
+            len -= n;
+        }
+    }
+
+    void flush() { _encoder.flush(); }
+
+private:
+    DfuStreamEncoder _encoder;
+};
+
+}
+
+void DfuPatch::diff( const std::vector<uint8_t>& base, const std::vector<uint8_t>& image, DfuStream& stream )
+{
+    stream.data.clear();
+    stream.image_size = static_cast<uint32_t>( image.size() );
+    stream.image_crc = static_cast<uint32_t>( crc32( crc32( 0, Z_NULL, 0 ), image.data(), image.size() ) );
+
+    // First occurrence of every aligned block of the base
+    std::unordered_map<uint32_t, uint32_t> blocks;
+    if( base.size() >= BLOCK_SIZE ) {
+        blocks.reserve( base.size() / BLOCK_SIZE );
+        for( size_t offset = 0; offset + BLOCK_SIZE <= base.size(); offset += BLOCK_SIZE ) {
+            blocks.emplace( block_hash( base.data() + offset ), static_cast<uint32_t>( offset ) );
+        }
+    }
+
+    PatchWriter writer( stream.data );
+    const uint32_t top = hash_top();
+    size_t literal = 0;     // Start of the bytes not covered yet
+    size_t i = 0;
+    uint32_t h = image.size() >= BLOCK_SIZE ? block_hash( image.data() ) : 0;
+    while( !blocks.empty() && i + BLOCK_SIZE <= image.size() ) {
+        auto it = blocks.find( h );
+        if( it != blocks.end() && std::memcmp( base.data() + it->second, image.data() + i, BLOCK_SIZE ) == 0 ) {
+            size_t src = it->second;
+            size_t start = i;
+            while( start > literal && src > 0 && base[ src - 1 ] == image[ start - 1 ] ) {
+                start--;
+                src--;
+            }
+            size_t end = i + BLOCK_SIZE;
+            while( end < image.size() && src + ( end - start ) < base.size() && base[ src + ( end - start ) ] == image[ end ] ) {
+                end++;
+            }
+
+            writer.insert( image.data() + literal, start - literal );
+            writer.copy( static_cast<uint32_t>( src ), static_cast<uint32_t>( end - start ) );
+            literal = i = end;
+            if( i + BLOCK_SIZE <= image.size() ) {
+                h = block_hash( image.data() + i );
+            }
+            continue;
+        }
+
+        if( i + BLOCK_SIZE >= image.size() ) {
+            break;
+        }
+        h = ( h - image[ i ] * top ) * HASH_BASE + image[ i + BLOCK_SIZE ];
+        i++;
+    }
+    writer.insert( image.data() + literal, image.size() - literal );
+    writer.flush();
+}
+
+DfuPatchApplier::DfuPatchApplier( int base_fd, uint32_t base_size, uint32_t image_size, Sink sink )
+    : _base_fd{ base_fd }
+    , _base_size{ base_size }
+    , _image_size{ image_size }
+    , _sink{ std::move( sink ) }
+{
+}
+
+void DfuPatchApplier::reset( uint32_t image_offset )
+{
+    _image_offset   = image_offset;
+    _header_bytes   = 0;
+    _remaining      = 0;
+}
+
+bool DfuPatchApplier::write( const uint8_t* data, size_t len )
+{
+    while( len > 0 ) {
+        if( _remaining > 0 ) {
+            uint32_t n = static_cast<uint32_t>( std::min<size_t>( len, _remaining ) );
+            if( !_sink( data, n ) ) {
+                return false;
+            }
+            _image_offset += n;
+            _remaining -= n;
+            data += n;
+            len -= n;
+            continue;
+        }
+
+        // An op header, possibly split across writes
+        _header[ _header_bytes++ ] = *data++;
+        len--;
+        size_t header_len = _header[ 0 ] == DfuPatch::COPY ? sizeof( CopyOp ) : _header[ 0 ] == DfuPatch::INSERT ? sizeof( InsertOp ) : 0;
+        if( header_len == 0 ) {
+            return false;
+        }
+        if( _header_bytes < header_len ) {
+            continue;
+        }
+        _header_bytes = 0;
+
+        if( _header[ 0 ] == DfuPatch::COPY ) {
+            CopyOp op;
+            std::memcpy( &op, _header, sizeof( op ) );
+            if( !copy( op.offset, op.len ) ) {
+                return false;
+            }
+        }
+        else {
+            InsertOp op;
+            std::memcpy( &op, _header, sizeof( op ) );
+            if( op.len == 0 || op.len > _image_size - _image_offset ) {
+                return false;
+            }
+            _remaining = op.len;
+        }
+    }
+    return true;
+}
+
+bool DfuPatchApplier::copy( uint32_t offset, uint32_t len )
+{
+    if( len == 0 || offset > _base_size || len > _base_size - offset || len > _image_size - _image_offset ) {
+        return false;
+    }
+
+    uint8_t buffer[ 16 * 1024 ];
+    while( len > 0 ) {
+        ssize_t n = ::pread( _base_fd, buffer, std::min<size_t>( len, sizeof( buffer ) ), offset );
+        if( n < 0 && errno == EINTR ) {
+            continue;
+        }
+        if( n <= 0 || !_sink( buffer, n ) ) {
+            return false;
+        }
+        _image_offset += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+}
+
+}
+}
@@ -0,0 +1,244 @@
+#include "bm_core/dfu_stream.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace bm {
+namespace core {
+
+namespace {
+
+void put_le32( uint8_t* p, uint32_t value )
+{
+    p[0] = static_cast<uint8_t>( value );
+    p[1] = static_cast<uint8_t>( value >> 8 );
+    p[2] = static_cast<uint8_t>( value >> 16 );
+    p[3] = static_cast<uint8_t>( value >> 24 );
+}
+
+uint32_t get_le32( const uint8_t* p )
+{
+    return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( static_cast<uint32_t>( p[3] ) << 24 );
+}
+
+}
+
+bool DfuStream::encode( const std::string& path, DfuStream& stream )
+{
+    int fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if( fd < 0 ) {
+        return false;
+    }
+
+    stream.data.clear();
+    DfuStreamEncoder encoder( stream.data );
+    uint64_t image_size = 0;
+    uLong crc = crc32( 0, Z_NULL, 0 );
+
+    std::vector<uint8_t> buffer( SEGMENT_SIZE );
+    bool ok = true;
+    for( ;; ) {
+        ssize_t n = ::read( fd, buffer.data(), buffer.size() );
+        if( n < 0 && errno == EINTR ) {
+            continue;
+        }
+        if( n <= 0 ) {
+            ok = n == 0;
+            break;
+        }
+
+        image_size += n;
+        if( image_size > UINT32_MAX ) {
+            errno = EFBIG;
+            ok = false;
+            break;
+        }
+        crc = crc32( crc, buffer.data(), n );
+        encoder.write( buffer.data(), n );
+    }
+    encoder.flush();
+    ::close( fd );
+
+    stream.image_size   = static_cast<uint32_t>( image_size );
+    stream.image_crc    = static_cast<uint32_t>( crc );
+    if( ok && stream.data.size() > UINT32_MAX ) {
+        errno = EFBIG;
+        ok = false;
+    }
+    return ok;
+}
+
+DfuStreamEncoder::DfuStreamEncoder( std::vector<uint8_t>& stream )
+    : _stream{ stream }
+{
+    if( deflateInit2( &_zs, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY ) != Z_OK ) {
+        throw std::runtime_error( "Failed to initialize deflate" );
+    }
+    _segment.reserve( DfuStream::SEGMENT_SIZE );
+    _compressed.resize( deflateBound( &_zs, DfuStream::SEGMENT_SIZE ) );
+}
+
+DfuStreamEncoder::~DfuStreamEncoder()
+{
+    deflateEnd( &_zs );
+}
+
+void DfuStreamEncoder::write( const uint8_t* data, size_t len )
+{
+    while( len > 0 ) {
+        size_t n = std::min( len, room() );
+        _segment.insert( _segment.end(), data, data + n );
+        data += n;
+        len -= n;
+        if( room() == 0 ) {
+            flush();
+        }
+    }
+}
+
+void DfuStreamEncoder::flush()
+{
+    if( _segment.empty() ) {
+        return;
+    }
+
+    deflateReset( &_zs );
+    _zs.next_in     = _segment.data();
+    _zs.avail_in    = _segment.size();
+    _zs.next_out    = _compressed.data();
+    _zs.avail_out   = _compressed.size();
+    int ret = deflate( &_zs, Z_FINISH );
+    size_t out = _compressed.size() - _zs.avail_out;
+
+    uint8_t header[ DfuStream::HEADER_SIZE ];
+    if( ret == Z_STREAM_END && out < _segment.size() ) {
+        put_le32( header, out );
+        _stream.insert( _stream.end(), header, header + DfuStream::HEADER_SIZE );
+        _stream.insert( _stream.end(), _compressed.data(), _compressed.data() + out );
+    }
+    else {
+        put_le32( header, _segment.size() | DfuStream::SEGMENT_STORED );
+        _stream.insert( _stream.end(), header, header + DfuStream::HEADER_SIZE );
+        _stream.insert( _stream.end(), _segment.begin(), _segment.end() );
+    }
+    _segment.clear();
+}
+
+DfuStreamDecoder::DfuStreamDecoder( Sink sink, SegmentHandler on_segment )
+    : _sink{ std::move( sink ) }
+    , _on_segment{ std::move( on_segment ) }
+{
+    if( inflateInit2( &_zs, -MAX_WBITS ) != Z_OK ) {
+        throw std::runtime_error( "Failed to initialize inflate" );
+    }
+}
+
+DfuStreamDecoder::~DfuStreamDecoder()
+{
+    inflateEnd( &_zs );
+}
+
+void DfuStreamDecoder::reset( uint32_t stream_offset, uint32_t image_offset )
+{
+    _stream_offset  = stream_offset;
+    _image_offset   = image_offset;
+    _header_bytes   = 0;
+    _remaining      = 0;
+}
+
+bool DfuStreamDecoder::write( const uint8_t* data, size_t len )
+{
+    uint8_t out[ 16 * 1024 ];
+
+    while( len > 0 ) {
+        // Segment header, possibly split across writes
+        if( _remaining == 0 ) {
+            size_t n = std::min( len, DfuStream::HEADER_SIZE - _header_bytes );
+            std::memcpy( _header + _header_bytes, data, n );
+            _header_bytes += n;
+            _stream_offset += n;
+            data += n;
+            len -= n;
+            if( _header_bytes < DfuStream::HEADER_SIZE ) {
+                break;
+            }
+
+            uint32_t header = get_le32( _header );
+            _header_bytes   = 0;
+            _stored         = header & DfuStream::SEGMENT_STORED;
+            _remaining      = header & ~DfuStream::SEGMENT_STORED;
+            _ended          = false;
+            _segment_out    = 0;
+            if( _remaining == 0 || ( _stored && _remaining > DfuStream::SEGMENT_SIZE ) ) {
+                return false;
+            }
+            inflateReset( &_zs );
+            continue;
+        }
+
+        size_t n = std::min<size_t>( len, _remaining );
+        if( _stored ) {
+            if( !_sink( data, n ) ) {
+                return false;
+            }
+            _segment_out += n;
+        }
+        else {
+            _zs.next_in     = const_cast<uint8_t*>( data );
+            _zs.avail_in    = n;
+            do {
+                _zs.next_out    = out;
+                _zs.avail_out   = sizeof( out );
+                int ret = inflate( &_zs, Z_NO_FLUSH );
+                if( ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR ) {
+                    return false;
+                }
+                _ended = ret == Z_STREAM_END;
+
+                size_t produced = sizeof( out ) - _zs.avail_out;
+                _segment_out += produced;
+                if( _segment_out > DfuStream::SEGMENT_SIZE || ( produced && !_sink( out, produced ) ) ) {
+                    return false;
+                }
+                if( ret == Z_BUF_ERROR && produced == 0 ) {
+                    break;
+                }
+            } while( !_ended && ( _zs.avail_in > 0 || _zs.avail_out == 0 ) );
+
+            // Anything after the end of the segment's deflate stream is corrupt
+            if( _ended && _zs.avail_in > 0 ) {
+                return false;
+            }
+        }
+
+        _stream_offset  += n;
+        _remaining      -= n;
+        data            += n;
+        len             -= n;
+
+        if( _remaining == 0 && !finish_segment() ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DfuStreamDecoder::finish_segment()
+{
+    if( !_stored && !_ended ) {
+        return false;
+    }
+    _image_offset += _segment_out;
+    if( _on_segment ) {
+        _on_segment();
+    }
+    return true;
+}
+
+}
+}
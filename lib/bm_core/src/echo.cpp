@@ -0,0 +1,129 @@
+#include "bm_core/echo.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+#include "bm_core/network_interface.hpp"
+
+namespace bm {
+namespace core {
+
+Echo::Echo( NetworkInterface& net )
+    : _net{ net }
+{
+    _net.bcmp().register_handler<bcmp_echo_request_t>( BCMP_ECHO_REQUEST, [this]( const BcmpMessage& msg, const bcmp_echo_request_t& request ){
+        handle_request( msg, request );
+    });
+    _net.bcmp().register_handler<bcmp_echo_reply_t>( BCMP_ECHO_REPLY, [this]( const BcmpMessage& msg, const bcmp_echo_reply_t& reply ){
+        handle_reply( msg, reply );
+    });
+}
+
+int Echo::send_request( const in6_addr& dst, uint16_t id, uint16_t seq_num, size_t payload_len )
+{
+    uint8_t buffer[ NetworkDevice::BM_MTU ];
+    if( payload_len < MIN_PAYLOAD || sizeof( bcmp_echo_request_t ) + payload_len > sizeof( buffer ) ) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    bcmp_echo_request_t request{};
+    request.target_node_id  = IN6_IS_ADDR_MULTICAST( &dst ) ? 0 : NetworkInterface::node_id_of( dst );
+    request.id              = id;
+    request.seq_num         = seq_num;
+    request.payload_len     = static_cast<uint16_t>( payload_len );
+    std::memcpy( buffer, &request, sizeof( request ) );
+
+    // Recognizable filler after the timestamp, which is taken last to leave the building out of the round trip
+    uint8_t* payload = buffer + sizeof( request );
+    for( size_t i = MIN_PAYLOAD; i < payload_len; i++ ) {
+        payload[ i ] = static_cast<uint8_t>( i );
+    }
+    uint64_t sent = std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now().time_since_epoch() ).count();
+    std::memcpy( payload, &sent, sizeof( sent ) );
+
+    return _net.send_bcmp_message( dst, BCMP_ECHO_REQUEST, buffer, sizeof( request ) + payload_len );
+}
+
+void Echo::update()
+{
+    PendingReply pending[ 32 ];
+    size_t count;
+    while( ( count = _pending.try_dequeue_bulk( pending, 32 ) ) > 0 ) {
+        auto now = Clock::now();
+        for( size_t i = 0; i < count; i++ ) {
+            PendingReply& p = pending[ i ];
+
+            auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>( now - p.received ).count();
+            uint32_t turnaround = static_cast<uint32_t>( std::min<int64_t>( waited, UINT32_MAX ) );
+            std::memcpy( p.reply->data() + offsetof( bcmp_echo_reply_t, turnaround_ns ), &turnaround, sizeof( turnaround ) );
+
+            if( _net.send_bcmp_message( p.dst, BCMP_ECHO_REPLY, p.reply->data(), p.reply->len() ) < 0 ) {
+                spdlog::debug( "Failed to send echo reply: {}", std::strerror( errno ) );
+            }
+            p.reply.reset();
+        }
+    }
+}
+
+void Echo::handle_request( const BcmpMessage& msg, const bcmp_echo_request_t& request )
+{
+    auto received = Clock::now();
+
+    NodeId node_id = _net.node_id();
+    if( request.target_node_id != 0 && request.target_node_id != node_id ) {
+        return;
+    }
+    size_t payload_len = msg.len - sizeof( request );
+    if( request.payload_len != payload_len ) {
+        spdlog::debug( "Malformed echo request, payload {} of {} bytes", payload_len, request.payload_len );
+        return;
+    }
+    _requests.fetch_add( 1, std::memory_order_relaxed );
+
+    // Build the reply here, update() only fills in the turnaround
+    PbufPtr pbuf;
+    if( _pending.size_approx() >= MAX_PENDING || !( pbuf = _net.pbufs().alloc() ) || pbuf->tailroom() < msg.len + sizeof( bcmp_echo_reply_t ) ) {
+        _dropped.fetch_add( 1, std::memory_order_relaxed );
+        return;
+    }
+
+    bcmp_echo_reply_t reply{};
+    reply.node_id       = node_id;
+    reply.id            = request.id;
+    reply.seq_num       = request.seq_num;
+    reply.payload_len   = request.payload_len;
+    std::memcpy( pbuf->append( sizeof( reply ) ), &reply, sizeof( reply ) );
+    std::memcpy( pbuf->append( payload_len ), msg.payload + sizeof( request ), payload_len );
+
+    _pending.enqueue( PendingReply{ std::move( pbuf ), msg.ip6.ip6_src, received } );
+}
+
+void Echo::handle_reply( const BcmpMessage& msg, const bcmp_echo_reply_t& reply )
+{
+    auto received = Clock::now();
+
+    size_t payload_len = msg.len - sizeof( reply );
+    if( reply.payload_len != payload_len || payload_len < MIN_PAYLOAD ) {
+        spdlog::debug( "Malformed echo reply, payload {} of {} bytes", payload_len, reply.payload_len );
+        return;
+    }
+    if( !_reply_handler ) {
+        return;
+    }
+
+    uint64_t sent;
+    std::memcpy( &sent, msg.payload + sizeof( reply ), sizeof( sent ) );
+    auto rtt = received - Clock::time_point( std::chrono::duration_cast<Clock::duration>( std::chrono::nanoseconds( sent ) ) );
+
+    _reply_handler( EchoReply{ reply.node_id, reply.id, reply.seq_num,
+                               std::chrono::duration_cast<std::chrono::nanoseconds>( rtt ),
+                               std::chrono::nanoseconds( reply.turnaround_ns ), msg } );
+}
+
+}
+}
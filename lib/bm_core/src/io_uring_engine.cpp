@@ -0,0 +1,368 @@
+#include "bm_core/io_uring_engine.hpp"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+namespace bm {
+namespace core {
+
+namespace {
+    constexpr uint64_t  RECV_TAG            = 1;
+    constexpr uint16_t  RECV_BUFFER_GROUP   = 0;
+}
+
+IoUringEngine::IoUringEngine( int sock_fd, const IoUringConfig& config )
+    : _sock_fd{ sock_fd }
+    , _config{ config }
+{
+    if( config.buffer_count == 0 || config.buffer_count > 32768 || ( config.buffer_count & ( config.buffer_count - 1 ) ) != 0 ) {
+        throw std::invalid_argument( "io_uring buffer count must be a power of two up to 32768" );
+    }
+
+    try {
+        // Every receive completion holds a buffer until it is reaped, so a CQ with room for all of them plus the
+        // final multishot completion can never overflow
+        setup_ring( _rx, config.queue_depth, config.buffer_count * 2 );
+        setup_ring( _tx, config.queue_depth, config.queue_depth * 2 );
+        setup_buffers();
+        arm_recv();
+        if( enter( _rx, 0 ) < 0 ) {
+            throw std::runtime_error( std::string( "Failed to submit multishot recv: " ) + std::strerror( errno ) );
+        }
+
+        // Kernels with provided buffer rings but without multishot recv (5.19) take the submission and fail it at
+        // once. Anything else, a frame or nothing yet, is left for read_batch().
+        uint32_t head = *_rx.cq_head;
+        if( head != __atomic_load_n( _rx.cq_tail, __ATOMIC_ACQUIRE ) ) {
+            const auto& cqe = _rx.cqes[ head & *_rx.cq_mask ];
+            if( cqe.res < 0 && cqe.res != -ENOBUFS && !( cqe.flags & IORING_CQE_F_MORE ) ) {
+                throw std::runtime_error( std::string( "Multishot recv unsupported: " ) + std::strerror( -cqe.res ) );
+            }
+        }
+    }
+    catch( const std::exception& ) {
+        release();
+        throw;
+    }
+
+    spdlog::info( "io_uring: queue depth {}, {} receive buffers of {} bytes", config.queue_depth, config.buffer_count, config.buffer_size );
+}
+
+IoUringEngine::~IoUringEngine()
+{
+    release();
+}
+
+void IoUringEngine::release()
+{
+    // Closing the ring cancels the outstanding multishot recv
+    teardown_ring( _rx );
+    teardown_ring( _tx );
+
+    if( _buf_ring ) {
+        ::munmap( _buf_ring, _buf_ring_size );
+        _buf_ring = nullptr;
+    }
+}
+
+void IoUringEngine::setup_ring( Ring& ring, uint32_t entries, uint32_t cq_entries )
+{
+    io_uring_params params;
+    std::memset( &params, 0, sizeof( params ) );
+    params.flags        = IORING_SETUP_CQSIZE;
+    params.cq_entries   = cq_entries;
+
+    ring.fd = static_cast<int>( ::syscall( __NR_io_uring_setup, entries, &params ) );
+    if( ring.fd < 0 ) {
+        ring.fd = -1;
+        throw std::runtime_error( std::string( "io_uring_setup failed: " ) + std::strerror( errno ) );
+    }
+    ring.entries = params.sq_entries;
+
+    ring.sq_map_size = params.sq_off.array + params.sq_entries * sizeof( uint32_t );
+    ring.cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+
+    // Kernels since 5.4 share one mapping between both rings
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if( single_mmap ) {
+        ring.sq_map_size = ring.cq_map_size = std::max( ring.sq_map_size, ring.cq_map_size );
+    }
+
+    ring.sq_map = ::mmap( nullptr, ring.sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING );
+    if( ring.sq_map == MAP_FAILED ) {
+        ring.sq_map = nullptr;
+        throw std::runtime_error( std::string( "Failed to map io_uring SQ: " ) + std::strerror( errno ) );
+    }
+
+    if( single_mmap ) {
+        ring.cq_map = ring.sq_map;
+    }
+    else {
+        ring.cq_map = ::mmap( nullptr, ring.cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING );
+        if( ring.cq_map == MAP_FAILED ) {
+            ring.cq_map = nullptr;
+            throw std::runtime_error( std::string( "Failed to map io_uring CQ: " ) + std::strerror( errno ) );
+        }
+    }
+
+    ring.sqes_size = params.sq_entries * sizeof( io_uring_sqe );
+    void* sqes = ::mmap( nullptr, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES );
+    if( sqes == MAP_FAILED ) {
+        throw std::runtime_error( std::string( "Failed to map io_uring SQEs: " ) + std::strerror( errno ) );
+    }
+    ring.sqes = static_cast<io_uring_sqe*>( sqes );
+
+    auto* sq = static_cast<uint8_t*>( ring.sq_map );
+    auto* cq = static_cast<uint8_t*>( ring.cq_map );
+    ring.sq_head    = reinterpret_cast<uint32_t*>( sq + params.sq_off.head );
+    ring.sq_tail    = reinterpret_cast<uint32_t*>( sq + params.sq_off.tail );
+    ring.sq_mask    = reinterpret_cast<uint32_t*>( sq + params.sq_off.ring_mask );
+    ring.cq_head    = reinterpret_cast<uint32_t*>( cq + params.cq_off.head );
+    ring.cq_tail    = reinterpret_cast<uint32_t*>( cq + params.cq_off.tail );
+    ring.cq_mask    = reinterpret_cast<uint32_t*>( cq + params.cq_off.ring_mask );
+    ring.cqes       = reinterpret_cast<io_uring_cqe*>( cq + params.cq_off.cqes );
+
+    // SQ slots map one to one onto SQEs
+    auto* array = reinterpret_cast<uint32_t*>( sq + params.sq_off.array );
+    for( uint32_t i = 0; i < params.sq_entries; i++ ) {
+        array[ i ] = i;
+    }
+}
+
+void IoUringEngine::teardown_ring( Ring& ring )
+{
+    if( ring.sqes ) {
+        ::munmap( ring.sqes, ring.sqes_size );
+        ring.sqes = nullptr;
+    }
+    if( ring.cq_map && ring.cq_map != ring.sq_map ) {
+        ::munmap( ring.cq_map, ring.cq_map_size );
+    }
+    ring.cq_map = nullptr;
+    if( ring.sq_map ) {
+        ::munmap( ring.sq_map, ring.sq_map_size );
+        ring.sq_map = nullptr;
+    }
+    if( ring.fd != -1 ) {
+        ::close( ring.fd );
+        ring.fd = -1;
+    }
+}
+
+io_uring_sqe* IoUringEngine::next_sqe( Ring& ring )
+{
+    // Only this thread produces, so the tail can be read plainly
+    uint32_t tail = *ring.sq_tail + ring.pending;
+    auto* sqe = &ring.sqes[ tail & *ring.sq_mask ];
+    std::memset( sqe, 0, sizeof( *sqe ) );
+    ring.pending++;
+    return sqe;
+}
+
+int IoUringEngine::enter( Ring& ring, uint32_t min_complete )
+{
+    uint32_t to_submit = ring.pending;
+    __atomic_store_n( ring.sq_tail, *ring.sq_tail + to_submit, __ATOMIC_RELEASE );
+    ring.pending = 0;
+
+    while( true ) {
+        int ret = static_cast<int>( ::syscall( __NR_io_uring_enter, ring.fd, to_submit, min_complete,
+            min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0 ) );
+        if( ret < 0 && errno == EINTR ) {
+            // Anything consumed before the interruption is not resubmitted
+            to_submit = 0;
+            continue;
+        }
+        return ret;
+    }
+}
+
+void IoUringEngine::setup_buffers()
+{
+    _buffers.resize( static_cast<size_t>( _config.buffer_count ) * _config.buffer_size );
+
+    _buf_ring_size = _config.buffer_count * sizeof( io_uring_buf );
+    void* ring = ::mmap( nullptr, _buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( ring == MAP_FAILED ) {
+        throw std::runtime_error( std::string( "Failed to allocate buffer ring: " ) + std::strerror( errno ) );
+    }
+    _buf_ring = static_cast<io_uring_buf_ring*>( ring );
+
+    io_uring_buf_reg reg;
+    std::memset( &reg, 0, sizeof( reg ) );
+    reg.ring_addr       = reinterpret_cast<uint64_t>( _buf_ring );
+    reg.ring_entries    = _config.buffer_count;
+    reg.bgid            = RECV_BUFFER_GROUP;
+
+    if( ::syscall( __NR_io_uring_register, _rx.fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) < 0 ) {
+        throw std::runtime_error( std::string( "IORING_REGISTER_PBUF_RING failed: " ) + std::strerror( errno ) );
+    }
+
+    for( uint32_t i = 0; i < _config.buffer_count; i++ ) {
+        recycle_buffer( static_cast<uint16_t>( i ) );
+    }
+    __atomic_store_n( &_buf_ring->tail, _buf_tail, __ATOMIC_RELEASE );
+}
+
+void IoUringEngine::recycle_buffer( uint16_t bid )
+{
+    // Published to the kernel by the next tail store. The header's flex array member is offset by an empty struct
+    // when compiled as C++, so index the entries directly; the tail overlays the first entry's resv field.
+    auto* bufs = reinterpret_cast<io_uring_buf*>( _buf_ring );
+    auto& buf = bufs[ _buf_tail & ( _config.buffer_count - 1 ) ];
+    buf.addr    = reinterpret_cast<uint64_t>( _buffers.data() + static_cast<size_t>( bid ) * _config.buffer_size );
+    buf.len     = _config.buffer_size;
+    buf.bid     = bid;
+    _buf_tail++;
+}
+
+void IoUringEngine::arm_recv()
+{
+    auto* sqe = next_sqe( _rx );
+    sqe->opcode     = IORING_OP_RECV;
+    sqe->fd         = _sock_fd;
+    sqe->ioprio     = IORING_RECV_MULTISHOT;
+    sqe->flags      = IOSQE_BUFFER_SELECT;
+    sqe->buf_group  = RECV_BUFFER_GROUP;
+    sqe->user_data  = RECV_TAG;
+    _recv_armed = true;
+}
+
+ssize_t IoUringEngine::read_batch( const NetworkDevice::FrameHandler& handler, size_t max_frames, int timeout_ms )
+{
+    if( _recv_error ) {
+        errno = _recv_error;
+        return -1;
+    }
+
+    uint32_t head = *_rx.cq_head;
+    if( head == __atomic_load_n( _rx.cq_tail, __ATOMIC_ACQUIRE ) ) {
+        pollfd pfd{ _rx.fd, POLLIN, 0 };
+        int ret = ::poll( &pfd, 1, timeout_ms );
+        if( ret <= 0 ) {
+            if( ret == 0 ) {
+                errno = EAGAIN;
+            }
+            return -1;
+        }
+    }
+
+    uint32_t tail = __atomic_load_n( _rx.cq_tail, __ATOMIC_ACQUIRE );
+    size_t handled = 0;
+
+    for( ; head != tail && handled < max_frames; head++ ) {
+        const auto& cqe = _rx.cqes[ head & *_rx.cq_mask ];
+        if( cqe.user_data != RECV_TAG ) {
+            continue;
+        }
+
+        if( cqe.res > 0 && ( cqe.flags & IORING_CQE_F_BUFFER ) ) {
+            uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            handler( FrameView{ _buffers.data() + static_cast<size_t>( bid ) * _config.buffer_size, static_cast<size_t>( cqe.res ) } );
+            recycle_buffer( bid );
+            handled++;
+            _recv_failures = 0;
+        }
+        else if( cqe.res < 0 && cqe.res != -ENOBUFS ) {
+            // Running out of buffers is only a re-arm, an error that keeps coming back is not going away
+            if( ++_recv_failures >= RECV_FAILURE_LIMIT ) {
+                spdlog::error( "io_uring recv keeps failing, giving up on receive: {}", std::strerror( -cqe.res ) );
+                _recv_error = -cqe.res;
+            }
+            else {
+                spdlog::warn( "io_uring recv failed: {}", std::strerror( -cqe.res ) );
+            }
+        }
+
+        // The kernel stops a multishot recv on errors or when it runs out of buffers
+        if( !( cqe.flags & IORING_CQE_F_MORE ) ) {
+            _recv_armed = false;
+        }
+    }
+
+    __atomic_store_n( _rx.cq_head, head, __ATOMIC_RELEASE );
+    __atomic_store_n( &_buf_ring->tail, _buf_tail, __ATOMIC_RELEASE );
+
+    if( !_recv_armed && !_recv_error ) {
+        arm_recv();
+        if( enter( _rx, 0 ) < 0 ) {
+            spdlog::error( "Failed to re-arm io_uring recv: {}", std::strerror( errno ) );
+            _recv_error = errno;
+        }
+    }
+
+    if( handled == 0 ) {
+        errno = _recv_error ? _recv_error : EAGAIN;
+        return -1;
+    }
+    return handled;
+}
+
+ssize_t IoUringEngine::write_frames( const FrameView* frames, size_t count )
+{
+    size_t sent = 0;
+    size_t done = 0;
+
+    while( done < count ) {
+        uint32_t batch = static_cast<uint32_t>( std::min<size_t>( count - done, _tx.entries ) );
+        for( uint32_t i = 0; i < batch; i++ ) {
+            auto* sqe = next_sqe( _tx );
+            sqe->opcode     = IORING_OP_SEND;
+            sqe->fd         = _sock_fd;
+            sqe->addr       = reinterpret_cast<uint64_t>( frames[ done + i ].data );
+            sqe->len        = frames[ done + i ].len;
+            sqe->user_data  = done + i;
+        }
+
+        uint32_t sq_head = __atomic_load_n( _tx.sq_head, __ATOMIC_ACQUIRE );
+        int ret = enter( _tx, batch );
+        int error = errno;
+
+        // Callers own the frame memory, so no send may be left behind. SQEs the kernel did not take are withdrawn,
+        // a later enter() would submit them once the frames were released, and the ones it took are waited for even
+        // if the wait was cut short.
+        uint32_t taken = __atomic_load_n( _tx.sq_head, __ATOMIC_ACQUIRE ) - sq_head;
+        if( taken < batch ) {
+            __atomic_store_n( _tx.sq_tail, sq_head + taken, __ATOMIC_RELEASE );
+        }
+
+        uint32_t completed = 0;
+        while( true ) {
+            uint32_t head = *_tx.cq_head;
+            uint32_t tail = __atomic_load_n( _tx.cq_tail, __ATOMIC_ACQUIRE );
+            for( ; head != tail; head++, completed++ ) {
+                if( _tx.cqes[ head & *_tx.cq_mask ].res >= 0 ) {
+                    sent++;
+                }
+            }
+            __atomic_store_n( _tx.cq_head, head, __ATOMIC_RELEASE );
+
+            if( completed >= taken ) {
+                break;
+            }
+            // Nothing is pending, so this only waits
+            if( enter( _tx, taken - completed ) < 0 ) {
+                spdlog::error( "Failed to wait for io_uring sends: {}", std::strerror( errno ) );
+                break;
+            }
+        }
+
+        if( ret < 0 || taken < batch ) {
+            errno = ret < 0 ? error : EAGAIN;
+            break;
+        }
+        done += batch;
+    }
+
+    return ( sent == 0 && count > 0 ) ? -1 : sent;
+}
+
+}
+}
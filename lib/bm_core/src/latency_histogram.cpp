@@ -0,0 +1,100 @@
+#include "bm_core/latency_histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace bm {
+namespace core {
+
+size_t LatencyHistogram::bucket_of( uint64_t value )
+{
+    if( value < SUB_BUCKETS ) {
+        return value;
+    }
+
+    // Keep the top SUB_BUCKET_BITS of the value, the leading one selects the upper half of the sub-buckets
+    unsigned shift = ( 63 - __builtin_clzll( value ) ) - ( SUB_BUCKET_BITS - 1 );
+    uint64_t top = value >> shift;
+    return SUB_BUCKETS + ( shift - 1 ) * ( SUB_BUCKETS / 2 ) + ( top - SUB_BUCKETS / 2 );
+}
+
+uint64_t LatencyHistogram::highest_in( size_t bucket )
+{
+    if( bucket < SUB_BUCKETS ) {
+        return bucket;
+    }
+
+    unsigned shift = ( bucket - SUB_BUCKETS ) / ( SUB_BUCKETS / 2 ) + 1;
+    uint64_t top = ( bucket - SUB_BUCKETS ) % ( SUB_BUCKETS / 2 ) + SUB_BUCKETS / 2;
+    return ( top << shift ) + ( ( 1ull << shift ) - 1 );
+}
+
+void LatencyHistogram::record( std::chrono::nanoseconds value )
+{
+    uint64_t ns = value.count() > 0 ? static_cast<uint64_t>( value.count() ) : 0;
+
+    _buckets[ bucket_of( ns ) ].fetch_add( 1, std::memory_order_relaxed );
+    _count.fetch_add( 1, std::memory_order_relaxed );
+    _sum.fetch_add( ns, std::memory_order_relaxed );
+
+    uint64_t current = _min.load( std::memory_order_relaxed );
+    while( ns < current && !_min.compare_exchange_weak( current, ns, std::memory_order_relaxed ) ) {
+    }
+    current = _max.load( std::memory_order_relaxed );
+    while( ns > current && !_max.compare_exchange_weak( current, ns, std::memory_order_relaxed ) ) {
+    }
+}
+
+std::chrono::nanoseconds LatencyHistogram::min() const
+{
+    uint64_t ns = _min.load( std::memory_order_relaxed );
+    return std::chrono::nanoseconds( ns == UINT64_MAX ? 0 : ns );
+}
+
+std::chrono::nanoseconds LatencyHistogram::max() const
+{
+    return std::chrono::nanoseconds( _max.load( std::memory_order_relaxed ) );
+}
+
+std::chrono::nanoseconds LatencyHistogram::mean() const
+{
+    uint64_t n = count();
+    return std::chrono::nanoseconds( n ? _sum.load( std::memory_order_relaxed ) / n : 0 );
+}
+
+std::chrono::nanoseconds LatencyHistogram::percentile( double percent ) const
+{
+    uint64_t n = count();
+    if( n == 0 ) {
+        return std::chrono::nanoseconds( 0 );
+    }
+
+    auto rank = static_cast<uint64_t>( std::ceil( std::clamp( percent, 0.0, 100.0 ) / 100.0 * n ) );
+    rank = std::max<uint64_t>( rank, 1 );
+
+    // Counts recorded concurrently may not have reached their bucket yet, then it comes down to max()
+    uint64_t seen = 0;
+    uint64_t value = UINT64_MAX;
+    for( size_t i = 0; i < BUCKETS; i++ ) {
+        seen += _buckets[ i ].load( std::memory_order_relaxed );
+        if( seen >= rank ) {
+            value = highest_in( i );
+            break;
+        }
+    }
+    return std::chrono::nanoseconds( std::min( value, _max.load( std::memory_order_relaxed ) ) );
+}
+
+void LatencyHistogram::reset()
+{
+    for( auto& bucket : _buckets ) {
+        bucket.store( 0, std::memory_order_relaxed );
+    }
+    _count.store( 0, std::memory_order_relaxed );
+    _sum.store( 0, std::memory_order_relaxed );
+    _min.store( UINT64_MAX, std::memory_order_relaxed );
+    _max.store( 0, std::memory_order_relaxed );
+}
+
+}
+}
@@ -0,0 +1,147 @@
+#include "bm_core/middleware.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "bm_core/network_interface.hpp"
+
+namespace bm {
+namespace core {
+
+static_assert( ( Middleware::TABLE_SIZE & ( Middleware::TABLE_SIZE - 1 ) ) == 0, "Table size must be a power of two" );
+
+Middleware::Middleware( NetworkInterface& net, NodeId node_id )
+    : _net{ net }
+    , _node_id{ node_id }
+{
+    if( !_net.bind( BM_MIDDLEWARE_PORT, [this]( const UdpDatagram& dgram ){ handle_datagram( dgram ); } ) ) {
+        throw std::runtime_error( "Failed to bind the middleware port" );
+    }
+}
+
+bool Middleware::subscribe( uint32_t topic_id, Callback callback )
+{
+    // Reuse the topic's slot, or else take the first free one along its probe sequence
+    Slot* free_slot = nullptr;
+    for( size_t i = 0; i < TABLE_SIZE; i++ ) {
+        Slot& slot = _slots[ ( topic_id + i ) & ( TABLE_SIZE - 1 ) ];
+        if( slot.state == SlotState::USED && slot.topic_id == topic_id ) {
+            slot.callback = std::move( callback );
+            return true;
+        }
+        if( slot.state != SlotState::USED && !free_slot ) {
+            free_slot = &slot;
+        }
+        if( slot.state == SlotState::EMPTY ) {
+            break;
+        }
+    }
+
+    if( _subscriptions >= MAX_SUBSCRIPTIONS || !free_slot ) {
+        spdlog::error( "No room to subscribe to topic {:#010x}", topic_id );
+        return false;
+    }
+
+    free_slot->topic_id = topic_id;
+    free_slot->state    = SlotState::USED;
+    free_slot->callback = std::move( callback );
+    _subscriptions++;
+    return true;
+}
+
+bool Middleware::subscribe( std::string_view topic, Callback callback )
+{
+    // Checked up front, a name the resource table refuses must not leave the subscription in place
+    if( topic.empty() || topic.size() > ResourceTable::MAX_NAME_LEN ) {
+        spdlog::error( "Can't subscribe to a topic name of {} bytes", topic.size() );
+        return false;
+    }
+    return subscribe( topic_id( topic ), std::move( callback ) ) && _net.resources().add( topic, BCMP_RESOURCE_SUBSCRIBER );
+}
+
+void Middleware::unsubscribe( std::string_view topic )
+{
+    unsubscribe( topic_id( topic ) );
+    _net.resources().remove( topic, BCMP_RESOURCE_SUBSCRIBER );
+}
+
+bool Middleware::advertise( std::string_view topic )
+{
+    return _net.resources().add( topic, BCMP_RESOURCE_PUBLISHER );
+}
+
+void Middleware::unadvertise( std::string_view topic )
+{
+    _net.resources().remove( topic, BCMP_RESOURCE_PUBLISHER );
+}
+
+void Middleware::unsubscribe( uint32_t topic_id )
+{
+    if( auto* slot = const_cast<Slot*>( find( topic_id ) ) ) {
+        // Leave a tombstone so topics probed past this slot are still found
+        slot->state     = SlotState::DELETED;
+        slot->callback  = nullptr;
+        _subscriptions--;
+    }
+}
+
+int Middleware::publish( uint32_t topic_id, const void* data, size_t len )
+{
+    PubSubHeader header{};
+    header.version  = VERSION;
+    header.topic_id = topic_id;
+    header.node_id  = _node_id;
+
+    iovec iov[] = {
+        { &header, sizeof( header ) },
+        { const_cast<void*>( data ), len },
+    };
+    return _net.send_to( NetworkInterface::ALL_NODES_REALM_LOCAL, BM_MIDDLEWARE_PORT, iov, 2 );
+}
+
+const Middleware::Slot* Middleware::find( uint32_t topic_id ) const
+{
+    for( size_t i = 0; i < TABLE_SIZE; i++ ) {
+        const Slot& slot = _slots[ ( topic_id + i ) & ( TABLE_SIZE - 1 ) ];
+        if( slot.state == SlotState::EMPTY ) {
+            return nullptr;
+        }
+        if( slot.state == SlotState::USED && slot.topic_id == topic_id ) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+void Middleware::handle_datagram( const UdpDatagram& dgram )
+{
+    PubSubHeader header;
+    if( dgram.len < sizeof( header ) ) {
+        _malformed.fetch_add( 1, std::memory_order_relaxed );
+        return;
+    }
+    std::memcpy( &header, dgram.payload, sizeof( header ) );
+    if( header.version != VERSION ) {
+        _malformed.fetch_add( 1, std::memory_order_relaxed );
+        return;
+    }
+
+    // Our own publications can be looped back by the multicast group
+    if( header.node_id == _node_id ) {
+        return;
+    }
+
+    const Slot* slot = find( header.topic_id );
+    if( !slot ) {
+        _unsubscribed.fetch_add( 1, std::memory_order_relaxed );
+        return;
+    }
+
+    PubSubMessage msg{ header.node_id, header.topic_id, dgram.payload + sizeof( header ), dgram.len - sizeof( header ), dgram };
+    slot->callback( msg );
+}
+
+}
+}
@@ -1,23 +1,162 @@
 #include "bm_core/neighbor_table.hpp"
 
+#include <algorithm>
+#include <stdexcept>
+
 namespace bm {
 namespace core {
 
-void NeighborTable::insert( NeighborEntry entry )
+uint64_t NeighborMap::hash( NodeId id )
+{
+    // splitmix64 finalizer, node IDs are often sequential
+    id ^= id >> 30;
+    id *= 0xbf58476d1ce4e5b9ull;
+    id ^= id >> 27;
+    id *= 0x94d049bb133111ebull;
+    id ^= id >> 31;
+    return id;
+}
+
+size_t NeighborMap::probe( NodeId id ) const
+{
+    if( _entries.empty() ) {
+        return NONE;
+    }
+
+    uint64_t h = hash( id );
+    uint32_t ctrl = control( h );
+    size_t mask = _slots.size() - 1;
+    for( size_t i = home( h ); _slots[ i ] != EMPTY; i = ( i + 1 ) & mask ) {
+        if( ( _slots[ i ] & ~INDEX_MASK ) == ctrl && _entries[ index_of( _slots[ i ] ) ].node_id == id ) {
+            return i;
+        }
+    }
+    return NONE;
+}
+
+const NeighborEntry* NeighborMap::find( NodeId id ) const
+{
+    size_t slot = probe( id );
+    return slot != NONE ? &_entries[ index_of( _slots[ slot ] ) ] : nullptr;
+}
+
+void NeighborMap::insert( const NeighborEntry& entry )
+{
+    size_t slot = probe( entry.node_id );
+    if( slot != NONE ) {
+        _entries[ index_of( _slots[ slot ] ) ] = entry;
+        return;
+    }
+
+    if( _entries.size() >= MAX_SIZE ) {
+        throw std::length_error( "Neighbor map is full" );
+    }
+
+    // At most three quarters full, so probes stay short and always end at an empty slot
+    _entries.push_back( entry );
+    if( _entries.size() * 4 > _slots.size() * 3 ) {
+        grow();
+    }
+    else {
+        place( _entries.size() - 1 );
+    }
+}
+
+bool NeighborMap::erase( NodeId id )
+{
+    size_t hole = probe( id );
+    if( hole == NONE ) {
+        return false;
+    }
+    size_t index = index_of( _slots[ hole ] );
+
+    // Pull later slots of the probe run back into the hole, unless that would put them before their home slot
+    size_t mask = _slots.size() - 1;
+    for( size_t i = ( hole + 1 ) & mask; _slots[ i ] != EMPTY; i = ( i + 1 ) & mask ) {
+        size_t ideal = home( hash( _entries[ index_of( _slots[ i ] ) ].node_id ) );
+        if( ( ( i - ideal ) & mask ) >= ( ( i - hole ) & mask ) ) {
+            _slots[ hole ] = _slots[ i ];
+            hole = i;
+        }
+    }
+    _slots[ hole ] = EMPTY;
+
+    // Keep the entries dense by moving the last one into the gap
+    size_t last = _entries.size() - 1;
+    if( index != last ) {
+        size_t moved = probe( _entries[ last ].node_id );
+        _slots[ moved ] = ( _slots[ moved ] & ~INDEX_MASK ) | static_cast<uint32_t>( index );
+        _entries[ index ] = _entries[ last ];
+    }
+    _entries.pop_back();
+    return true;
+}
+
+void NeighborMap::clear()
+{
+    std::fill( _slots.begin(), _slots.end(), EMPTY );
+    _entries.clear();
+}
+
+void NeighborMap::place( size_t index )
+{
+    uint64_t h = hash( _entries[ index ].node_id );
+    size_t mask = _slots.size() - 1;
+    size_t i = home( h );
+    while( _slots[ i ] != EMPTY ) {
+        i = ( i + 1 ) & mask;
+    }
+    _slots[ i ] = control( h ) | static_cast<uint32_t>( index );
+}
+
+void NeighborMap::grow()
+{
+    _slots.assign( std::max( MIN_CAPACITY, _slots.size() * 2 ), EMPTY );
+    for( size_t i = 0; i < _entries.size(); i++ ) {
+        place( i );
+    }
+}
+
+NeighborTable::NeighborTable()
+    : _published{ std::make_shared<const Map>() }
 {
-    _neighbors[ entry.node_id ] = entry;
 }
 
-bool NeighborTable::find( NodeId id, NeighborEntry& entry )
+void NeighborTable::insert( const NeighborEntry& entry )
 {
-    auto count = _neighbors.count( id );
-    if( count )
-    {
-        entry = _neighbors.at( id );
+    _neighbors.insert( entry );
+    _dirty = true;
+}
+
+void NeighborTable::erase( NodeId id )
+{
+    if( _neighbors.erase( id ) ) {
+        _dirty = true;
+    }
+}
+
+bool NeighborTable::publish()
+{
+    if( !_dirty ) {
+        return false;
+    }
+
+    // Readers still holding the previous snapshot keep it alive until they are done with it. The copy is two flat
+    // arrays, no per-entry allocation.
+    std::atomic_store_explicit( &_published, Snapshot{ std::make_shared<const Map>( _neighbors ) }, std::memory_order_release );
+    _dirty = false;
+    return true;
+}
+
+bool NeighborTable::lookup( NodeId id, NeighborEntry& entry ) const
+{
+    auto neighbors = snapshot();
+    if( auto* found = neighbors->find( id ) ) {
+        entry = *found;
         return true;
     }
     return false;
 }
 
 }
-}
\ No newline at end of file
+}
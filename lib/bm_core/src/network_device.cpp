@@ -1,8 +1,14 @@
 #include "bm_core/network_device.hpp"
 #include "bm_core/network_interface.hpp"
+#include "bm_core/xdp_socket.hpp"
+#include "bm_core/io_uring_engine.hpp"
+#include "bm_core/packet_filter.hpp"
 
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <netinet/ip6.h>
@@ -18,63 +24,31 @@
 #include <spdlog/spdlog.h>
 
 
-int set_promiscuous_mode(const char *interface, int enable) {
-    int fd;
-    struct ifreq ifr;
-
-    // Create a socket to perform the IOCTL operation
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd == -1) {
-        perror("Socket creation failed");
-        return -1;
-    }
-
-    // Prepare the struct ifreq
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(ifr.ifr_name, interface, sizeof(ifr.ifr_name));
-
-    // Get the current interface flags
-    if (ioctl(fd, SIOCGIFFLAGS, &ifr) == -1) {
-        perror("Getting IF flags failed");
-        close(fd);
-        return -1;
-    }
-
-    // Modify the flags to set or unset the IFF_PROMISC flag
-    if (enable) {
-        ifr.ifr_flags |= IFF_PROMISC;
-    } else {
-        ifr.ifr_flags &= ~IFF_PROMISC;
-    }
-
-    // Set the updated flags on the interface
-    if (ioctl(fd, SIOCSIFFLAGS, &ifr) == -1) {
-        perror("Setting IF flags failed");
-        close(fd);
-        return -1;
-    }
-
-    // Close the socket
-    close(fd);
-    return 0;
-}
-
 namespace bm {
 namespace core {
 
-NetworkDevice::NetworkDevice( NetworkInterface& net_if, const std::string& interface ) 
+NetworkDevice::NetworkDevice( NetworkInterface& net_if, const std::string& interface, const NetDeviceConfig& config ) 
     : _net_if{ net_if }
 {
-    // Create socket
-    _sock_fd = ::socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IPV6) );
+    bool use_xdp = config.backend == NetDeviceBackend::XDP_SOCKET;
+
+    // Create socket. With AF_XDP it is only used for ioctls, protocol 0 keeps it from receiving anything.
+    _sock_fd = ::socket(AF_PACKET, SOCK_RAW, use_xdp ? 0 : htons(ETH_P_IPV6) );
     if( _sock_fd == -1 ){
         throw std::runtime_error( "Failed to create socket" );
     }
 
     spdlog::info( "Socket" );
+
+    // Filter before anything gets queued, so non-BM traffic never wakes us up
+    if( !use_xdp && !set_udp_ports( _net_if.udp_ports() ) ) {
+        ::close( _sock_fd );
+        throw std::runtime_error( "Failed to attach packet filter" );
+    }
+
     struct timeval tv;
     tv.tv_sec = 0;
-    tv.tv_usec = 100000;
+    tv.tv_usec = RX_TIMEOUT_MS * 1000;
     if (setsockopt(_sock_fd, SOL_SOCKET, SO_RCVTIMEO,&tv,sizeof(tv)) < 0) {
         perror("Error");
     }
@@ -102,17 +76,65 @@ NetworkDevice::NetworkDevice( NetworkInterface& net_if, const std::string& inter
         _info.mac_address[i] = static_cast<uint8_t>( ifr.ifr_hwaddr.sa_data[i] );
     }
 
-    set_promiscuous_mode( "enx001ec0d1b1a9", 1 );
+    _info.if_name = interface;
+
+    // Membership is tied to this socket, so unlike IFF_PROMISC it is undone when the device goes away
+    if( config.promiscuous && !add_membership( PACKET_MR_PROMISC ) ) {
+        ::close( _sock_fd );
+        throw std::runtime_error( "Failed to enable promiscuous mode" );
+    }
+
+    if( use_xdp ) {
+        try {
+            _xdp = std::make_unique<XdpSocket>( _sock_addr.sll_ifindex, config.xdp, _net_if.udp_ports() );
+        }
+        catch( const std::exception& ) {
+            ::close( _sock_fd );
+            throw;
+        }
+        return;
+    }
+
+    if( config.rx_ring.enabled || config.tx_ring.enabled ) {
+        try {
+            setup_rings( config );
+        }
+        catch( const std::exception& ) {
+            ::close( _sock_fd );
+            throw;
+        }
+    }
+
     if (bind(_sock_fd, (struct sockaddr *)&_sock_addr, sizeof(struct sockaddr_ll)) == -1) {
         ::close(_sock_fd);
         throw std::runtime_error( "Failed to find network interface" );
     }
 
-
-    _info.if_name = interface;
+    // io_uring sends go out through the bound socket, so it can only start once bound
+    if( config.io_engine == IoEngine::IO_URING ) {
+        if( _rx_ring || _tx_ring ) {
+            spdlog::warn( "io_uring engine ignored on {}, packet rings already bypass per-frame syscalls", interface );
+        }
+        else {
+            try {
+                _uring = std::make_unique<IoUringEngine>( _sock_fd, config.io_uring );
+            }
+            catch( const std::exception& e ) {
+                spdlog::warn( "io_uring unavailable on {} ({}), using recvmmsg/sendmmsg", interface, e.what() );
+            }
+        }
+    }
 }
 
 NetworkDevice::~NetworkDevice() {
+    // The engines reference the socket, tear them down first
+    _uring.reset();
+    _xdp.reset();
+
+    if( _ring_map ) {
+        ::munmap( _ring_map, _ring_map_size );
+    }
+
     // Close socket
     if( _sock_fd != -1 ) {
         ::close( _sock_fd );
@@ -123,6 +145,110 @@ NetDeviceInfo NetworkDevice::info() const {
     return _info;
 }
 
+int NetworkDevice::fd() const {
+    if( _xdp ) {
+        return _xdp->fd();
+    }
+    return _uring ? _uring->fd() : _sock_fd;
+}
+
+bool NetworkDevice::set_nonblocking( bool nonblocking ) {
+    // Ring, XDP and io_uring reads wait in poll(), only recv*() honours O_NONBLOCK
+    _rx_timeout_ms = nonblocking ? 0 : RX_TIMEOUT_MS;
+
+    int flags = fcntl( _sock_fd, F_GETFL, 0 );
+    if( flags == -1 ) {
+        return false;
+    }
+    flags = nonblocking ? ( flags | O_NONBLOCK ) : ( flags & ~O_NONBLOCK );
+    return fcntl( _sock_fd, F_SETFL, flags ) != -1;
+}
+
+bool NetworkDevice::add_membership( int type, const uint8_t* mac ) {
+    packet_mreq mreq;
+    std::memset( &mreq, 0, sizeof( mreq ) );
+    mreq.mr_ifindex = _sock_addr.sll_ifindex;
+    mreq.mr_type    = type;
+    if( mac ) {
+        mreq.mr_alen = ETH_ALEN;
+        std::memcpy( mreq.mr_address, mac, ETH_ALEN );
+    }
+
+    if( setsockopt( _sock_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof( mreq ) ) == -1 ) {
+        spdlog::error( "PACKET_ADD_MEMBERSHIP failed on {}: {}", _info.if_name, std::strerror( errno ) );
+        return false;
+    }
+    return true;
+}
+
+bool NetworkDevice::drop_membership( int type, const uint8_t* mac ) {
+    packet_mreq mreq;
+    std::memset( &mreq, 0, sizeof( mreq ) );
+    mreq.mr_ifindex = _sock_addr.sll_ifindex;
+    mreq.mr_type    = type;
+    if( mac ) {
+        mreq.mr_alen = ETH_ALEN;
+        std::memcpy( mreq.mr_address, mac, ETH_ALEN );
+    }
+
+    if( setsockopt( _sock_fd, SOL_PACKET, PACKET_DROP_MEMBERSHIP, &mreq, sizeof( mreq ) ) == -1 ) {
+        spdlog::error( "PACKET_DROP_MEMBERSHIP failed on {}: {}", _info.if_name, std::strerror( errno ) );
+        return false;
+    }
+    return true;
+}
+
+bool NetworkDevice::join_fanout( uint16_t& group_id, FanoutMode mode ) {
+    if( _xdp ) {
+        errno = ENOTSUP;
+        return false;
+    }
+
+    // Only the low 16 bits carry the id, PACKET_FANOUT_FLAG_UNIQUEID makes the kernel pick one
+    uint32_t type = ( mode == FanoutMode::CPU ) ? PACKET_FANOUT_CPU : PACKET_FANOUT_HASH;
+    uint32_t arg = group_id | ( type << 16 );
+    if( group_id == 0 ) {
+        arg |= PACKET_FANOUT_FLAG_UNIQUEID << 16;
+    }
+
+    if( setsockopt( _sock_fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof( arg ) ) == -1 ) {
+        spdlog::error( "PACKET_FANOUT failed on {}: {}", _info.if_name, std::strerror( errno ) );
+        return false;
+    }
+
+    if( group_id == 0 ) {
+        socklen_t arg_len = sizeof( arg );
+        if( getsockopt( _sock_fd, SOL_PACKET, PACKET_FANOUT, &arg, &arg_len ) == -1 ) {
+            spdlog::error( "Failed to read fanout group on {}: {}", _info.if_name, std::strerror( errno ) );
+            return false;
+        }
+        group_id = arg & 0xffff;
+    }
+    return true;
+}
+
+bool NetworkDevice::set_udp_ports( const std::vector<uint16_t>& udp_ports ) {
+    if( udp_ports.size() > BM_FILTER_MAX_UDP_PORTS ) {
+        spdlog::error( "{} UDP ports, packet filters take at most {}", udp_ports.size(), BM_FILTER_MAX_UDP_PORTS );
+        errno = E2BIG;
+        return false;
+    }
+
+    if( _xdp ) {
+        return _xdp->set_udp_ports( udp_ports );
+    }
+
+    auto filter = bm_packet_filter( udp_ports );
+    sock_fprog prog{ static_cast<unsigned short>( filter.size() ), filter.data() };
+
+    // Attaching replaces any previous filter atomically
+    if( setsockopt( _sock_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof( prog ) ) == -1 ) {
+        spdlog::error( "SO_ATTACH_FILTER failed: {}", std::strerror( errno ) );
+        return false;
+    }
+    return true;
+}
+
 ssize_t NetworkDevice::write_frame( const char* buffer, size_t len ) {
     // The input to this method is a complete ethernet frame
 
@@ -131,10 +257,154 @@ ssize_t NetworkDevice::write_frame( const char* buffer, size_t len ) {
         return -1;
     }
 
+    if( _xdp || _uring ) {
+        FrameView frame{ reinterpret_cast<const uint8_t*>( buffer ), len };
+        return write_frames( &frame, 1 ) == 1 ? static_cast<ssize_t>( len ) : -1;
+    }
+
+    if( _tx_ring ) {
+        size_t capacity;
+        uint8_t* slot = tx_slot( capacity );
+        if( !slot && ( flush_tx() < 0 || !( slot = tx_slot( capacity ) ) ) ) {
+            return -1;
+        }
+
+        std::memcpy( slot, buffer, len );
+        tx_commit( len );
+        if( flush_tx() < 0 ) {
+            return -1;
+        }
+        return len;
+    }
+
     ssize_t sz = ::sendto( _sock_fd, buffer, len, 0, (struct sockaddr*)&_sock_addr, sizeof( _sock_addr ) );
     return sz;
 }
 
+ssize_t NetworkDevice::write_frame( const Pbuf& frame ) {
+    return write_frame( reinterpret_cast<const char*>( frame.data() ), frame.len() );
+}
+
+ssize_t NetworkDevice::write_frames( const FrameView* frames, size_t count ) {
+    // Each input is a complete ethernet frame. Returns the number of frames handed to the kernel.
+
+    if( _xdp ) {
+        size_t sent = 0;
+        while( sent < count ) {
+            auto ret = _xdp->write_frames( frames + sent, count - sent );
+            if( ret <= 0 ) {
+                break;
+            }
+            sent += ret;
+        }
+        return ( sent == 0 && count > 0 ) ? -1 : sent;
+    }
+
+    if( _uring ) {
+        return _uring->write_frames( frames, count );
+    }
+
+    if( !_tx_ring ) {
+        mmsghdr msgs[ MAX_BATCH ];
+        iovec   iovs[ MAX_BATCH ];
+
+        size_t sent = 0;
+        while( sent < count ) {
+            size_t batch = std::min( count - sent, MAX_BATCH );
+            for( size_t i = 0; i < batch; i++ ) {
+                iovs[ i ].iov_base = const_cast<uint8_t*>( frames[ sent + i ].data );
+                iovs[ i ].iov_len  = frames[ sent + i ].len;
+
+                std::memset( &msgs[ i ], 0, sizeof( mmsghdr ) );
+                msgs[ i ].msg_hdr.msg_name      = &_sock_addr;
+                msgs[ i ].msg_hdr.msg_namelen   = sizeof( _sock_addr );
+                msgs[ i ].msg_hdr.msg_iov       = &iovs[ i ];
+                msgs[ i ].msg_hdr.msg_iovlen    = 1;
+            }
+
+            int ret = ::sendmmsg( _sock_fd, msgs, batch, 0 );
+            if( ret <= 0 ) {
+                break;
+            }
+            sent += ret;
+        }
+        return ( sent == 0 && count > 0 ) ? -1 : sent;
+    }
+
+    size_t queued = 0;
+    for( ; queued < count; queued++ ) {
+        if( frames[ queued ].len > BM_MAX_FRAME_SIZE ) {
+            errno = EINVAL;
+            break;
+        }
+
+        size_t capacity;
+        uint8_t* slot = tx_slot( capacity );
+        if( !slot ) {
+            // Ring is full, push out what we have and wait for slots to free up
+            if( flush_tx() < 0 || !( slot = tx_slot( capacity ) ) ) {
+                break;
+            }
+        }
+
+        std::memcpy( slot, frames[ queued ].data, frames[ queued ].len );
+        tx_commit( frames[ queued ].len );
+    }
+
+    if( flush_tx() < 0 || ( queued == 0 && count > 0 ) ) {
+        return -1;
+    }
+    return queued;
+}
+
+uint8_t* NetworkDevice::tx_slot( size_t& capacity ) {
+    if( !_tx_ring ) {
+        errno = ENOTSUP;
+        return nullptr;
+    }
+
+    auto* hdr = tx_ring_frame( _tx_frame );
+    auto status = __atomic_load_n( &hdr->tp_status, __ATOMIC_ACQUIRE );
+    if( status == TP_STATUS_WRONG_FORMAT ) {
+        spdlog::warn( "TX ring: kernel rejected frame in slot {}", _tx_frame );
+        status = TP_STATUS_AVAILABLE;
+    }
+    if( status != TP_STATUS_AVAILABLE ) {
+        errno = ENOBUFS;
+        return nullptr;
+    }
+
+    capacity = _tx_frame_size - TX_RING_DATA_OFFSET;
+    return reinterpret_cast<uint8_t*>( hdr ) + TX_RING_DATA_OFFSET;
+}
+
+void NetworkDevice::tx_commit( size_t len ) {
+    auto* hdr = tx_ring_frame( _tx_frame );
+    hdr->tp_len = len;
+    hdr->tp_next_offset = 0;
+    __atomic_store_n( &hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE );
+
+    _tx_frame = ( _tx_frame + 1 ) % _tx_frame_count;
+    _tx_pending++;
+}
+
+ssize_t NetworkDevice::flush_tx() {
+    if( !_tx_ring ) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if( _tx_pending == 0 ) {
+        return 0;
+    }
+
+    // Blocking send transmits every slot marked TP_STATUS_SEND_REQUEST and waits for them to complete
+    ssize_t sz = ::send( _sock_fd, nullptr, 0, 0 );
+    if( sz >= 0 ) {
+        _tx_pending = 0;
+    }
+    return sz;
+}
+
 ssize_t NetworkDevice::read_frame( char* buffer, size_t len ) {
     // The output of this method is a complete ethernet frame
 
@@ -143,9 +413,257 @@ ssize_t NetworkDevice::read_frame( char* buffer, size_t len ) {
         return -1;
     }
 
+    if( _xdp || _uring ) {
+        ssize_t sz = -1;
+        auto copy = [&]( const FrameView& frame ){
+            sz = std::min( len, frame.len );
+            std::memcpy( buffer, frame.data, sz );
+        };
+        if( _xdp ) {
+            _xdp->read_batch( copy, 1, _rx_timeout_ms );
+        }
+        else {
+            _uring->read_batch( copy, 1, _rx_timeout_ms );
+        }
+        return sz;
+    }
+
+    if( _rx_ring ) {
+        if( _rx_frames_left == 0 && !rx_ring_wait_block() ) {
+            return -1;
+        }
+
+        // Truncate like recvfrom would
+        FrameView frame = rx_ring_frame();
+        size_t sz = std::min( len, frame.len );
+        std::memcpy( buffer, frame.data, sz );
+        rx_ring_advance();
+        return sz;
+    }
+
     ssize_t sz = ::recvfrom( _sock_fd, buffer, len, 0, NULL, NULL );
     return sz;
 }
 
+ssize_t NetworkDevice::read_frames( FrameBuffer* frames, size_t count ) {
+    if( count == 0 ) {
+        return 0;
+    }
+
+    if( _xdp || _uring ) {
+        size_t received = 0;
+        auto copy = [&]( const FrameView& frame ){
+            frames[ received ].len = std::min( frames[ received ].size, frame.len );
+            std::memcpy( frames[ received ].data, frame.data, frames[ received ].len );
+            received++;
+        };
+        return _xdp ? _xdp->read_batch( copy, count, _rx_timeout_ms )
+                    : _uring->read_batch( copy, count, _rx_timeout_ms );
+    }
+
+    if( _rx_ring ) {
+        if( _rx_frames_left == 0 && !rx_ring_wait_block() ) {
+            return -1;
+        }
+
+        // Only drain what is already in the current block
+        size_t received = 0;
+        while( received < count && _rx_frames_left > 0 ) {
+            FrameView frame = rx_ring_frame();
+            frames[ received ].len = std::min( frames[ received ].size, frame.len );
+            std::memcpy( frames[ received ].data, frame.data, frames[ received ].len );
+            rx_ring_advance();
+            received++;
+        }
+        return received;
+    }
+
+    mmsghdr msgs[ MAX_BATCH ];
+    iovec   iovs[ MAX_BATCH ];
+
+    size_t batch = std::min( count, MAX_BATCH );
+    for( size_t i = 0; i < batch; i++ ) {
+        iovs[ i ].iov_base = frames[ i ].data;
+        iovs[ i ].iov_len  = frames[ i ].size;
+
+        std::memset( &msgs[ i ], 0, sizeof( mmsghdr ) );
+        msgs[ i ].msg_hdr.msg_iov       = &iovs[ i ];
+        msgs[ i ].msg_hdr.msg_iovlen    = 1;
+    }
+
+    // Block (up to SO_RCVTIMEO) for the first frame, then take whatever else is already queued
+    int ret = ::recvmmsg( _sock_fd, msgs, batch, MSG_WAITFORONE, nullptr );
+    if( ret <= 0 ) {
+        return -1;
+    }
+
+    for( int i = 0; i < ret; i++ ) {
+        frames[ i ].len = msgs[ i ].msg_len;
+    }
+    return ret;
+}
+
+ssize_t NetworkDevice::read_block( const FrameHandler& handler ) {
+    if( _xdp ) {
+        return _xdp->read_batch( handler, MAX_BATCH, _rx_timeout_ms );
+    }
+
+    if( _uring ) {
+        return _uring->read_batch( handler, MAX_BATCH, _rx_timeout_ms );
+    }
+
+    if( !_rx_ring ) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if( _rx_frames_left == 0 && !rx_ring_wait_block() ) {
+        return -1;
+    }
+
+    // The block is handed back to the kernel when its last frame is consumed, so handle it before advancing
+    ssize_t count = 0;
+    while( _rx_frames_left > 0 ) {
+        handler( rx_ring_frame() );
+        rx_ring_advance();
+        count++;
+    }
+
+    return count;
+}
+
+void NetworkDevice::setup_rings( const NetDeviceConfig& config ) {
+    // The version applies to both rings
+    int version = TPACKET_V3;
+    if( setsockopt( _sock_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof( version ) ) == -1 ) {
+        throw std::runtime_error( std::string( "setsockopt PACKET_VERSION failed: " ) + std::strerror( errno ) );
+    }
+
+    size_t rx_size = 0;
+    size_t tx_size = 0;
+
+    if( config.rx_ring.enabled ) {
+        const auto& rx = config.rx_ring;
+
+        tpacket_req3 req;
+        std::memset( &req, 0, sizeof( req ) );
+        req.tp_block_size       = rx.block_size;
+        req.tp_block_nr         = rx.block_count;
+        req.tp_frame_size       = rx.frame_size;
+        req.tp_frame_nr         = ( rx.block_size / rx.frame_size ) * rx.block_count;
+        req.tp_retire_blk_tov   = rx.block_timeout_ms;
+        req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+
+        if( setsockopt( _sock_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof( req ) ) == -1 ) {
+            throw std::runtime_error( std::string( "setsockopt PACKET_RX_RING failed: " ) + std::strerror( errno ) );
+        }
+        rx_size = static_cast<size_t>( rx.block_size ) * rx.block_count;
+    }
+
+    if( config.tx_ring.enabled ) {
+        const auto& tx = config.tx_ring;
+        if( tx.frame_size < TX_RING_DATA_OFFSET + BM_MAX_FRAME_SIZE ) {
+            throw std::runtime_error( "TX ring frame size too small for a BM frame" );
+        }
+
+        // TPACKET_V3 transmits frame by frame, block retire options must stay zeroed
+        tpacket_req3 req;
+        std::memset( &req, 0, sizeof( req ) );
+        req.tp_block_size       = tx.block_size;
+        req.tp_block_nr         = tx.block_count;
+        req.tp_frame_size       = tx.frame_size;
+        req.tp_frame_nr         = ( tx.block_size / tx.frame_size ) * tx.block_count;
+
+        if( setsockopt( _sock_fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof( req ) ) == -1 ) {
+            throw std::runtime_error( std::string( "setsockopt PACKET_TX_RING failed: " ) + std::strerror( errno ) );
+        }
+        tx_size = static_cast<size_t>( tx.block_size ) * tx.block_count;
+    }
+
+    // Both rings must be mapped in one go, RX first
+    size_t map_size = rx_size + tx_size;
+    void* map = ::mmap( nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, _sock_fd, 0 );
+    if( map == MAP_FAILED ) {
+        throw std::runtime_error( std::string( "mmap of packet rings failed: " ) + std::strerror( errno ) );
+    }
+
+    _ring_map       = static_cast<uint8_t*>( map );
+    _ring_map_size  = map_size;
+
+    if( config.rx_ring.enabled ) {
+        _rx_ring        = _ring_map;
+        _rx_block_size  = config.rx_ring.block_size;
+        _rx_block_count = config.rx_ring.block_count;
+
+        spdlog::info( "RX ring: {} blocks of {} bytes, {} ms retire timeout", _rx_block_count, _rx_block_size, config.rx_ring.block_timeout_ms );
+    }
+
+    if( config.tx_ring.enabled ) {
+        _tx_ring            = _ring_map + rx_size;
+        _tx_block_size      = config.tx_ring.block_size;
+        _tx_frame_size      = config.tx_ring.frame_size;
+        _tx_frame_count     = ( _tx_block_size / _tx_frame_size ) * config.tx_ring.block_count;
+
+        spdlog::info( "TX ring: {} slots of {} bytes", _tx_frame_count, _tx_frame_size );
+    }
+}
+
+tpacket3_hdr* NetworkDevice::tx_ring_frame( uint32_t index ) const {
+    // Frames never straddle blocks, so locate the block first
+    uint32_t frames_per_block = _tx_block_size / _tx_frame_size;
+    size_t offset = static_cast<size_t>( index / frames_per_block ) * _tx_block_size
+                  + static_cast<size_t>( index % frames_per_block ) * _tx_frame_size;
+    return reinterpret_cast<tpacket3_hdr*>( _tx_ring + offset );
+}
+
+bool NetworkDevice::rx_ring_wait_block() {
+    auto* block = reinterpret_cast<tpacket_block_desc*>( _rx_ring + static_cast<size_t>( _rx_block ) * _rx_block_size );
+
+    while( true ) {
+        if( __atomic_load_n( &block->hdr.bh1.block_status, __ATOMIC_ACQUIRE ) & TP_STATUS_USER ) {
+            break;
+        }
+
+        pollfd pfd{ _sock_fd, POLLIN | POLLERR, 0 };
+        int ret = ::poll( &pfd, 1, _rx_timeout_ms );
+        if( ret <= 0 ) {
+            if( ret == 0 ) {
+                errno = EAGAIN;
+            }
+            return false;
+        }
+    }
+
+    _rx_frames_left = block->hdr.bh1.num_pkts;
+    _rx_frame = reinterpret_cast<tpacket3_hdr*>( reinterpret_cast<uint8_t*>( block ) + block->hdr.bh1.offset_to_first_pkt );
+
+    if( _rx_frames_left == 0 ) {
+        // Nothing to hand out, give it straight back
+        __atomic_store_n( &block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE );
+        _rx_block = ( _rx_block + 1 ) % _rx_block_count;
+        errno = EAGAIN;
+        return false;
+    }
+    return true;
+}
+
+FrameView NetworkDevice::rx_ring_frame() const {
+    return FrameView{ reinterpret_cast<const uint8_t*>( _rx_frame ) + _rx_frame->tp_mac, _rx_frame->tp_snaplen };
+}
+
+void NetworkDevice::rx_ring_advance() {
+    _rx_frames_left--;
+    if( _rx_frames_left > 0 ) {
+        _rx_frame = reinterpret_cast<tpacket3_hdr*>( reinterpret_cast<uint8_t*>( _rx_frame ) + _rx_frame->tp_next_offset );
+        return;
+    }
+
+    // Last frame of the block: return it to the kernel and move on
+    auto* block = reinterpret_cast<tpacket_block_desc*>( _rx_ring + static_cast<size_t>( _rx_block ) * _rx_block_size );
+    __atomic_store_n( &block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE );
+    _rx_block = ( _rx_block + 1 ) % _rx_block_count;
+    _rx_frame = nullptr;
+}
+
 }
 }
\ No newline at end of file
@@ -1,58 +1,658 @@
 #include "bm_core/network_interface.hpp"
 #include "bm_core/network_device.hpp"
 #include <arpa/inet.h> 
+#include <netinet/udp.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <cstddef>
+#include <cstring>
 
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/bin_to_hex.h>
 
 #include "bm_core/node.hpp"
+#include "bm_core/checksum.hpp"
+#include "bm_core/bcmp_messages.hpp"
+
+namespace {
+
+// All nodes / all routers, link-local and realm-local scope
+const in6_addr BM_MULTICAST_GROUPS[] = {
+    { { { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01 } } },
+    { { { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02 } } },
+    bm::core::NetworkInterface::ALL_NODES_REALM_LOCAL,
+    { { { 0xff, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02 } } },
+};
+
+// RFC 2464: 33:33 followed by the low 32 bits of the group address
+void multicast_mac( const in6_addr& group, uint8_t* mac )
+{
+    mac[0] = 0x33;
+    mac[1] = 0x33;
+    std::memcpy( mac + 2, group.s6_addr + 12, 4 );
+}
+
+}
 
 namespace bm {
 namespace core {
 
-NetworkInterface::NetworkInterface( Node& node, const std::vector<std::string>& interfaces ) 
+NetworkInterface::NetworkInterface( Node& node, const std::vector<std::string>& interfaces, const NetDeviceConfig& dev_config ) 
     : _node{ node }
 {
     // Create network devices
     for( auto& iface : interfaces )
     {
-        _net_devices.emplace_back( std::make_shared<NetworkDevice>( *this, iface ) );
+        _net_devices.emplace_back( std::make_shared<NetworkDevice>( *this, iface, dev_config ) );
+    }
+
+    _rx_devices.push_back( _net_devices );
+    if( dev_config.fanout.workers > 1 ) {
+        if( dev_config.backend == NetDeviceBackend::XDP_SOCKET ) {
+            spdlog::warn( "PACKET_FANOUT is not available with AF_XDP, receiving on a single worker" );
+        }
+        else {
+            setup_fanout( dev_config );
+        }
     }
 
     // Create IP Addresses
-    _lla.__in6_u.__u6_addr32[0] = htonl(0xFD000000);
+    _lla.__in6_u.__u6_addr32[0] = htonl(0xFE800000);
     _lla.__in6_u.__u6_addr32[1] = htonl(0x0);
     _lla.__in6_u.__u6_addr32[2] = htonl((_node.id() >> 32) & 0xFFFFFFFF);
     _lla.__in6_u.__u6_addr32[3] = htonl(_node.id() & 0xFFFFFFFF);
 
-    _ula.__in6_u.__u6_addr32[0] = htonl(0xFE800000);
+    _ula.__in6_u.__u6_addr32[0] = htonl(0xFD000000);
     _ula.__in6_u.__u6_addr32[1] = htonl(0x0);
     _ula.__in6_u.__u6_addr32[2] = htonl((_node.id() >> 32) & 0xFFFFFFFF);
     _ula.__in6_u.__u6_addr32[3] = htonl(_node.id() & 0xFFFFFFFF);
 
     spdlog::info("LLA: {}", spdlog::to_hex(_lla.__in6_u.__u6_addr8, _lla.__in6_u.__u6_addr8 + 16)); 
     spdlog::info("ULA: {}", spdlog::to_hex(_ula.__in6_u.__u6_addr8, _ula.__in6_u.__u6_addr8 + 16)); 
+
+    // Accept the BM groups instead of running the NICs promiscuous. The device's own unicast MAC is always accepted;
+    // adding it as PACKET_MR_UNICAST would push NICs without unicast filtering into promiscuous mode.
+    for( auto& group : BM_MULTICAST_GROUPS )
+    {
+        join_multicast_group( group );
+    }
+
+    _bcmp.register_handler<bcmp_heartbeat_t>( BCMP_HEARTBEAT, [this]( const BcmpMessage& msg, const bcmp_heartbeat_t& heartbeat ){
+        handle_heartbeat( msg, heartbeat );
+    });
+    _bcmp.register_handler<bcmp_ack_t>( BCMP_ACK, [this]( const BcmpMessage& msg, const bcmp_ack_t& ack ){
+        _reliable.ack_received( msg.ip6.ip6_src, ack );
+    });
+}
+
+void NetworkInterface::setup_fanout( const NetDeviceConfig& dev_config )
+{
+    // Extra sockets only receive. Link-layer memberships are per interface, so the port device's already cover them.
+    auto member_config = dev_config;
+    member_config.tx_ring.enabled   = false;
+    member_config.promiscuous       = false;
+
+    _rx_devices.resize( dev_config.fanout.workers );
+
+    for( auto& dev : _net_devices ) {
+        uint16_t group_id = 0;
+        if( !dev->join_fanout( group_id, dev_config.fanout.mode ) ) {
+            throw std::runtime_error( "Failed to create fanout group on " + dev->info().if_name );
+        }
+
+        for( size_t worker = 1; worker < _rx_devices.size(); worker++ ) {
+            auto member = std::make_shared<NetworkDevice>( *this, dev->info().if_name, member_config );
+            if( !member->join_fanout( group_id, dev_config.fanout.mode ) ) {
+                throw std::runtime_error( "Failed to join fanout group on " + dev->info().if_name );
+            }
+            _rx_devices[ worker ].push_back( std::move( member ) );
+        }
+
+        spdlog::info( "{}: fanout group {} with {} sockets", dev->info().if_name, group_id, _rx_devices.size() );
+    }
+}
+
+uint8_t NetworkInterface::port_of( const NetworkDevice& dev ) const
+{
+    for( size_t i = 0; i < _net_devices.size(); i++ ) {
+        if( _net_devices[ i ]->ifindex() == dev.ifindex() ) {
+            return static_cast<uint8_t>( i + 1 );
+        }
+    }
+    return 0;
+}
+
+void NetworkInterface::update_neighbor( const NeighborEntry& entry )
+{
+    _neighbor_updates.enqueue( entry );
+}
+
+void NetworkInterface::update()
+{
+    NeighborEntry updates[ 64 ];
+    size_t count;
+    while( ( count = _neighbor_updates.try_dequeue_bulk( updates, 64 ) ) > 0 ) {
+        for( size_t i = 0; i < count; i++ ) {
+            // Queues from different workers interleave arbitrarily, never let an older heartbeat overwrite a newer one
+            auto* current = _neighbors.find( updates[ i ].node_id );
+            if( current && current->last_heartbeat > updates[ i ].last_heartbeat ) {
+                continue;
+            }
+            if( !current || current->local_ingress_port != updates[ i ].local_ingress_port ||
+                current->remote_egress_port != updates[ i ].remote_egress_port ) {
+                _topology.neighbors_changed();
+            }
+            _neighbors.insert( updates[ i ] );
+            schedule_lease( updates[ i ] );
+        }
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    _lease_timers.advance( now );
+    _neighbors.publish();
+
+    _reliable.update( now );
+    _echo.update();
+    _topology.update( now );
+    _resources.update( now );
+    _dfu.update( now );
+}
+
+void NetworkInterface::schedule_lease( const NeighborEntry& entry )
+{
+    auto it = _lease_timer_ids.find( entry.node_id );
+
+    // A zero lease never expires
+    if( entry.liveliness_lease_dur_ms == 0 ) {
+        if( it != _lease_timer_ids.end() ) {
+            _lease_timers.cancel( it->second );
+            _lease_timer_ids.erase( it );
+        }
+        return;
+    }
+
+    auto expiry = entry.last_heartbeat + std::chrono::milliseconds( entry.liveliness_lease_dur_ms );
+    if( it != _lease_timer_ids.end() ) {
+        _lease_timers.reschedule( it->second, expiry );
+    }
+    else {
+        _lease_timer_ids.emplace( entry.node_id, _lease_timers.schedule( entry.node_id, expiry ) );
+    }
+}
+
+void NetworkInterface::expire_neighbor( NodeId id )
+{
+    _lease_timer_ids.erase( id );
+
+    auto* found = _neighbors.find( id );
+    if( !found ) {
+        return;
+    }
+    NeighborEntry entry = *found;
+    _neighbors.erase( id );
+    _topology.neighbors_changed();
+
+    spdlog::info( "Neighbor {:016x} on port {} is down", id, entry.local_ingress_port );
+    if( _neighbor_down ) {
+        _neighbor_down( entry );
+    }
+}
+
+bool NetworkInterface::HeaderKey::operator==( const HeaderKey& other ) const
+{
+    return port == other.port && next_header == other.next_header && std::memcmp( &dst, &other.dst, sizeof( dst ) ) == 0;
+}
+
+size_t NetworkInterface::HeaderKeyHash::operator()( const HeaderKey& key ) const
+{
+    // FNV-1a over the key fields
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto mix = [&]( uint8_t byte ){ hash = ( hash ^ byte ) * 0x100000001b3ull; };
+    for( auto byte : key.dst.s6_addr ) {
+        mix( byte );
+    }
+    mix( key.port );
+    mix( key.next_header );
+    return hash;
+}
+
+const in6_addr& NetworkInterface::source_address( const in6_addr& dst ) const
+{
+    bool link_local = ( dst.s6_addr[0] == 0xff && ( dst.s6_addr[1] & 0x0f ) == 0x02 )
+                   || ( dst.s6_addr[0] == 0xfe && ( dst.s6_addr[1] & 0xc0 ) == 0x80 );
+    return link_local ? _lla : _ula;
+}
+
+const NetworkInterface::HeaderTemplate& NetworkInterface::header_template( uint8_t port, uint8_t next_header, const in6_addr& dst )
+{
+    HeaderKey key{ dst, port, next_header };
+    {
+        std::shared_lock<std::shared_mutex> lock( _header_mutex );
+        auto it = _header_templates.find( key );
+        if( it != _header_templates.end() ) {
+            return it->second;
+        }
+    }
+
+    HeaderTemplate header{};
+    auto* eth = reinterpret_cast<ethhdr*>( header.data() );
+    auto* ip6 = reinterpret_cast<ip6_hdr*>( header.data() + sizeof( ethhdr ) );
+
+    // BM links are point to point, so unicast goes to the broadcast MAC and is filtered at the IPv6 layer
+    if( dst.s6_addr[0] == 0xff ) {
+        multicast_mac( dst, eth->h_dest );
+    }
+    else {
+        std::memset( eth->h_dest, 0xff, ETH_ALEN );
+    }
+    std::memcpy( eth->h_source, _net_devices[ port - 1 ]->info().mac_address, ETH_ALEN );
+    eth->h_proto = htons( ETH_P_IPV6 );
+
+    ip6->ip6_flow   = htonl( 6 << 28 );
+    ip6->ip6_plen   = 0;
+    ip6->ip6_nxt    = next_header;
+    ip6->ip6_hops   = BM_HOP_LIMIT;
+    ip6->ip6_src    = source_address( dst );
+    ip6->ip6_dst    = dst;
+
+    std::unique_lock<std::shared_mutex> lock( _header_mutex );
+    return _header_templates.emplace( key, header ).first->second;
+}
+
+int NetworkInterface::bm_tx( Pbuf& pbuf, uint8_t next_header, const in6_addr& dst, uint8_t port )
+{
+    if( port > _net_devices.size() || pbuf.len() > NetworkDevice::BM_MTU - sizeof( ip6_hdr ) ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint16_t payload_len = htons( static_cast<uint16_t>( pbuf.len() ) );
+    uint8_t* header = pbuf.push( BM_HEADER_BYTES );
+    if( !header ) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    // Every port gets its own source MAC, so rewrite the header in place before each send. Writes complete before
+    // returning, the kernel never looks at the pbuf afterwards.
+    uint8_t first = port ? port : 1;
+    uint8_t last = port ? port : static_cast<uint8_t>( _net_devices.size() );
+    int sent = 0;
+    for( uint8_t p = first; p <= last; p++ ) {
+        std::memcpy( header, header_template( p, next_header, dst ).data(), BM_HEADER_BYTES );
+        std::memcpy( header + sizeof( ethhdr ) + offsetof( ip6_hdr, ip6_plen ), &payload_len, sizeof( payload_len ) );
+
+        if( _net_devices[ p - 1 ]->write_frame( pbuf ) >= 0 ) {
+            sent++;
+        }
+        else {
+            spdlog::warn( "bm_tx on port {} failed: {}", p, std::strerror( errno ) );
+        }
+    }
+
+    pbuf.pull( BM_HEADER_BYTES );
+    return sent ? sent : -1;
+}
+
+bool NetworkInterface::join_multicast_group( const in6_addr& group )
+{
+    if( group.s6_addr[0] != 0xff ) {
+        return false;
+    }
+
+    uint8_t mac[ ETH_ALEN ];
+    multicast_mac( group, mac );
+
+    bool ok = true;
+    for( auto& dev : _net_devices ) {
+        ok &= dev->add_membership( PACKET_MR_MULTICAST, mac );
+    }
+    return ok;
+}
+
+bool NetworkInterface::leave_multicast_group( const in6_addr& group )
+{
+    if( group.s6_addr[0] != 0xff ) {
+        return false;
+    }
+
+    uint8_t mac[ ETH_ALEN ];
+    multicast_mac( group, mac );
+
+    bool ok = true;
+    for( auto& dev : _net_devices ) {
+        ok &= dev->drop_membership( PACKET_MR_MULTICAST, mac );
+    }
+    return ok;
+}
+
+bool NetworkInterface::bind( uint16_t port, UdpDemux::Handler handler, bool reliable )
+{
+    if( reliable ) {
+        // Strip the sequence header and only pass on the first copy of each datagram
+        handler = [this, handler = std::move( handler )]( const UdpDatagram& dgram ){
+            bcmp_reliable_header_t sequence;
+            if( dgram.len < sizeof( sequence ) || IN6_IS_ADDR_MULTICAST( &dgram.ip6.ip6_dst ) ) {
+                return;
+            }
+            std::memcpy( &sequence, dgram.payload, sizeof( sequence ) );
+            if( _reliable.receive( dgram.ip6.ip6_src, sequence ) ) {
+                handler( UdpDatagram{ dgram.dev, dgram.ingress_port, dgram.ip6, dgram.src_port, dgram.dst_port,
+                                      dgram.payload + sizeof( sequence ), dgram.len - sizeof( sequence ) } );
+            }
+        };
+    }
+
+    // Checked first, so a port the filters can not take never gets a binding
+    if( std::find( _udp_ports.begin(), _udp_ports.end(), port ) == _udp_ports.end() &&
+        _udp_ports.size() >= BM_FILTER_MAX_UDP_PORTS ) {
+        spdlog::error( "Can not bind UDP port {}, the packet filters take at most {} ports", port,
+                       BM_FILTER_MAX_UDP_PORTS );
+        errno = ENOSPC;
+        return false;
+    }
+
+    if( !_udp.bind( port, std::move( handler ) ) ) {
+        return false;
+    }
+    if( !add_udp_port( port ) ) {
+        _udp.unbind( port );
+        return false;
+    }
+    return true;
+}
+
+void NetworkInterface::unbind( uint16_t port )
+{
+    _udp.unbind( port );
+
+    // The well-known ports stay in the packet filters, unbound datagrams to them are just counted and dropped
+    if( port == BM_MIDDLEWARE_PORT || port == BM_BCL_PORT || port == STRESS_TEST_PORT ) {
+        return;
+    }
+    auto it = std::find( _udp_ports.begin(), _udp_ports.end(), port );
+    if( it != _udp_ports.end() ) {
+        _udp_ports.erase( it );
+        apply_udp_ports();
+    }
+}
+
+bool NetworkInterface::add_udp_port( uint16_t port )
+{
+    if( std::find( _udp_ports.begin(), _udp_ports.end(), port ) != _udp_ports.end() ) {
+        return true;
+    }
+    if( _udp_ports.size() >= BM_FILTER_MAX_UDP_PORTS ) {
+        errno = ENOSPC;
+        return false;
+    }
+    _udp_ports.push_back( port );
+
+    // Devices already updated go back to the filter without the port
+    if( !apply_udp_ports() ) {
+        int err = errno;
+        _udp_ports.pop_back();
+        apply_udp_ports();
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+bool NetworkInterface::apply_udp_ports()
+{
+    bool ok = true;
+    for( auto& worker : _rx_devices ) {
+        for( auto& dev : worker ) {
+            if( !dev->set_udp_ports( _udp_ports ) ) {
+                spdlog::error( "Failed to update packet filter on {}", dev->info().if_name );
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+bool NetworkInterface::bm_rx( NetworkDevice& dev, const FrameView& frame )
+{
+    if( frame.len < BM_HEADER_BYTES ) {
+        return false;
+    }
+
+    uint16_t ethertype;
+    std::memcpy( &ethertype, frame.data + offsetof( ethhdr, h_proto ), sizeof( ethertype ) );
+    if( ethertype != htons( ETH_P_IPV6 ) ) {
+        return false;
+    }
+
+    // Frame memory carries no alignment guarantee for the IPv6 header
+    ip6_hdr ip6;
+    std::memcpy( &ip6, frame.data + sizeof( ethhdr ), sizeof( ip6 ) );
+    if( ( ip6.ip6_vfc >> 4 ) != 6 ) {
+        return false;
+    }
+
+    // Unicast goes out to the broadcast MAC, so on a shared segment we also see what other nodes are sent
+    if( !IN6_IS_ADDR_MULTICAST( &ip6.ip6_dst ) && !IN6_ARE_ADDR_EQUAL( &ip6.ip6_dst, &_lla ) &&
+        !IN6_ARE_ADDR_EQUAL( &ip6.ip6_dst, &_ula ) ) {
+        return false;
+    }
+
+    // Short frames are padded on the wire, so only a payload longer than the frame is an error
+    size_t payload_len = ntohs( ip6.ip6_plen );
+    if( payload_len > frame.len - BM_HEADER_BYTES ) {
+        return false;
+    }
+
+    const uint8_t* payload = frame.data + BM_HEADER_BYTES;
+    switch( ip6.ip6_nxt ) {
+        case IP_PROTO_BCMP:
+            return bcmp_rx( dev, ip6, payload, payload_len );
+        case IPPROTO_UDP:
+            return udp_rx( dev, ip6, payload, payload_len );
+        default:
+            return false;
+    }
+}
+
+bool NetworkInterface::bcmp_rx( NetworkDevice& dev, const ip6_hdr& ip6, const uint8_t* payload, size_t len )
+{
+    if( len < sizeof( bcmp_header_t ) ) {
+        return false;
+    }
+
+    // Summing a message together with its checksum gives zero when it is intact
+    uint64_t sum = ip6_pseudo_header_sum( ip6.ip6_src, ip6.ip6_dst, len, IP_PROTO_BCMP );
+    if( inet_checksum_finish( inet_checksum_add( payload, len, sum ) ) != 0 ) {
+        spdlog::debug( "BCMP checksum error from {}", spdlog::to_hex( ip6.ip6_src.s6_addr, ip6.ip6_src.s6_addr + 16 ) );
+        return false;
+    }
+
+    bcmp_header_t header;
+    std::memcpy( &header, payload, sizeof( header ) );
+    payload += sizeof( header );
+    len -= sizeof( header );
+
+    // Reliable messages are acknowledged even when they are duplicates, but only dispatched once
+    if( header.flags & BCMP_FLAG_RELIABLE ) {
+        bcmp_reliable_header_t sequence;
+        if( len < sizeof( sequence ) || IN6_IS_ADDR_MULTICAST( &ip6.ip6_dst ) ) {
+            return false;
+        }
+        std::memcpy( &sequence, payload, sizeof( sequence ) );
+        if( !_reliable.receive( ip6.ip6_src, sequence ) ) {
+            return false;
+        }
+        payload += sizeof( sequence );
+        len -= sizeof( sequence );
+    }
+
+    BcmpMessage msg{ dev, port_of( dev ), ip6, header, payload, len };
+    return _bcmp.dispatch( msg );
+}
+
+bool NetworkInterface::udp_rx( NetworkDevice& dev, const ip6_hdr& ip6, const uint8_t* payload, size_t len )
+{
+    if( len < sizeof( udphdr ) ) {
+        return false;
+    }
+
+    udphdr udp;
+    std::memcpy( &udp, payload, sizeof( udp ) );
+
+    size_t udp_len = ntohs( udp.uh_ulen );
+    if( udp_len < sizeof( udphdr ) || udp_len > len ) {
+        return false;
+    }
+
+    // The checksum is mandatory over IPv6 (RFC 8200), so zero is never valid
+    uint64_t sum = ip6_pseudo_header_sum( ip6.ip6_src, ip6.ip6_dst, udp_len, IPPROTO_UDP );
+    if( udp.uh_sum == 0 || inet_checksum_finish( inet_checksum_add( payload, udp_len, sum ) ) != 0 ) {
+        spdlog::debug( "UDP checksum error from {}", spdlog::to_hex( ip6.ip6_src.s6_addr, ip6.ip6_src.s6_addr + 16 ) );
+        return false;
+    }
+
+    UdpDatagram dgram{ dev, port_of( dev ), ip6, ntohs( udp.uh_sport ), ntohs( udp.uh_dport ),
+                       payload + sizeof( udp ), udp_len - sizeof( udp ) };
+    return _udp.dispatch( dgram );
 }
 
-void NetworkInterface::send_bcmp_message( const std::string& dest_addr, uint8_t* data, size_t len )
+void NetworkInterface::handle_heartbeat( const BcmpMessage& msg, const bcmp_heartbeat_t& heartbeat )
 {
-    // Choose which ports to send to based on dest_addr
-    // Only allow the well defined multicast addresses for now
+    NeighborEntry entry{};
+    entry.node_id                   = node_id_of( msg.ip6.ip6_src );
+    entry.local_ingress_port        = msg.ingress_port;
+    entry.liveliness_lease_dur_ms   = heartbeat.liveliness_lease_dur_s * 1000;
+    entry.last_heartbeat            = std::chrono::steady_clock::now();
+    update_neighbor( entry );
+}
 
-    // If dest_addr is multicast, set 
+NodeId NetworkInterface::node_id() const
+{
+    return _node.id();
+}
 
+NodeId NetworkInterface::node_id_of( const in6_addr& addr )
+{
+    return ( static_cast<uint64_t>( ntohl( addr.s6_addr32[2] ) ) << 32 ) | ntohl( addr.s6_addr32[3] );
+}
 
-    // FIll ETH Header
-    // _eth_header_out.h_dest
+in6_addr NetworkInterface::unique_local_address( NodeId id )
+{
+    in6_addr addr{};
+    addr.s6_addr32[0] = htonl( 0xFD000000 );
+    addr.s6_addr32[2] = htonl( static_cast<uint32_t>( id >> 32 ) );
+    addr.s6_addr32[3] = htonl( static_cast<uint32_t>( id ) );
+    return addr;
+}
+
+uint8_t NetworkInterface::egress_port( const in6_addr& dst )
+{
+    if( dst.s6_addr[0] == 0xff ) {
+        return 0;
+    }
+
+    NeighborEntry neighbor;
+    if( _neighbors.lookup( node_id_of( dst ), neighbor ) ) {
+        return neighbor.local_ingress_port;
+    }
+    return 0;
+}
 
-    // Fill IPv6 Header
+int NetworkInterface::send_bcmp_message( const in6_addr& dst, uint16_t type, const void* payload, size_t len, uint8_t flags )
+{
+    bool is_reliable = flags & BCMP_FLAG_RELIABLE;
+    size_t bcmp_len = sizeof( bcmp_header_t ) + ( is_reliable ? sizeof( bcmp_reliable_header_t ) : 0 ) + len;
+    if( bcmp_len > NetworkDevice::BM_MTU - sizeof( ip6_hdr ) ) {
+        errno = EMSGSIZE;
+        return -1;
+    }
 
-    // Fill Payload
+    bcmp_reliable_header_t reliable;
+    if( is_reliable && !_reliable.next_seq( dst, reliable ) ) {
+        return -1;
+    }
 
-    // Calc FCS
+    auto pbuf = _pbuf_pool.alloc();
+    if( !pbuf ) {
+        errno = ENOBUFS;
+        return -1;
+    }
 
-    // Send
+    auto* header = reinterpret_cast<bcmp_header_t*>( pbuf->append( sizeof( bcmp_header_t ) ) );
+    header->type        = type;
+    header->checksum    = 0;
+    header->flags       = flags;
+    header->rsvd        = 0;
+
+    uint64_t sum = ip6_pseudo_header_sum( source_address( dst ), dst, bcmp_len, IP_PROTO_BCMP );
+    sum = inet_checksum_add( header, sizeof( bcmp_header_t ), sum );
+    if( is_reliable ) {
+        sum = inet_checksum_copy( pbuf->append( sizeof( reliable ) ), &reliable, sizeof( reliable ), sum );
+    }
+    sum = inet_checksum_copy( pbuf->append( len ), payload, len, sum );
+    header->checksum = inet_checksum_finish( sum );
+
+    if( is_reliable ) {
+        return _reliable.send( dst, IP_PROTO_BCMP, reliable.seq, std::move( pbuf ) );
+    }
+    return bm_tx( *pbuf, IP_PROTO_BCMP, dst, egress_port( dst ) );
+}
+
+int NetworkInterface::send_to( const in6_addr& dst, uint16_t port, const void* data, size_t len, uint16_t src_port, bool reliable )
+{
+    iovec iov{ const_cast<void*>( data ), len };
+    return send_to( dst, port, &iov, 1, src_port, reliable );
+}
+
+int NetworkInterface::send_to( const in6_addr& dst, uint16_t port, const iovec* iov, size_t iovcnt, uint16_t src_port, bool reliable )
+{
+    size_t udp_len = sizeof( udphdr ) + ( reliable ? sizeof( bcmp_reliable_header_t ) : 0 );
+    for( size_t i = 0; i < iovcnt; i++ ) {
+        udp_len += iov[ i ].iov_len;
+    }
+    if( udp_len > NetworkDevice::BM_MTU - sizeof( ip6_hdr ) ) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    bcmp_reliable_header_t sequence;
+    if( reliable && !_reliable.next_seq( dst, sequence ) ) {
+        return -1;
+    }
+
+    auto pbuf = _pbuf_pool.alloc();
+    if( !pbuf ) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    auto* header = reinterpret_cast<udphdr*>( pbuf->append( sizeof( udphdr ) ) );
+    header->uh_sport    = htons( src_port ? src_port : port );
+    header->uh_dport    = htons( port );
+    header->uh_ulen     = htons( static_cast<uint16_t>( udp_len ) );
+    header->uh_sum      = 0;
+
+    uint64_t sum = ip6_pseudo_header_sum( source_address( dst ), dst, udp_len, IPPROTO_UDP );
+    sum = inet_checksum_add( header, sizeof( udphdr ), sum );
+    if( reliable ) {
+        sum = inet_checksum_copy( pbuf->append( sizeof( sequence ) ), &sequence, sizeof( sequence ), sum );
+    }
+    for( size_t i = 0; i < iovcnt; i++ ) {
+        sum = inet_checksum_copy( pbuf->append( iov[ i ].iov_len ), iov[ i ].iov_base, iov[ i ].iov_len, sum );
+    }
+
+    // A computed zero goes out as all ones, zero means no checksum
+    uint16_t checksum = inet_checksum_finish( sum );
+    header->uh_sum = checksum ? checksum : 0xffff;
+
+    if( reliable ) {
+        return _reliable.send( dst, IPPROTO_UDP, sequence.seq, std::move( pbuf ) );
+    }
+    return bm_tx( *pbuf, IPPROTO_UDP, dst, egress_port( dst ) );
 }
 
 }
-}
\ No newline at end of file
+}
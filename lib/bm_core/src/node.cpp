@@ -3,9 +3,10 @@
 namespace bm {
 namespace core {
 
-Node::Node( NodeId id, const std::vector<std::string>& interfaces )
+Node::Node( NodeId id, const std::vector<std::string>& interfaces, const NetDeviceConfig& dev_config )
     : _id{ id }
-    , _net_if{ *this, interfaces }
+    , _net_if{ *this, interfaces, dev_config }
+    , _middleware{ _net_if, id }
 {
 }
 
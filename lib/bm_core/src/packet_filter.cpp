@@ -0,0 +1,48 @@
+#include "bm_core/packet_filter.hpp"
+#include "bm_core/network_device.hpp"
+#include "bm_core/network_interface.hpp"
+
+#include <netinet/in.h>
+
+#include <stdexcept>
+
+namespace bm {
+namespace core {
+
+std::vector<sock_filter> bm_packet_filter( const std::vector<uint16_t>& udp_ports )
+{
+    // Conditional jumps are 8-bit relative offsets, which bounds the number of ports we can test
+    if( udp_ports.size() > BM_FILTER_MAX_UDP_PORTS ) {
+        throw std::length_error( "Too many UDP ports for packet filter" );
+    }
+
+    // Offsets into an untagged ethernet frame carrying IPv6
+    constexpr uint32_t ETHERTYPE_OFF = 12;
+    constexpr uint32_t IP6_NXT_OFF   = 14 + 6;
+    constexpr uint32_t UDP_DPORT_OFF = 14 + 40 + 2;
+
+    const uint8_t n = static_cast<uint8_t>( udp_ports.size() );
+
+    // Layout: 6 header instructions, n port tests, "ret reject" at 6 + n, "ret accept" at 7 + n.
+    // Jump offsets are relative to the instruction following the jump.
+    std::vector<sock_filter> prog = {
+        BPF_STMT( BPF_LD | BPF_H | BPF_ABS, ETHERTYPE_OFF ),
+        BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, 0, static_cast<uint8_t>( n + 4 ) ),
+        BPF_STMT( BPF_LD | BPF_B | BPF_ABS, IP6_NXT_OFF ),
+        BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, NetworkInterface::IP_PROTO_BCMP, static_cast<uint8_t>( n + 3 ), 0 ),
+        BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, static_cast<uint8_t>( n + 1 ) ),
+        BPF_STMT( BPF_LD | BPF_H | BPF_ABS, UDP_DPORT_OFF ),
+    };
+
+    for( uint8_t i = 0; i < n; i++ ) {
+        prog.push_back( BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, udp_ports[ i ], static_cast<uint8_t>( n - i ), 0 ) );
+    }
+
+    prog.push_back( BPF_STMT( BPF_RET | BPF_K, 0 ) );
+    prog.push_back( BPF_STMT( BPF_RET | BPF_K, NetworkDevice::BM_MAX_FRAME_SIZE ) );
+
+    return prog;
+}
+
+}
+}
@@ -0,0 +1,120 @@
+#include "bm_core/pbuf.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace bm {
+namespace core {
+
+uint8_t* Pbuf::push( size_t bytes )
+{
+    if( bytes > _offset ) {
+        return nullptr;
+    }
+    _offset -= bytes;
+    _len += bytes;
+    return data();
+}
+
+bool Pbuf::pull( size_t bytes )
+{
+    if( bytes > _len ) {
+        return false;
+    }
+    _offset += bytes;
+    _len -= bytes;
+    return true;
+}
+
+uint8_t* Pbuf::append( size_t bytes )
+{
+    if( bytes > tailroom() ) {
+        return nullptr;
+    }
+    uint8_t* tail = data() + _len;
+    _len += bytes;
+    return tail;
+}
+
+bool Pbuf::set_len( size_t len )
+{
+    if( len > _size - _offset ) {
+        return false;
+    }
+    _len = len;
+    return true;
+}
+
+void Pbuf::reset( size_t headroom )
+{
+    _offset = static_cast<uint32_t>( std::min<size_t>( headroom, _size ) );
+    _len = 0;
+}
+
+PbufPool::PbufPool( size_t count, size_t buffer_size, size_t headroom )
+    : _count{ count }
+    , _buffer_size{ buffer_size }
+    , _headroom{ headroom }
+    , _free_head{ NONE }
+    , _available{ count }
+{
+    if( count == 0 || count >= NONE || headroom >= buffer_size || buffer_size > UINT32_MAX ) {
+        throw std::invalid_argument( "Invalid pbuf pool dimensions" );
+    }
+
+    _storage.reset( new uint8_t[ count * buffer_size ] );
+    _pbufs.reset( new Pbuf[ count ] );
+
+    // Chain every pbuf into the free list, lowest index on top
+    for( size_t i = 0; i < count; i++ ) {
+        auto& pbuf = _pbufs[ i ];
+        pbuf._pool      = this;
+        pbuf._buffer    = _storage.get() + i * buffer_size;
+        pbuf._size      = static_cast<uint32_t>( buffer_size );
+        pbuf._next.store( i + 1 < count ? static_cast<uint32_t>( i + 1 ) : NONE, std::memory_order_relaxed );
+    }
+    _free_head.store( 0, std::memory_order_release );
+}
+
+PbufPtr PbufPool::alloc()
+{
+    uint64_t head = _free_head.load( std::memory_order_acquire );
+    uint32_t index;
+    while( true ) {
+        index = static_cast<uint32_t>( head );
+        if( index == NONE ) {
+            return PbufPtr{};
+        }
+
+        // If another thread pops this entry first the tag has moved on and the exchange fails
+        uint64_t next = _pbufs[ index ]._next.load( std::memory_order_relaxed );
+        uint64_t new_head = ( ( ( head >> 32 ) + 1 ) << 32 ) | next;
+        if( _free_head.compare_exchange_weak( head, new_head, std::memory_order_acquire, std::memory_order_acquire ) ) {
+            break;
+        }
+    }
+    _available.fetch_sub( 1, std::memory_order_relaxed );
+
+    auto& pbuf = _pbufs[ index ];
+    pbuf.reset( _headroom );
+    pbuf._refs.store( 1, std::memory_order_relaxed );
+    return PbufPtr{ &pbuf };
+}
+
+void PbufPool::free( Pbuf* pbuf )
+{
+    uint32_t index = static_cast<uint32_t>( pbuf - _pbufs.get() );
+
+    uint64_t head = _free_head.load( std::memory_order_relaxed );
+    while( true ) {
+        pbuf->_next.store( static_cast<uint32_t>( head ), std::memory_order_relaxed );
+        uint64_t new_head = ( head & 0xffffffff00000000ull ) | index;
+        if( _free_head.compare_exchange_weak( head, new_head, std::memory_order_release, std::memory_order_relaxed ) ) {
+            break;
+        }
+    }
+    _available.fetch_add( 1, std::memory_order_relaxed );
+}
+
+}
+}
@@ -0,0 +1,32 @@
+#include "bm_core/pending_requests.hpp"
+
+#include <algorithm>
+
+namespace bm {
+namespace core {
+
+void PendingRequests::add( NodeId node_id )
+{
+    _pending.emplace( node_id, Pending{} );
+}
+
+void PendingRequests::send( Clock::time_point now, const Sender& sender )
+{
+    size_t sent = 0;
+    for( auto& pending : _pending ) {
+        if( sent >= MAX_REQUESTS_PER_UPDATE ) {
+            break;
+        }
+        if( pending.second.retry > now ) {
+            continue;
+        }
+        if( sender( pending.first ) ) {
+            sent++;
+        }
+        pending.second.retry    = now + pending.second.backoff;
+        pending.second.backoff  = std::min<Clock::duration>( pending.second.backoff * 2, MAX_REQUEST_BACKOFF );
+    }
+}
+
+}
+}
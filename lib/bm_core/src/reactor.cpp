@@ -0,0 +1,129 @@
+#include "bm_core/reactor.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <cstring>
+#include <limits>
+
+#include <spdlog/spdlog.h>
+
+namespace bm {
+namespace core {
+
+namespace {
+    constexpr uint64_t WAKEUP_KEY = std::numeric_limits<uint64_t>::max();
+}
+
+Reactor::Reactor( FrameHandler handler )
+    : _handler{ std::move( handler ) }
+    , _rx_storage( NetworkDevice::MAX_BATCH * NetworkDevice::BM_MAX_FRAME_SIZE )
+{
+    for( size_t i = 0; i < _rx_frames.size(); i++ ) {
+        _rx_frames[ i ] = { _rx_storage.data() + i * NetworkDevice::BM_MAX_FRAME_SIZE, NetworkDevice::BM_MAX_FRAME_SIZE, 0 };
+    }
+
+    _epoll_fd = ::epoll_create1( EPOLL_CLOEXEC );
+    if( _epoll_fd == -1 ) {
+        throw std::runtime_error( std::string( "epoll_create1 failed: " ) + std::strerror( errno ) );
+    }
+
+    _event_fd = ::eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+    if( _event_fd == -1 ) {
+        ::close( _epoll_fd );
+        throw std::runtime_error( std::string( "eventfd failed: " ) + std::strerror( errno ) );
+    }
+
+    epoll_event ev{};
+    ev.events   = EPOLLIN;
+    ev.data.u64 = WAKEUP_KEY;
+    if( ::epoll_ctl( _epoll_fd, EPOLL_CTL_ADD, _event_fd, &ev ) == -1 ) {
+        ::close( _event_fd );
+        ::close( _epoll_fd );
+        throw std::runtime_error( std::string( "epoll_ctl failed: " ) + std::strerror( errno ) );
+    }
+}
+
+Reactor::~Reactor()
+{
+    ::close( _event_fd );
+    ::close( _epoll_fd );
+}
+
+void Reactor::add( std::shared_ptr<NetworkDevice> dev )
+{
+    dev->set_nonblocking( true );
+
+    // Level triggered: a device left with frames after its budget is reported again on the next wait
+    epoll_event ev{};
+    ev.events   = EPOLLIN;
+    ev.data.u64 = _devices.size();
+    if( ::epoll_ctl( _epoll_fd, EPOLL_CTL_ADD, dev->fd(), &ev ) == -1 ) {
+        throw std::runtime_error( std::string( "epoll_ctl failed: " ) + std::strerror( errno ) );
+    }
+
+    _devices.emplace_back( std::move( dev ) );
+}
+
+void Reactor::run()
+{
+    epoll_event events[ MAX_EVENTS ];
+
+    while( !_stop ) {
+        int count = ::epoll_wait( _epoll_fd, events, MAX_EVENTS, -1 );
+        if( count == -1 ) {
+            if( errno == EINTR ) {
+                continue;
+            }
+            spdlog::error( "epoll_wait failed: {}", std::strerror( errno ) );
+            return;
+        }
+
+        for( int i = 0; i < count && !_stop; i++ ) {
+            if( events[ i ].data.u64 == WAKEUP_KEY ) {
+                uint64_t value;
+                while( ::read( _event_fd, &value, sizeof( value ) ) > 0 ) {}
+                continue;
+            }
+
+            drain( *_devices[ events[ i ].data.u64 ] );
+        }
+    }
+}
+
+void Reactor::stop()
+{
+    _stop = true;
+
+    uint64_t value = 1;
+    if( ::write( _event_fd, &value, sizeof( value ) ) == -1 ) {
+        spdlog::error( "Failed to wake reactor: {}", std::strerror( errno ) );
+    }
+}
+
+void Reactor::drain( NetworkDevice& dev )
+{
+    size_t handled = 0;
+    while( handled < RX_BUDGET ) {
+        ssize_t ret;
+        if( dev.zero_copy_rx() ) {
+            ret = dev.read_block( [&]( const FrameView& frame ){ _handler( dev, frame ); } );
+        }
+        else {
+            ret = dev.read_frames( _rx_frames.data(), _rx_frames.size() );
+            for( ssize_t i = 0; i < ret; i++ ) {
+                _handler( dev, FrameView{ _rx_frames[ i ].data, _rx_frames[ i ].len } );
+            }
+        }
+
+        if( ret <= 0 ) {
+            break;
+        }
+        handled += ret;
+    }
+}
+
+}
+}
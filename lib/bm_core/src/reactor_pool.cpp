@@ -0,0 +1,83 @@
+#include "bm_core/reactor_pool.hpp"
+#include "bm_core/network_interface.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+namespace bm {
+namespace core {
+
+ReactorPool::ReactorPool( NetworkInterface& net_if, const Reactor::FrameHandler& handler, bool pin_workers )
+    : _pin_workers{ pin_workers && net_if.rx_workers() > 1 }
+{
+    for( size_t worker = 0; worker < net_if.rx_workers(); worker++ ) {
+        auto reactor = std::make_unique<Reactor>( handler );
+        for( auto& dev : net_if.rx_devs( worker ) ) {
+            reactor->add( dev );
+        }
+        _reactors.emplace_back( std::move( reactor ) );
+    }
+}
+
+ReactorPool::~ReactorPool()
+{
+    stop();
+}
+
+void ReactorPool::start()
+{
+    for( size_t worker = 0; worker < _reactors.size(); worker++ ) {
+        _threads.emplace_back( [this, worker]{ _reactors[ worker ]->run(); } );
+        if( _pin_workers ) {
+            pin( _threads.back(), worker );
+        }
+    }
+}
+
+void ReactorPool::stop()
+{
+    for( auto& reactor : _reactors ) {
+        reactor->stop();
+    }
+    for( auto& thread : _threads ) {
+        if( thread.joinable() ) {
+            thread.join();
+        }
+    }
+    _threads.clear();
+}
+
+void ReactorPool::pin( std::thread& thread, size_t worker )
+{
+    // Respect an affinity mask the process was started with (taskset, cgroups)
+    cpu_set_t allowed;
+    if( sched_getaffinity( 0, sizeof( allowed ), &allowed ) == -1 ) {
+        spdlog::warn( "sched_getaffinity failed: {}", std::strerror( errno ) );
+        return;
+    }
+
+    size_t target = worker % CPU_COUNT( &allowed );
+    int cpu = 0;
+    for( size_t seen = 0; cpu < CPU_SETSIZE; cpu++ ) {
+        if( CPU_ISSET( cpu, &allowed ) && seen++ == target ) {
+            break;
+        }
+    }
+
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu, &set );
+    int ret = pthread_setaffinity_np( thread.native_handle(), sizeof( set ), &set );
+    if( ret != 0 ) {
+        spdlog::warn( "Failed to pin receive worker {} to CPU {}: {}", worker, cpu, std::strerror( ret ) );
+        return;
+    }
+    spdlog::info( "Receive worker {} pinned to CPU {}", worker, cpu );
+}
+
+}
+}
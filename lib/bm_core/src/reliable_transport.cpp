@@ -0,0 +1,294 @@
+#include "bm_core/reliable_transport.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+#include "bm_core/network_interface.hpp"
+
+namespace bm {
+namespace core {
+
+ReliableTransport::ReliableTransport( NetworkInterface& net )
+    : _net{ net }
+    , _timers{ TIMER_RESOLUTION, [this]( uint64_t peer ){ retransmit( peer ); } }
+{
+}
+
+bool ReliableTransport::next_seq( const in6_addr& dst, bcmp_reliable_header_t& header )
+{
+    if( IN6_IS_ADDR_MULTICAST( &dst ) ) {
+        errno = EINVAL;
+        return false;
+    }
+
+    NodeId peer = NetworkInterface::node_id_of( dst );
+    auto it = _tx_peers.find( peer );
+    if( it == _tx_peers.end() ) {
+        it = _tx_peers.emplace( peer, TxPeer{} ).first;
+        it->second.addr = dst;
+        it->second.base = it->second.next = _isn_rng();
+    }
+
+    TxPeer& tx = it->second;
+    if( tx.next - tx.base >= WINDOW ) {
+        errno = EAGAIN;
+        return false;
+    }
+
+    header.seq  = tx.next;
+    header.base = tx.base;
+    return true;
+}
+
+int ReliableTransport::send( const in6_addr& dst, uint8_t next_header, uint32_t seq, PbufPtr pbuf )
+{
+    NodeId peer = NetworkInterface::node_id_of( dst );
+    auto it = _tx_peers.find( peer );
+    if( it == _tx_peers.end() || it->second.next != seq || !pbuf ) {
+        errno = EINVAL;
+        return -1;
+    }
+    TxPeer& tx = it->second;
+
+    int ports = _net.bm_tx( *pbuf, next_header, dst, _net.egress_port( dst ) );
+
+    InFlight& slot = tx.window[ seq % WINDOW ];
+    slot.pbuf           = std::move( pbuf );
+    slot.sent           = Clock::now();
+    slot.next_header    = next_header;
+    slot.retries        = 0;
+    tx.next++;
+
+    if( tx.timer == TimerWheel::INVALID_TIMER ) {
+        rearm( peer, tx );
+    }
+    return std::max( ports, 0 );
+}
+
+bool ReliableTransport::receive( const in6_addr& src, const bcmp_reliable_header_t& header )
+{
+    NodeId peer = NetworkInterface::node_id_of( src );
+    std::lock_guard<std::mutex> lock( _rx_mutex );
+
+    auto it = _rx_peers.find( peer );
+    if( it == _rx_peers.end() ) {
+        it = _rx_peers.emplace( peer, RxPeer{} ).first;
+        it->second.addr     = src;
+        it->second.expected = header.base;
+    }
+    RxPeer& rx = it->second;
+
+    if( !rx.ack_pending ) {
+        rx.ack_pending = true;
+        _ack_pending.push_back( peer );
+    }
+
+    // Everything before the sender's base was delivered. A base far off in either direction is a new stream.
+    uint32_t ahead = header.base - rx.expected;
+    if( ahead >= RESYNC_DISTANCE && rx.expected - header.base >= RESYNC_DISTANCE ) {
+        rx.expected = header.base;
+        rx.received = 0;
+    }
+    else if( ahead > 0 && ahead < RESYNC_DISTANCE ) {
+        rx.received = ahead < WINDOW ? rx.received >> ahead : 0;
+        rx.expected = header.base;
+    }
+
+    // Behind the window it's a duplicate, unsigned wrap puts those far beyond it
+    uint32_t offset = header.seq - rx.expected;
+    if( offset >= WINDOW ) {
+        if( static_cast<int32_t>( offset ) < 0 ) {
+            _duplicates.fetch_add( 1, std::memory_order_relaxed );
+        }
+        return false;
+    }
+    if( rx.received & ( 1u << offset ) ) {
+        _duplicates.fetch_add( 1, std::memory_order_relaxed );
+        return false;
+    }
+
+    rx.received |= 1u << offset;
+    while( rx.received & 1 ) {
+        rx.received >>= 1;
+        rx.expected++;
+    }
+    return true;
+}
+
+void ReliableTransport::ack_received( const in6_addr& src, const bcmp_ack_t& ack )
+{
+    _acks.enqueue( AckEvent{ NetworkInterface::node_id_of( src ), ack, Clock::now() } );
+}
+
+void ReliableTransport::update( Clock::time_point now )
+{
+    AckEvent events[ 32 ];
+    size_t count;
+    while( ( count = _acks.try_dequeue_bulk( events, 32 ) ) > 0 ) {
+        for( size_t i = 0; i < count; i++ ) {
+            apply_ack( events[ i ] );
+        }
+    }
+
+    // Build the ACKs under the lock, send them after
+    {
+        std::lock_guard<std::mutex> lock( _rx_mutex );
+        for( NodeId peer : _ack_pending ) {
+            RxPeer& rx = _rx_peers.at( peer );
+            rx.ack_pending = false;
+            _outgoing_acks.emplace_back( rx.addr, bcmp_ack_t{ rx.expected, rx.received } );
+        }
+        _ack_pending.clear();
+    }
+    for( auto& ack : _outgoing_acks ) {
+        if( _net.send_bcmp_message( ack.first, BCMP_ACK, &ack.second, sizeof( ack.second ) ) < 0 ) {
+            spdlog::debug( "Failed to send BCMP ACK: {}", std::strerror( errno ) );
+        }
+    }
+    _outgoing_acks.clear();
+
+    _timers.advance( now );
+}
+
+uint32_t ReliableTransport::in_flight( const in6_addr& dst ) const
+{
+    auto it = _tx_peers.find( NetworkInterface::node_id_of( dst ) );
+    return it != _tx_peers.end() ? it->second.next - it->second.base : 0;
+}
+
+void ReliableTransport::apply_ack( const AckEvent& event )
+{
+    auto it = _tx_peers.find( event.peer );
+    if( it == _tx_peers.end() ) {
+        return;
+    }
+    TxPeer& tx = it->second;
+
+    // Stale or bogus, the cumulative ACK must fall within what was sent
+    uint32_t cumulative = event.ack.cumulative_seq;
+    if( cumulative - tx.base > tx.next - tx.base ) {
+        return;
+    }
+
+    // Karn's algorithm: only messages sent once give an unambiguous round trip
+    Clock::time_point newest{};
+    bool sampled = false;
+    auto acknowledge = [&]( InFlight& slot ){
+        if( !slot.pbuf ) {
+            return;
+        }
+        if( slot.retries == 0 && slot.sent > newest ) {
+            newest = slot.sent;
+            sampled = true;
+        }
+        slot.pbuf.reset();
+    };
+
+    for( ; tx.base != cumulative; tx.base++ ) {
+        acknowledge( tx.window[ tx.base % WINDOW ] );
+    }
+    for( uint32_t i = 0; i < WINDOW; i++ ) {
+        uint32_t seq = cumulative + i;
+        if( ( event.ack.sack_bitmap & ( 1u << i ) ) && seq - tx.base < tx.next - tx.base ) {
+            acknowledge( tx.window[ seq % WINDOW ] );
+        }
+    }
+
+    if( sampled ) {
+        rtt_sample( tx, event.time - newest );
+    }
+    rearm( event.peer, tx );
+}
+
+void ReliableTransport::retransmit( NodeId peer )
+{
+    auto it = _tx_peers.find( peer );
+    if( it == _tx_peers.end() ) {
+        return;
+    }
+    TxPeer& tx = it->second;
+    tx.timer = TimerWheel::INVALID_TIMER;
+
+    auto now = Clock::now();
+    bool resent = false;
+    for( uint32_t seq = tx.base; seq != tx.next; seq++ ) {
+        InFlight& slot = tx.window[ seq % WINDOW ];
+        if( !slot.pbuf || slot.sent + tx.rto > now ) {
+            continue;
+        }
+
+        // Give up on the peer. Its state goes too, so the next message starts a new stream.
+        if( slot.retries >= MAX_RETRIES ) {
+            uint32_t lost = 0;
+            for( uint32_t s = tx.base; s != tx.next; s++ ) {
+                lost += tx.window[ s % WINDOW ].pbuf ? 1 : 0;
+            }
+            spdlog::warn( "Reliable delivery to {:016x} failed, dropping {} messages", peer, lost );
+            _failures += lost;
+            _tx_peers.erase( it );
+            return;
+        }
+
+        _net.bm_tx( *slot.pbuf, slot.next_header, tx.addr, _net.egress_port( tx.addr ) );
+        slot.retries++;
+        slot.sent = now;
+        _retransmits++;
+        resent = true;
+    }
+
+    // Exponential backoff until a clean round trip is measured again
+    if( resent ) {
+        tx.rto = std::min<Clock::duration>( tx.rto * 2, MAX_RTO );
+    }
+    rearm( peer, tx );
+}
+
+void ReliableTransport::rearm( NodeId peer, TxPeer& tx )
+{
+    // One timer per peer, for whichever unacknowledged message times out first
+    bool pending = false;
+    Clock::time_point oldest = Clock::time_point::max();
+    for( uint32_t seq = tx.base; seq != tx.next; seq++ ) {
+        const InFlight& slot = tx.window[ seq % WINDOW ];
+        if( slot.pbuf ) {
+            oldest = std::min( oldest, slot.sent );
+            pending = true;
+        }
+    }
+
+    if( !pending ) {
+        if( tx.timer != TimerWheel::INVALID_TIMER ) {
+            _timers.cancel( tx.timer );
+            tx.timer = TimerWheel::INVALID_TIMER;
+        }
+        return;
+    }
+
+    auto expiry = oldest + tx.rto;
+    if( tx.timer == TimerWheel::INVALID_TIMER || !_timers.reschedule( tx.timer, expiry ) ) {
+        tx.timer = _timers.schedule( peer, expiry );
+    }
+}
+
+void ReliableTransport::rtt_sample( TxPeer& tx, Clock::duration rtt )
+{
+    // RFC 6298 section 2
+    if( tx.srtt == Clock::duration::zero() ) {
+        tx.srtt     = rtt;
+        tx.rttvar   = rtt / 2;
+    }
+    else {
+        auto error  = tx.srtt > rtt ? tx.srtt - rtt : rtt - tx.srtt;
+        tx.rttvar   = ( tx.rttvar * 3 + error ) / 4;
+        tx.srtt     = ( tx.srtt * 7 + rtt ) / 8;
+    }
+
+    Clock::duration variance = std::max<Clock::duration>( TIMER_RESOLUTION, tx.rttvar * 4 );
+    tx.rto = std::clamp<Clock::duration>( tx.srtt + variance, MIN_RTO, MAX_RTO );
+}
+
+}
+}
@@ -0,0 +1,383 @@
+#include "bm_core/resource_table.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <random>
+
+#include <spdlog/spdlog.h>
+
+#include "bm_core/network_interface.hpp"
+
+namespace bm {
+namespace core {
+
+// Room for resources in one message
+static constexpr size_t CHUNK_BYTES = NetworkDevice::BM_MTU - sizeof( ip6_hdr ) - sizeof( bcmp_header_t ) -
+                                      sizeof( bcmp_resource_table_reply_t );
+
+ResourceTable::ResourceTable( NetworkInterface& net, const Topology& topology )
+    : _net{ net }
+    , _topology{ topology }
+    , _node_id{ net.node_id() }
+    , _epoch{ std::random_device{}() }
+    , _published{ std::make_shared<const Index>() }
+{
+    _net.bcmp().register_handler<bcmp_resource_table_request_t>( BCMP_RESOURCE_TABLE_REQUEST, [this]( const BcmpMessage& msg, const bcmp_resource_table_request_t& request ){
+        handle_request( msg, request );
+    });
+    _net.bcmp().register_handler<bcmp_resource_table_reply_t>( BCMP_RESOURCE_TABLE_REPLY, [this]( const BcmpMessage& msg, const bcmp_resource_table_reply_t& reply ){
+        handle_reply( msg, reply );
+    });
+}
+
+bool ResourceTable::add( std::string_view name, uint8_t flags )
+{
+    if( name.empty() || name.size() > MAX_NAME_LEN ) {
+        return false;
+    }
+
+    std::string key( name );
+    auto it = _local.find( key );
+    uint8_t current = it != _local.end() ? it->second.flags : 0;
+    if( ( current | flags ) != current ) {
+        set_local( key, current | flags );
+    }
+    return true;
+}
+
+void ResourceTable::remove( std::string_view name, uint8_t flags )
+{
+    auto it = _local.find( std::string( name ) );
+    if( it != _local.end() && ( it->second.flags & flags ) ) {
+        set_local( it->first, it->second.flags & ~flags );
+    }
+}
+
+void ResourceTable::set_local( const std::string& name, uint8_t flags )
+{
+    _version++;
+    _local[ name ] = LocalResource{ flags, _version };
+    set_holder( name, _node_id, flags );
+
+    if( flags != 0 ) {
+        return;
+    }
+
+    // Removals stay in the table as tombstones for peers catching up, up to a point. A peer older than the last one
+    // forgotten gets the full table instead.
+    _tombstones.emplace_back( _version, name );
+    if( _tombstones.size() > MAX_TOMBSTONES ) {
+        auto& oldest = _tombstones.front();
+        auto it = _local.find( oldest.second );
+        if( it != _local.end() && it->second.flags == 0 && it->second.version == oldest.first ) {
+            _local.erase( it );
+        }
+        _forgotten = oldest.first;
+        _tombstones.pop_front();
+    }
+}
+
+void ResourceTable::handle_request( const BcmpMessage& msg, const bcmp_resource_table_request_t& request )
+{
+    if( request.target_node_id == 0 || request.target_node_id == _node_id ) {
+        _requests.enqueue( Request{ msg.ip6.ip6_src, request } );
+    }
+}
+
+void ResourceTable::handle_reply( const BcmpMessage& msg, const bcmp_resource_table_reply_t& reply )
+{
+    if( reply.node_id == _node_id ) {
+        return;
+    }
+
+    Chunk chunk{ reply, {} };
+    chunk.resources.reserve( reply.resource_count );
+
+    size_t offset = sizeof( reply );
+    for( size_t i = 0; i < reply.resource_count; i++ ) {
+        bcmp_resource_t resource;
+        if( msg.len < offset + sizeof( resource ) ) {
+            break;
+        }
+        std::memcpy( &resource, msg.payload + offset, sizeof( resource ) );
+        offset += sizeof( resource );
+        if( msg.len < offset + resource.name_len ) {
+            break;
+        }
+        chunk.resources.emplace_back( std::string( reinterpret_cast<const char*>( msg.payload + offset ), resource.name_len ), resource.flags );
+        offset += resource.name_len;
+    }
+
+    if( chunk.resources.size() != reply.resource_count || offset != msg.len || reply.chunk >= reply.chunks ) {
+        spdlog::debug( "Malformed resource table from {:016x}", reply.node_id );
+        return;
+    }
+    _chunks.enqueue( std::move( chunk ) );
+}
+
+void ResourceTable::update( Clock::time_point now )
+{
+    // Whatever changed since the last announcement, in one go
+    if( _announced != _version ) {
+        send_table( NetworkInterface::ALL_NODES_REALM_LOCAL, _announced, _announced < _forgotten );
+        _announced = _version;
+    }
+
+    Request requests[ 16 ];
+    size_t count;
+    while( ( count = _requests.try_dequeue_bulk( requests, 16 ) ) > 0 ) {
+        for( size_t i = 0; i < count; i++ ) {
+            const auto& request = requests[ i ].request;
+            bool full = ( request.flags & BCMP_RESOURCE_TABLE_FULL ) || request.epoch != _epoch ||
+                        request.version < _forgotten || request.version > _version;
+            send_table( requests[ i ].src, request.version, full );
+        }
+    }
+
+    if( _topology.snapshot() != _topology_seen ) {
+        sync_peers();
+    }
+
+    Chunk chunk;
+    while( _chunks.try_dequeue( chunk ) ) {
+        receive( chunk, now );
+    }
+
+    send_requests( now );
+
+    if( _dirty ) {
+        std::atomic_store_explicit( &_published, Snapshot{ std::make_shared<const Index>( _index ) }, std::memory_order_release );
+        _dirty = false;
+    }
+}
+
+void ResourceTable::sync_peers()
+{
+    _topology_seen = _topology.snapshot();
+
+    for( auto it = _peers.begin(); it != _peers.end(); ) {
+        if( _topology_seen->count( it->first ) ) {
+            ++it;
+            continue;
+        }
+        for( const auto& resource : it->second.resources ) {
+            set_holder( resource.first, it->first, 0 );
+        }
+        _pending.remove( it->first );
+        it = _peers.erase( it );
+    }
+
+    // New nodes start out unknown, which has them asked for their full table
+    for( const auto& node : *_topology_seen ) {
+        if( node.first != _node_id ) {
+            _peers.emplace( node.first, Peer{} );
+        }
+    }
+}
+
+void ResourceTable::receive( Chunk& chunk, Clock::time_point now )
+{
+    const auto& header = chunk.header;
+
+    // Peers only come from the topology, a node we cannot see in the graph (yet) is not synchronized with
+    auto it = _peers.find( header.node_id );
+    if( it == _peers.end() ) {
+        return;
+    }
+    Peer& peer = it->second;
+
+    // The newest version we heard of, that we are behind as long as we don't hold it
+    if( header.epoch != peer.latest_epoch || header.version > peer.latest_version ) {
+        peer.latest_epoch   = header.epoch;
+        peer.latest_version = header.version;
+    }
+
+    Assembly& assembly = peer.assembly;
+    const auto& current = assembly.header;
+    if( current.epoch != header.epoch || current.base_version != header.base_version || current.version != header.version ||
+        current.flags != header.flags || current.chunks != header.chunks || assembly.received.none() ) {
+        assembly.header = header;
+        assembly.received.reset();
+        assembly.resources.clear();
+    }
+    if( assembly.received.test( header.chunk ) ) {
+        return;
+    }
+    assembly.received.set( header.chunk );
+    std::move( chunk.resources.begin(), chunk.resources.end(), std::back_inserter( assembly.resources ) );
+
+    if( assembly.received.count() == header.chunks ) {
+        apply( header.node_id, peer, now );
+        assembly.received.reset();
+        assembly.resources.clear();
+    }
+}
+
+void ResourceTable::apply( NodeId node_id, Peer& peer, Clock::time_point now )
+{
+    const auto& header = peer.assembly.header;
+
+    if( header.flags & BCMP_RESOURCE_TABLE_FULL ) {
+        if( peer.known && peer.epoch == header.epoch && header.version < peer.version ) {
+            return;
+        }
+
+        std::unordered_map<std::string, uint8_t> resources;
+        for( auto& resource : peer.assembly.resources ) {
+            if( resource.second != 0 ) {
+                resources[ std::move( resource.first ) ] = resource.second;
+            }
+        }
+        for( const auto& resource : peer.resources ) {
+            if( !resources.count( resource.first ) ) {
+                set_holder( resource.first, node_id, 0 );
+            }
+        }
+        for( const auto& resource : resources ) {
+            set_holder( resource.first, node_id, resource.second );
+        }
+        peer.resources = std::move( resources );
+    }
+    else {
+        // A delta holds the current state of everything changed after its base, so it applies on top of any version
+        // from the base on, but must not take back anything newer
+        if( !peer.known || peer.epoch != header.epoch || header.base_version > peer.version || header.version < peer.version ) {
+            return;
+        }
+        for( auto& resource : peer.assembly.resources ) {
+            set_holder( resource.first, node_id, resource.second );
+            if( resource.second != 0 ) {
+                peer.resources[ std::move( resource.first ) ] = resource.second;
+            }
+            else {
+                peer.resources.erase( resource.first );
+            }
+        }
+    }
+
+    peer.known      = true;
+    peer.epoch      = header.epoch;
+    peer.version    = header.version;
+    peer.synced     = now;
+    _pending.remove( node_id );
+}
+
+void ResourceTable::send_requests( Clock::time_point now )
+{
+    for( const auto& entry : _peers ) {
+        const Peer& peer = entry.second;
+        bool behind = !peer.known || peer.epoch != peer.latest_epoch || peer.version < peer.latest_version;
+        if( behind || now - peer.synced >= PendingRequests::REFRESH_INTERVAL ) {
+            _pending.add( entry.first );
+        }
+    }
+
+    _pending.send( now, [this]( NodeId node_id ){ return send_request( node_id ); } );
+}
+
+bool ResourceTable::send_request( NodeId node_id )
+{
+    const Peer& peer = _peers.at( node_id );
+    bcmp_resource_table_request_t request{};
+    request.target_node_id  = node_id;
+    request.epoch           = peer.epoch;
+    request.version         = peer.version;
+    request.flags           = peer.known ? 0 : BCMP_RESOURCE_TABLE_FULL;
+    if( _net.send_bcmp_message( NetworkInterface::unique_local_address( node_id ), BCMP_RESOURCE_TABLE_REQUEST, &request, sizeof( request ) ) < 0 ) {
+        spdlog::debug( "Failed to request the resource table of {:016x}: {}", node_id, std::strerror( errno ) );
+        return false;
+    }
+    return true;
+}
+
+void ResourceTable::send_table( const in6_addr& dst, uint32_t base, bool full )
+{
+    std::vector<const std::pair<const std::string, LocalResource>*> resources;
+    for( const auto& resource : _local ) {
+        if( full ? resource.second.flags != 0 : resource.second.version > base ) {
+            resources.push_back( &resource );
+        }
+    }
+
+    // Split where the next resource would not fit. There is always a first chunk, an empty delta still tells the peer
+    // it is up to date.
+    std::vector<size_t> splits{ 0 };
+    size_t bytes = 0;
+    for( size_t i = 0; i < resources.size(); i++ ) {
+        size_t len = sizeof( bcmp_resource_t ) + resources[ i ]->first.size();
+        if( bytes + len > CHUNK_BYTES ) {
+            splits.push_back( i );
+            bytes = 0;
+        }
+        bytes += len;
+    }
+    splits.push_back( resources.size() );
+
+    size_t chunks = splits.size() - 1;
+    if( chunks > UINT8_MAX ) {
+        spdlog::error( "Resource table too large to send, {} messages", chunks );
+        return;
+    }
+
+    uint8_t buffer[ sizeof( bcmp_resource_table_reply_t ) + CHUNK_BYTES ];
+    for( size_t c = 0; c < chunks; c++ ) {
+        bcmp_resource_table_reply_t reply{};
+        reply.node_id           = _node_id;
+        reply.epoch             = _epoch;
+        reply.base_version      = full ? 0 : base;
+        reply.version           = _version;
+        reply.flags             = full ? BCMP_RESOURCE_TABLE_FULL : 0;
+        reply.chunk             = static_cast<uint8_t>( c );
+        reply.chunks            = static_cast<uint8_t>( chunks );
+        reply.resource_count    = static_cast<uint16_t>( splits[ c + 1 ] - splits[ c ] );
+        std::memcpy( buffer, &reply, sizeof( reply ) );
+
+        size_t len = sizeof( reply );
+        for( size_t i = splits[ c ]; i < splits[ c + 1 ]; i++ ) {
+            const auto& name = resources[ i ]->first;
+            bcmp_resource_t resource{ resources[ i ]->second.flags, static_cast<uint8_t>( name.size() ) };
+            std::memcpy( buffer + len, &resource, sizeof( resource ) );
+            std::memcpy( buffer + len + sizeof( resource ), name.data(), name.size() );
+            len += sizeof( resource ) + name.size();
+        }
+
+        if( _net.send_bcmp_message( dst, BCMP_RESOURCE_TABLE_REPLY, buffer, len ) < 0 ) {
+            spdlog::debug( "Failed to send the resource table: {}", std::strerror( errno ) );
+        }
+    }
+    ( full ? _full_tables_sent : _deltas_sent )++;
+}
+
+void ResourceTable::set_holder( const std::string& name, NodeId node_id, uint8_t flags )
+{
+    auto it = _index.find( name );
+    Holders holders;
+    if( it != _index.end() ) {
+        holders = *it->second;
+    }
+
+    auto holder = std::find_if( holders.begin(), holders.end(), [node_id]( const ResourceHolder& h ){ return h.node_id == node_id; } );
+    if( holder != holders.end() ? holder->flags == flags : flags == 0 ) {
+        return;
+    }
+    if( holder != holders.end() ) {
+        holders.erase( holder );
+    }
+    if( flags != 0 ) {
+        holders.push_back( ResourceHolder{ node_id, flags } );
+    }
+
+    // Snapshots share the holders of every name that did not change
+    if( holders.empty() ) {
+        _index.erase( name );
+    }
+    else {
+        _index[ name ] = std::make_shared<const Holders>( std::move( holders ) );
+    }
+    _dirty = true;
+}
+
+}
+}
@@ -0,0 +1,218 @@
+#include "bm_core/timer_wheel.hpp"
+
+#include <stdexcept>
+
+namespace bm {
+namespace core {
+
+TimerWheel::TimerWheel( Clock::duration resolution, ExpiryHandler handler, Clock::time_point start )
+    : _resolution{ resolution }
+    , _handler{ std::move( handler ) }
+    , _start{ start }
+{
+    if( resolution <= Clock::duration::zero() ) {
+        throw std::invalid_argument( "Timer wheel resolution must be positive" );
+    }
+    _buckets.fill( NONE );
+}
+
+uint64_t TimerWheel::to_tick( Clock::time_point time, bool round_up ) const
+{
+    if( time <= _start ) {
+        return 0;
+    }
+    auto elapsed = time - _start;
+    if( round_up ) {
+        elapsed += _resolution - Clock::duration( 1 );
+    }
+    return static_cast<uint64_t>( elapsed / _resolution );
+}
+
+TimerWheel::Timer* TimerWheel::lookup( TimerId id )
+{
+    uint32_t index = static_cast<uint32_t>( id );
+    if( index >= _timers.size() ) {
+        return nullptr;
+    }
+    Timer& timer = _timers[ index ];
+    if( timer.generation != static_cast<uint32_t>( id >> 32 ) || timer.bucket == NONE ) {
+        return nullptr;
+    }
+    return &timer;
+}
+
+TimerWheel::TimerId TimerWheel::schedule( uint64_t key, Clock::time_point expiry )
+{
+    uint32_t index;
+    if( _free != NONE ) {
+        index = _free;
+        _free = _timers[ index ].next;
+    }
+    else {
+        index = static_cast<uint32_t>( _timers.size() );
+        _timers.emplace_back();
+    }
+
+    Timer& timer = _timers[ index ];
+    timer.key       = key;
+    timer.expiry    = to_tick( expiry, true );
+    place( index );
+    _active++;
+
+    return ( static_cast<uint64_t>( timer.generation ) << 32 ) | index;
+}
+
+bool TimerWheel::reschedule( TimerId id, Clock::time_point expiry )
+{
+    Timer* timer = lookup( id );
+    if( !timer ) {
+        return false;
+    }
+
+    uint32_t index = static_cast<uint32_t>( id );
+    unlink( index );
+    timer->expiry = to_tick( expiry, true );
+    place( index );
+    return true;
+}
+
+bool TimerWheel::cancel( TimerId id )
+{
+    if( !lookup( id ) ) {
+        return false;
+    }
+
+    uint32_t index = static_cast<uint32_t>( id );
+    unlink( index );
+    release( index );
+    return true;
+}
+
+size_t TimerWheel::advance( Clock::time_point now )
+{
+    // Only ticks that have fully passed run
+    uint64_t target = to_tick( now, false );
+    size_t fired = 0;
+
+    while( _now < target ) {
+        // Nothing to run, skip straight to the end
+        if( _active == 0 ) {
+            _now = target;
+            break;
+        }
+
+        _now++;
+
+        // Each wrap of a level pulls the next slot of the level above down, highest level first so timers can fall
+        // through more than one level on the same tick
+        size_t levels = 0;
+        while( levels + 1 < LEVELS && ( _now & ( ( 1ull << ( SLOT_BITS * ( levels + 1 ) ) ) - 1 ) ) == 0 ) {
+            levels++;
+        }
+        for( size_t level = levels; level > 0; level-- ) {
+            cascade( level );
+        }
+
+        uint32_t& head = _buckets[ _now & ( SLOTS - 1 ) ];
+        while( head != NONE ) {
+            uint32_t index = head;
+            unlink( index );
+
+            // Parked beyond the reach of the wheel
+            if( _timers[ index ].expiry > _now ) {
+                place( index );
+                continue;
+            }
+
+            uint64_t key = _timers[ index ].key;
+            release( index );
+            _handler( key );
+            fired++;
+        }
+    }
+
+    return fired;
+}
+
+void TimerWheel::place( uint32_t index )
+{
+    Timer& timer = _timers[ index ];
+
+    // Due timers go in the next slot, the current one has already run
+    uint64_t expiry = timer.expiry > _now ? timer.expiry : _now + 1;
+    uint64_t delta = expiry - _now;
+    if( delta > MAX_DELTA ) {
+        expiry = _now + MAX_DELTA;
+        delta = MAX_DELTA;
+    }
+
+    size_t level = 0;
+    while( level + 1 < LEVELS && delta >= ( 1ull << ( SLOT_BITS * ( level + 1 ) ) ) ) {
+        level++;
+    }
+
+    uint32_t slot = static_cast<uint32_t>( ( expiry >> ( SLOT_BITS * level ) ) & ( SLOTS - 1 ) );
+    link( index, static_cast<uint32_t>( level * SLOTS + slot ) );
+}
+
+void TimerWheel::cascade( size_t level )
+{
+    uint32_t& head = _buckets[ level * SLOTS + ( ( _now >> ( SLOT_BITS * level ) ) & ( SLOTS - 1 ) ) ];
+    uint32_t index = head;
+    head = NONE;
+
+    while( index != NONE ) {
+        uint32_t next = _timers[ index ].next;
+        _timers[ index ].bucket = NONE;
+
+        // Due on this very tick, whose slot is about to run
+        if( _timers[ index ].expiry <= _now ) {
+            link( index, static_cast<uint32_t>( _now & ( SLOTS - 1 ) ) );
+        }
+        else {
+            place( index );
+        }
+        index = next;
+    }
+}
+
+void TimerWheel::link( uint32_t index, uint32_t bucket )
+{
+    Timer& timer = _timers[ index ];
+    timer.bucket    = bucket;
+    timer.prev      = NONE;
+    timer.next      = _buckets[ bucket ];
+    if( timer.next != NONE ) {
+        _timers[ timer.next ].prev = index;
+    }
+    _buckets[ bucket ] = index;
+}
+
+void TimerWheel::unlink( uint32_t index )
+{
+    Timer& timer = _timers[ index ];
+    if( timer.prev != NONE ) {
+        _timers[ timer.prev ].next = timer.next;
+    }
+    else {
+        _buckets[ timer.bucket ] = timer.next;
+    }
+    if( timer.next != NONE ) {
+        _timers[ timer.next ].prev = timer.prev;
+    }
+    timer.bucket = NONE;
+}
+
+void TimerWheel::release( uint32_t index )
+{
+    Timer& timer = _timers[ index ];
+    if( ++timer.generation == 0 ) {
+        timer.generation = 1;
+    }
+    timer.next = _free;
+    _free = index;
+    _active--;
+}
+
+}
+}
@@ -0,0 +1,235 @@
+#include "bm_core/topology.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <unordered_set>
+
+#include <spdlog/spdlog.h>
+
+#include "bm_core/network_interface.hpp"
+
+namespace bm {
+namespace core {
+
+// As many neighbors as fit in one message
+static constexpr size_t MAX_LINKS = ( NetworkDevice::BM_MTU - sizeof( ip6_hdr ) - sizeof( bcmp_header_t ) -
+                                      sizeof( bcmp_neighbor_table_reply_t ) ) / sizeof( bcmp_neighbor_info_t );
+
+Topology::Topology( NetworkInterface& net )
+    : _net{ net }
+    , _node_id{ net.node_id() }
+    , _local_version{ std::random_device{}() }
+    , _published{ std::make_shared<const Graph>() }
+{
+    _net.bcmp().register_handler<bcmp_neighbor_table_request_t>( BCMP_NEIGHBOR_TABLE_REQUEST, [this]( const BcmpMessage& msg, const bcmp_neighbor_table_request_t& request ){
+        handle_request( msg, request );
+    });
+    _net.bcmp().register_handler<bcmp_neighbor_table_reply_t>( BCMP_NEIGHBOR_TABLE_REPLY, [this]( const BcmpMessage& msg, const bcmp_neighbor_table_reply_t& reply ){
+        handle_reply( msg, reply );
+    });
+}
+
+void Topology::handle_request( const BcmpMessage& msg, const bcmp_neighbor_table_request_t& request )
+{
+    if( request.target_node_id == 0 || request.target_node_id == _node_id ) {
+        _requesters.enqueue( msg.ip6.ip6_src );
+    }
+}
+
+void Topology::handle_reply( const BcmpMessage& msg, const bcmp_neighbor_table_reply_t& reply )
+{
+    size_t count = reply.neighbor_count;
+    if( msg.len != sizeof( reply ) + count * sizeof( bcmp_neighbor_info_t ) ) {
+        spdlog::debug( "Malformed neighbor table from {:016x}, {} neighbors in {} bytes", reply.node_id, count, msg.len );
+        return;
+    }
+
+    Report report{ reply.node_id, reply.version, !IN6_IS_ADDR_MULTICAST( &msg.ip6.ip6_dst ), {} };
+    report.links.reserve( count );
+    for( size_t i = 0; i < count; i++ ) {
+        bcmp_neighbor_info_t info;
+        std::memcpy( &info, msg.payload + sizeof( reply ) + i * sizeof( info ), sizeof( info ) );
+        report.links.push_back( TopologyLink{ info.node_id, info.port } );
+    }
+    _reports.enqueue( std::move( report ) );
+}
+
+void Topology::update( Clock::time_point now )
+{
+    if( _local_changed ) {
+        _local_changed = false;
+        update_local( now );
+    }
+
+    in6_addr requesters[ 16 ];
+    size_t count;
+    while( ( count = _requesters.try_dequeue_bulk( requesters, 16 ) ) > 0 ) {
+        for( size_t i = 0; i < count; i++ ) {
+            send_table( requesters[ i ] );
+        }
+    }
+
+    Report report;
+    while( _reports.try_dequeue( report ) ) {
+        merge( report, now );
+    }
+
+    if( _dirty ) {
+        prune();
+    }
+    send_requests( now );
+
+    if( _dirty ) {
+        std::atomic_store_explicit( &_published, Snapshot{ std::make_shared<const Graph>( _graph ) }, std::memory_order_release );
+        _dirty = false;
+    }
+}
+
+void Topology::update_local( Clock::time_point now )
+{
+    auto neighbors = _net.neighbors().snapshot();
+
+    std::vector<TopologyLink> links;
+    links.reserve( neighbors->size() );
+    for( const auto& entry : *neighbors ) {
+        links.push_back( TopologyLink{ entry.node_id, entry.local_ingress_port } );
+    }
+    std::sort( links.begin(), links.end(), []( const TopologyLink& a, const TopologyLink& b ){ return a.neighbor < b.neighbor; } );
+
+    // Nothing to announce when a neighbor came back on the same port before we published it as gone
+    if( links == _local_links && _graph.count( _node_id ) ) {
+        return;
+    }
+    _local_links = std::move( links );
+    _local_version++;
+
+    _graph[ _node_id ] = std::make_shared<const TopologyNode>( TopologyNode{ _node_id, _local_version, _local_links, now } );
+    _dirty = true;
+
+    send_table( NetworkInterface::ALL_NODES_REALM_LOCAL );
+    _announcements++;
+}
+
+void Topology::merge( Report& report, Clock::time_point now )
+{
+    if( report.node_id == _node_id ) {
+        return;
+    }
+
+    // Announcements may arrive out of order. A node that restarted starts from a new random version, which its next
+    // answer to a refresh request makes current again.
+    auto it = _graph.find( report.node_id );
+    if( it != _graph.end() && !report.solicited && static_cast<int32_t>( report.version - it->second->version ) <= 0 ) {
+        return;
+    }
+
+    _pending.remove( report.node_id );
+    _graph[ report.node_id ] = std::make_shared<const TopologyNode>( TopologyNode{ report.node_id, report.version, std::move( report.links ), now } );
+    _dirty = true;
+}
+
+void Topology::prune()
+{
+    // Whatever can't be reached through the links nodes report left the network
+    std::unordered_set<NodeId> reachable;
+    std::deque<NodeId> queue{ _node_id };
+    reachable.insert( _node_id );
+    while( !queue.empty() ) {
+        auto it = _graph.find( queue.front() );
+        queue.pop_front();
+        if( it == _graph.end() ) {
+            continue;
+        }
+        for( const auto& link : it->second->links ) {
+            if( reachable.insert( link.neighbor ).second ) {
+                queue.push_back( link.neighbor );
+            }
+        }
+    }
+
+    for( auto it = _graph.begin(); it != _graph.end(); ) {
+        if( !reachable.count( it->first ) ) {
+            spdlog::info( "Node {:016x} left the network", it->first );
+            it = _graph.erase( it );
+        }
+        else {
+            ++it;
+        }
+    }
+    _pending.remove_if( [this]( NodeId node_id ){ return !is_neighbor( node_id ); } );
+
+    // Neighbors not known yet are asked directly. Nodes further away can't be asked, they are only known by the
+    // links to them.
+    for( const auto& link : _local_links ) {
+        if( !_graph.count( link.neighbor ) ) {
+            _pending.add( link.neighbor );
+        }
+    }
+}
+
+bool Topology::is_neighbor( NodeId node_id ) const
+{
+    // Sorted by neighbor
+    auto it = std::lower_bound( _local_links.begin(), _local_links.end(), node_id, []( const TopologyLink& link, NodeId id ){
+        return link.neighbor < id;
+    });
+    return it != _local_links.end() && it->neighbor == node_id;
+}
+
+void Topology::send_requests( Clock::time_point now )
+{
+    // Entries that went quiet for a long time are asked again
+    if( now >= _next_refresh ) {
+        _next_refresh = now + PendingRequests::REQUEST_TIMEOUT;
+        for( const auto& node : _graph ) {
+            if( is_neighbor( node.first ) && now - node.second->updated >= PendingRequests::REFRESH_INTERVAL ) {
+                _pending.add( node.first );
+            }
+        }
+    }
+
+    _pending.send( now, [this]( NodeId node_id ){ return send_request( node_id ); } );
+}
+
+bool Topology::send_request( NodeId node_id )
+{
+    bcmp_neighbor_table_request_t request{ node_id };
+    // Only neighbors are asked, the unique local address reaches them on whichever port they were heard
+    if( _net.send_bcmp_message( NetworkInterface::unique_local_address( node_id ), BCMP_NEIGHBOR_TABLE_REQUEST, &request, sizeof( request ) ) < 0 ) {
+        spdlog::debug( "Failed to request the neighbor table of {:016x}: {}", node_id, std::strerror( errno ) );
+        return false;
+    }
+    _requests_sent++;
+    return true;
+}
+
+void Topology::send_table( const in6_addr& dst )
+{
+    uint8_t buffer[ sizeof( bcmp_neighbor_table_reply_t ) + MAX_LINKS * sizeof( bcmp_neighbor_info_t ) ];
+
+    size_t count = std::min( _local_links.size(), MAX_LINKS );
+    if( count < _local_links.size() ) {
+        spdlog::warn( "Neighbor table truncated to {} of {} neighbors", count, _local_links.size() );
+    }
+
+    bcmp_neighbor_table_reply_t reply{};
+    reply.node_id           = _node_id;
+    reply.version           = _local_version;
+    reply.neighbor_count    = static_cast<uint16_t>( count );
+    std::memcpy( buffer, &reply, sizeof( reply ) );
+
+    for( size_t i = 0; i < count; i++ ) {
+        bcmp_neighbor_info_t info{ _local_links[ i ].neighbor, _local_links[ i ].port };
+        std::memcpy( buffer + sizeof( reply ) + i * sizeof( info ), &info, sizeof( info ) );
+    }
+
+    size_t len = sizeof( reply ) + count * sizeof( bcmp_neighbor_info_t );
+    if( _net.send_bcmp_message( dst, BCMP_NEIGHBOR_TABLE_REPLY, buffer, len ) < 0 ) {
+        spdlog::debug( "Failed to send the neighbor table: {}", std::strerror( errno ) );
+    }
+}
+
+}
+}
@@ -0,0 +1,57 @@
+#include "bm_core/udp_demux.hpp"
+
+#include <spdlog/spdlog.h>
+
+namespace bm {
+namespace core {
+
+UdpDemux::UdpDemux()
+    : _slots{ new uint8_t[ PORT_COUNT ]() }
+{
+}
+
+bool UdpDemux::bind( uint16_t port, Handler handler )
+{
+    if( port == 0 || !handler ) {
+        spdlog::error( "Can not bind UDP port {}", port );
+        return false;
+    }
+    if( _slots[ port ] != 0 ) {
+        spdlog::error( "UDP port {} is already bound", port );
+        return false;
+    }
+
+    for( size_t i = 0; i < MAX_BINDINGS; i++ ) {
+        if( !_handlers[ i ] ) {
+            _handlers[ i ] = std::move( handler );
+            _slots[ port ] = static_cast<uint8_t>( i + 1 );
+            return true;
+        }
+    }
+
+    spdlog::error( "No free UDP binding for port {}", port );
+    return false;
+}
+
+void UdpDemux::unbind( uint16_t port )
+{
+    if( uint8_t slot = _slots[ port ] ) {
+        _slots[ port ] = 0;
+        _handlers[ slot - 1 ] = nullptr;
+    }
+}
+
+bool UdpDemux::dispatch( const UdpDatagram& dgram ) const
+{
+    uint8_t slot = _slots[ dgram.dst_port ];
+    if( slot == 0 ) {
+        _unbound.fetch_add( 1, std::memory_order_relaxed );
+        return false;
+    }
+
+    _handlers[ slot - 1 ]( dgram );
+    return true;
+}
+
+}
+}
@@ -0,0 +1,472 @@
+#include "bm_core/xdp_socket.hpp"
+#include "bm_core/network_interface.hpp"
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+namespace {
+
+int sys_bpf( int cmd, bpf_attr& attr )
+{
+    return static_cast<int>( ::syscall( __NR_bpf, cmd, &attr, sizeof( attr ) ) );
+}
+
+// Minimal eBPF assembler with forward-only labels, enough for the redirect program below
+class BpfProgram {
+public:
+    enum Label { LABEL_REDIRECT, LABEL_PASS, LABEL_COUNT };
+
+    void emit( uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm )
+    {
+        bpf_insn insn;
+        std::memset( &insn, 0, sizeof( insn ) );
+        insn.code       = code;
+        insn.dst_reg    = dst;
+        insn.src_reg    = src;
+        insn.off        = off;
+        insn.imm        = imm;
+        _insns.push_back( insn );
+    }
+
+    void jump( uint8_t code, uint8_t dst, uint8_t src, int32_t imm, Label target )
+    {
+        _fixups.push_back( { _insns.size(), target } );
+        emit( code, dst, src, 0, imm );
+    }
+
+    void ld_map_fd( uint8_t dst, int map_fd )
+    {
+        // 16 byte instruction, the second half carries the upper 32 bits of the immediate
+        emit( BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, map_fd );
+        emit( 0, 0, 0, 0, 0 );
+    }
+
+    void label( Label label ) { _labels[ label ] = _insns.size(); }
+
+    std::vector<bpf_insn>& link()
+    {
+        for( auto& fixup : _fixups ) {
+            _insns[ fixup.first ].off = static_cast<int16_t>( _labels[ fixup.second ] - fixup.first - 1 );
+        }
+        return _insns;
+    }
+
+private:
+    std::vector<bpf_insn>                       _insns;
+    std::vector<std::pair<size_t, Label>>       _fixups;
+    size_t                                      _labels[ LABEL_COUNT ] = {};
+};
+
+}
+
+namespace bm {
+namespace core {
+
+XdpSocket::XdpSocket( int ifindex, const XdpConfig& config, const std::vector<uint16_t>& udp_ports )
+    : _config{ config }
+    , _ifindex{ ifindex }
+{
+    if( config.ring_size == 0 || ( config.ring_size & ( config.ring_size - 1 ) ) != 0 ) {
+        throw std::invalid_argument( "XDP ring size must be a power of two" );
+    }
+    if( config.frame_count <= config.ring_size ) {
+        throw std::invalid_argument( "XDP frame count must leave frames for TX" );
+    }
+
+    try {
+        _xsk_fd = ::socket( AF_XDP, SOCK_RAW, 0 );
+        if( _xsk_fd == -1 ) {
+            throw std::runtime_error( std::string( "Failed to create AF_XDP socket: " ) + std::strerror( errno ) );
+        }
+
+        setup_umem();
+        setup_rings();
+
+        sockaddr_xdp addr;
+        std::memset( &addr, 0, sizeof( addr ) );
+        addr.sxdp_family    = AF_XDP;
+        addr.sxdp_ifindex   = ifindex;
+        addr.sxdp_queue_id  = config.queue_id;
+        addr.sxdp_flags     = XDP_USE_NEED_WAKEUP | ( config.zero_copy ? XDP_ZEROCOPY : XDP_COPY );
+
+        if( ::bind( _xsk_fd, reinterpret_cast<sockaddr*>( &addr ), sizeof( addr ) ) == -1 ) {
+            throw std::runtime_error( std::string( "Failed to bind AF_XDP socket: " ) + std::strerror( errno ) );
+        }
+
+        create_map();
+
+        _prog_fd = load_program( udp_ports );
+        if( _prog_fd == -1 ) {
+            throw std::runtime_error( std::string( "Failed to load XDP program: " ) + std::strerror( errno ) );
+        }
+        attach_program();
+    }
+    catch( const std::exception& ) {
+        release();
+        throw;
+    }
+
+    spdlog::info( "AF_XDP: queue {}, {} UMEM frames of {} bytes, {} mode", config.queue_id, config.frame_count,
+        config.frame_size, config.skb_mode ? "generic" : "native" );
+}
+
+XdpSocket::~XdpSocket()
+{
+    release();
+}
+
+void XdpSocket::release()
+{
+    // Closing the link detaches the program
+    for( int* fd : { &_link_fd, &_prog_fd, &_map_fd } ) {
+        if( *fd != -1 ) {
+            ::close( *fd );
+            *fd = -1;
+        }
+    }
+
+    for( Ring* ring : { &_fill, &_completion, &_rx, &_tx } ) {
+        if( ring->map ) {
+            ::munmap( ring->map, ring->map_size );
+            ring->map = nullptr;
+        }
+    }
+
+    if( _xsk_fd != -1 ) {
+        ::close( _xsk_fd );
+        _xsk_fd = -1;
+    }
+
+    if( _umem ) {
+        ::munmap( _umem, _umem_size );
+        _umem = nullptr;
+    }
+}
+
+void XdpSocket::setup_umem()
+{
+    _umem_size = static_cast<size_t>( _config.frame_count ) * _config.frame_size;
+    void* umem = ::mmap( nullptr, _umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( umem == MAP_FAILED ) {
+        throw std::runtime_error( std::string( "Failed to allocate UMEM: " ) + std::strerror( errno ) );
+    }
+    _umem = static_cast<uint8_t*>( umem );
+
+    xdp_umem_reg reg;
+    std::memset( &reg, 0, sizeof( reg ) );
+    reg.addr        = reinterpret_cast<uint64_t>( _umem );
+    reg.len         = _umem_size;
+    reg.chunk_size  = _config.frame_size;
+
+    if( setsockopt( _xsk_fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof( reg ) ) == -1 ) {
+        throw std::runtime_error( std::string( "setsockopt XDP_UMEM_REG failed: " ) + std::strerror( errno ) );
+    }
+}
+
+void XdpSocket::setup_rings()
+{
+    uint32_t size = _config.ring_size;
+    for( int opt : { XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING, XDP_RX_RING, XDP_TX_RING } ) {
+        if( setsockopt( _xsk_fd, SOL_XDP, opt, &size, sizeof( size ) ) == -1 ) {
+            throw std::runtime_error( std::string( "setsockopt XDP ring size failed: " ) + std::strerror( errno ) );
+        }
+    }
+
+    xdp_mmap_offsets off;
+    socklen_t optlen = sizeof( off );
+    if( getsockopt( _xsk_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen ) == -1 ) {
+        throw std::runtime_error( std::string( "getsockopt XDP_MMAP_OFFSETS failed: " ) + std::strerror( errno ) );
+    }
+
+    map_ring( _fill, off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof( uint64_t ) );
+    map_ring( _completion, off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof( uint64_t ) );
+    map_ring( _rx, off.rx, XDP_PGOFF_RX_RING, sizeof( xdp_desc ) );
+    map_ring( _tx, off.tx, XDP_PGOFF_TX_RING, sizeof( xdp_desc ) );
+
+    // First ring_size frames are for receive, give them all to the kernel up front
+    auto* fill = static_cast<uint64_t*>( _fill.descs );
+    for( uint32_t i = 0; i < size; i++ ) {
+        fill[ i ] = static_cast<uint64_t>( i ) * _config.frame_size;
+    }
+    __atomic_store_n( _fill.producer, size, __ATOMIC_RELEASE );
+
+    _tx_free.reserve( _config.frame_count - size );
+    for( uint32_t i = size; i < _config.frame_count; i++ ) {
+        _tx_free.push_back( static_cast<uint64_t>( i ) * _config.frame_size );
+    }
+}
+
+void XdpSocket::map_ring( Ring& ring, const xdp_ring_offset& off, uint64_t pgoff, size_t desc_size )
+{
+    ring.map_size = off.desc + _config.ring_size * desc_size;
+    void* map = ::mmap( nullptr, ring.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _xsk_fd, pgoff );
+    if( map == MAP_FAILED ) {
+        throw std::runtime_error( std::string( "Failed to map XDP ring: " ) + std::strerror( errno ) );
+    }
+
+    auto* base      = static_cast<uint8_t*>( map );
+    ring.map        = map;
+    ring.producer   = reinterpret_cast<uint32_t*>( base + off.producer );
+    ring.consumer   = reinterpret_cast<uint32_t*>( base + off.consumer );
+    ring.flags      = reinterpret_cast<uint32_t*>( base + off.flags );
+    ring.descs      = base + off.desc;
+    ring.mask       = _config.ring_size - 1;
+}
+
+void XdpSocket::create_map()
+{
+    // XSKMAP indexed by RX queue
+    bpf_attr attr;
+    std::memset( &attr, 0, sizeof( attr ) );
+    attr.map_type       = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size       = sizeof( uint32_t );
+    attr.value_size     = sizeof( uint32_t );
+    attr.max_entries    = _config.queue_id + 1;
+
+    _map_fd = sys_bpf( BPF_MAP_CREATE, attr );
+    if( _map_fd == -1 ) {
+        throw std::runtime_error( std::string( "Failed to create XSKMAP: " ) + std::strerror( errno ) );
+    }
+
+    // Route our queue to this socket
+    uint32_t key = _config.queue_id;
+    uint32_t value = _xsk_fd;
+    std::memset( &attr, 0, sizeof( attr ) );
+    attr.map_fd = _map_fd;
+    attr.key    = reinterpret_cast<uint64_t>( &key );
+    attr.value  = reinterpret_cast<uint64_t>( &value );
+
+    if( sys_bpf( BPF_MAP_UPDATE_ELEM, attr ) == -1 ) {
+        throw std::runtime_error( std::string( "Failed to insert socket into XSKMAP: " ) + std::strerror( errno ) );
+    }
+}
+
+int XdpSocket::load_program( const std::vector<uint16_t>& udp_ports )
+{
+    // Offsets into an untagged ethernet frame carrying IPv6
+    constexpr int16_t ETHERTYPE_OFF = 12;
+    constexpr int16_t IP6_NXT_OFF   = 14 + 6;
+    constexpr int16_t UDP_DPORT_OFF = 14 + 40 + 2;
+    constexpr int32_t IP6_HDR_END   = 14 + 40;
+    constexpr int32_t UDP_DPORT_END = UDP_DPORT_OFF + 2;
+
+    // r1 = xdp_md*, r2 = data, r3 = data_end
+    BpfProgram prog;
+    prog.emit( BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof( xdp_md, data ), 0 );
+    prog.emit( BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_1, offsetof( xdp_md, data_end ), 0 );
+
+    prog.emit( BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0 );
+    prog.emit( BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, IP6_HDR_END );
+    prog.jump( BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, BpfProgram::LABEL_PASS );
+
+    prog.emit( BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, ETHERTYPE_OFF, 0 );
+    prog.jump( BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, htons( ETH_P_IPV6 ), BpfProgram::LABEL_PASS );
+
+    prog.emit( BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, IP6_NXT_OFF, 0 );
+    prog.jump( BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_5, 0, NetworkInterface::IP_PROTO_BCMP, BpfProgram::LABEL_REDIRECT );
+    prog.jump( BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, IPPROTO_UDP, BpfProgram::LABEL_PASS );
+
+    prog.emit( BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0 );
+    prog.emit( BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, UDP_DPORT_END );
+    prog.jump( BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, BpfProgram::LABEL_PASS );
+
+    prog.emit( BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, UDP_DPORT_OFF, 0 );
+    for( auto port : udp_ports ) {
+        prog.jump( BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_5, 0, htons( port ), BpfProgram::LABEL_REDIRECT );
+    }
+    prog.jump( BPF_JMP | BPF_JA, 0, 0, 0, BpfProgram::LABEL_PASS );
+
+    // return bpf_redirect_map( &xsks, ctx->rx_queue_index, XDP_PASS )
+    prog.label( BpfProgram::LABEL_REDIRECT );
+    prog.emit( BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof( xdp_md, rx_queue_index ), 0 );
+    prog.ld_map_fd( BPF_REG_1, _map_fd );
+    prog.emit( BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS );
+    prog.emit( BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map );
+    prog.emit( BPF_JMP | BPF_EXIT, 0, 0, 0, 0 );
+
+    prog.label( BpfProgram::LABEL_PASS );
+    prog.emit( BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS );
+    prog.emit( BPF_JMP | BPF_EXIT, 0, 0, 0, 0 );
+
+    auto& insns = prog.link();
+
+    char log[ 4096 ] = {};
+    bpf_attr attr;
+    std::memset( &attr, 0, sizeof( attr ) );
+    attr.prog_type  = BPF_PROG_TYPE_XDP;
+    attr.insns      = reinterpret_cast<uint64_t>( insns.data() );
+    attr.insn_cnt   = insns.size();
+    attr.license    = reinterpret_cast<uint64_t>( "GPL" );
+    attr.log_buf    = reinterpret_cast<uint64_t>( log );
+    attr.log_size   = sizeof( log );
+    attr.log_level  = 1;
+
+    int prog_fd = sys_bpf( BPF_PROG_LOAD, attr );
+    if( prog_fd == -1 ) {
+        int err = errno;
+        spdlog::error( "XDP verifier: {}", log );
+        errno = err;
+    }
+    return prog_fd;
+}
+
+bool XdpSocket::set_udp_ports( const std::vector<uint16_t>& udp_ports )
+{
+    int prog_fd = load_program( udp_ports );
+    if( prog_fd == -1 ) {
+        spdlog::error( "Failed to load XDP program: {}", std::strerror( errno ) );
+        return false;
+    }
+
+    bpf_attr attr;
+    std::memset( &attr, 0, sizeof( attr ) );
+    attr.link_update.link_fd        = _link_fd;
+    attr.link_update.new_prog_fd    = prog_fd;
+
+    if( sys_bpf( BPF_LINK_UPDATE, attr ) == -1 ) {
+        spdlog::error( "Failed to update XDP link: {}", std::strerror( errno ) );
+        ::close( prog_fd );
+        return false;
+    }
+
+    ::close( _prog_fd );
+    _prog_fd = prog_fd;
+    return true;
+}
+
+void XdpSocket::attach_program()
+{
+    bpf_attr attr;
+    std::memset( &attr, 0, sizeof( attr ) );
+    attr.link_create.prog_fd        = _prog_fd;
+    attr.link_create.target_ifindex = _ifindex;
+    attr.link_create.attach_type    = BPF_XDP;
+    attr.link_create.flags          = _config.skb_mode ? XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE;
+
+    _link_fd = sys_bpf( BPF_LINK_CREATE, attr );
+    if( _link_fd == -1 ) {
+        throw std::runtime_error( std::string( "Failed to attach XDP program: " ) + std::strerror( errno ) );
+    }
+}
+
+bool XdpSocket::wait_rx( int timeout_ms )
+{
+    if( __atomic_load_n( _rx.producer, __ATOMIC_ACQUIRE ) != *_rx.consumer ) {
+        return true;
+    }
+
+    pollfd pfd{ _xsk_fd, POLLIN, 0 };
+    int ret = ::poll( &pfd, 1, timeout_ms );
+    if( ret <= 0 ) {
+        if( ret == 0 ) {
+            errno = EAGAIN;
+        }
+        return false;
+    }
+    return __atomic_load_n( _rx.producer, __ATOMIC_ACQUIRE ) != *_rx.consumer;
+}
+
+ssize_t XdpSocket::read_batch( const NetworkDevice::FrameHandler& handler, size_t max_frames, int timeout_ms )
+{
+    if( !wait_rx( timeout_ms ) ) {
+        return -1;
+    }
+
+    uint32_t cons = *_rx.consumer;
+    uint32_t avail = __atomic_load_n( _rx.producer, __ATOMIC_ACQUIRE ) - cons;
+    uint32_t count = std::min<size_t>( avail, max_frames );
+
+    auto* descs = static_cast<xdp_desc*>( _rx.descs );
+    auto* fill = static_cast<uint64_t*>( _fill.descs );
+    uint32_t fill_prod = *_fill.producer;
+
+    for( uint32_t i = 0; i < count; i++ ) {
+        const auto& desc = descs[ ( cons + i ) & _rx.mask ];
+        handler( FrameView{ _umem + desc.addr, desc.len } );
+
+        // Recycle the chunk; the fill ring is as large as the RX pool so it can never be full here
+        fill[ ( fill_prod + i ) & _fill.mask ] = desc.addr & ~static_cast<uint64_t>( _config.frame_size - 1 );
+    }
+
+    __atomic_store_n( _rx.consumer, cons + count, __ATOMIC_RELEASE );
+    __atomic_store_n( _fill.producer, fill_prod + count, __ATOMIC_RELEASE );
+
+    return count;
+}
+
+void XdpSocket::reclaim_tx()
+{
+    uint32_t cons = *_completion.consumer;
+    uint32_t avail = __atomic_load_n( _completion.producer, __ATOMIC_ACQUIRE ) - cons;
+    auto* addrs = static_cast<uint64_t*>( _completion.descs );
+
+    for( uint32_t i = 0; i < avail; i++ ) {
+        _tx_free.push_back( addrs[ ( cons + i ) & _completion.mask ] );
+    }
+    __atomic_store_n( _completion.consumer, cons + avail, __ATOMIC_RELEASE );
+}
+
+ssize_t XdpSocket::write_frames( const FrameView* frames, size_t count )
+{
+    reclaim_tx();
+
+    uint32_t prod = *_tx.producer;
+    uint32_t space = _config.ring_size - ( prod - __atomic_load_n( _tx.consumer, __ATOMIC_ACQUIRE ) );
+    auto* descs = static_cast<xdp_desc*>( _tx.descs );
+
+    size_t queued = 0;
+    bool oversized = false;
+    for( ; queued < count && queued < space && !_tx_free.empty(); queued++ ) {
+        if( frames[ queued ].len > _config.frame_size ) {
+            oversized = true;
+            break;
+        }
+
+        uint64_t addr = _tx_free.back();
+        _tx_free.pop_back();
+        std::memcpy( _umem + addr, frames[ queued ].data, frames[ queued ].len );
+
+        auto& desc = descs[ ( prod + queued ) & _tx.mask ];
+        desc.addr       = addr;
+        desc.len        = frames[ queued ].len;
+        desc.options    = 0;
+    }
+
+    if( queued == 0 ) {
+        errno = oversized ? EINVAL : ENOBUFS;
+        return count > 0 ? -1 : 0;
+    }
+
+    __atomic_store_n( _tx.producer, prod + queued, __ATOMIC_RELEASE );
+
+    // In copy mode the frames are transmitted synchronously by this kick. If it fails they are queued all the same,
+    // and go out with the next one.
+    if( ::sendto( _xsk_fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0 ) == -1 && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS ) {
+        spdlog::debug( "AF_XDP TX kick failed: {}", std::strerror( errno ) );
+    }
+
+    reclaim_tx();
+    return queued;
+}
+
+}
+}
@@ -0,0 +1,144 @@
+// Checks that a DfuPatch rebuilds the image it was made from, sent through a DfuStream and applied against the base
+// file, for content inserted, deleted and moved. Also that malformed COPY ops are refused rather than read past the
+// base or the image.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "bm_core/dfu_patch.hpp"
+#include "bm_core/dfu_stream.hpp"
+
+using namespace bm::core;
+
+namespace {
+
+constexpr size_t BASE_SIZE = 256 * 1024;
+
+struct __attribute__((packed)) CopyOp {
+    uint8_t     op;
+    uint32_t    offset;
+    uint32_t    len;
+};
+
+// The base as the receiver holds it, in a file
+class BaseFile {
+public:
+    explicit BaseFile( const std::vector<uint8_t>& data )
+    {
+        _file = std::tmpfile();
+        if( !_file || std::fwrite( data.data(), 1, data.size(), _file ) != data.size() || std::fflush( _file ) != 0 ) {
+            std::perror( "tmpfile" );
+            std::exit( EXIT_FAILURE );
+        }
+    }
+    ~BaseFile() { std::fclose( _file ); }
+
+    int fd() const { return fileno( _file ); }
+
+private:
+    std::FILE* _file;
+};
+
+std::vector<uint8_t> random_bytes( size_t len, uint32_t seed )
+{
+    std::mt19937 rng( seed );
+    std::vector<uint8_t> data( len );
+    for( auto& byte : data ) {
+        byte = static_cast<uint8_t>( rng() );
+    }
+    return data;
+}
+
+bool round_trip( const char* name, const std::vector<uint8_t>& base, const std::vector<uint8_t>& image )
+{
+    DfuStream stream;
+    DfuPatch::diff( base, image, stream );
+
+    BaseFile base_file( base );
+    std::vector<uint8_t> rebuilt;
+    DfuPatchApplier applier( base_file.fd(), static_cast<uint32_t>( base.size() ), stream.image_size,
+                             [&rebuilt]( const uint8_t* data, size_t len ){
+        rebuilt.insert( rebuilt.end(), data, data + len );
+        return true;
+    });
+    DfuStreamDecoder decoder( [&applier]( const uint8_t* data, size_t len ){
+        return applier.write( data, len );
+    });
+
+    // In pieces the size of a payload, as a receiver gets them
+    bool ok = true;
+    for( size_t offset = 0; ok && offset < stream.data.size(); offset += 1000 ) {
+        ok = decoder.write( stream.data.data() + offset, std::min<size_t>( 1000, stream.data.size() - offset ) );
+    }
+
+    std::printf( "%s: %zu byte image, %zu byte patch\n", name, image.size(), stream.data.size() );
+    if( !ok || !decoder.at_boundary() || !applier.idle() || rebuilt != image ) {
+        std::printf( "FAIL: %s did not rebuild the image\n", name );
+        return false;
+    }
+    if( stream.image_size != image.size() ) {
+        std::printf( "FAIL: %s has the wrong image size\n", name );
+        return false;
+    }
+    // Random content only matches the base, so a patch much smaller than the image took it from there
+    if( stream.data.size() > image.size() / 4 ) {
+        std::printf( "FAIL: %s did not copy from the base\n", name );
+        return false;
+    }
+    return true;
+}
+
+bool refuses_copy( const char* name, uint32_t base_size, uint32_t image_size, uint32_t offset, uint32_t len )
+{
+    std::vector<uint8_t> base = random_bytes( base_size, 1 );
+    BaseFile base_file( base );
+    size_t written = 0;
+    DfuPatchApplier applier( base_file.fd(), base_size, image_size, [&written]( const uint8_t*, size_t len ){
+        written += len;
+        return true;
+    });
+
+    CopyOp op{ DfuPatch::COPY, offset, len };
+    if( applier.write( reinterpret_cast<const uint8_t*>( &op ), sizeof( op ) ) || written != 0 ) {
+        std::printf( "FAIL: %s was applied\n", name );
+        return false;
+    }
+    std::printf( "%s: refused\n", name );
+    return true;
+}
+
+}
+
+int main()
+{
+    const std::vector<uint8_t> base = random_bytes( BASE_SIZE, 7 );
+    const std::vector<uint8_t> fresh = random_bytes( 3000, 8 );
+    bool ok = true;
+
+    std::vector<uint8_t> inserted( base );
+    inserted.insert( inserted.begin() + BASE_SIZE / 3, fresh.begin(), fresh.end() );
+    ok &= round_trip( "insert", base, inserted );
+
+    std::vector<uint8_t> deleted( base );
+    deleted.erase( deleted.begin() + BASE_SIZE / 2, deleted.begin() + BASE_SIZE / 2 + 5000 );
+    ok &= round_trip( "delete", base, deleted );
+
+    // The second half first
+    std::vector<uint8_t> moved( base.begin() + BASE_SIZE / 2, base.end() );
+    moved.insert( moved.end(), base.begin(), base.begin() + BASE_SIZE / 2 );
+    ok &= round_trip( "move", base, moved );
+
+    ok &= round_trip( "unchanged", base, base );
+
+    ok &= refuses_copy( "copy past the base", 4096, 8192, 4000, 200 );
+    ok &= refuses_copy( "copy from beyond the base", 4096, 8192, 5000, 10 );
+    ok &= refuses_copy( "copy wrapping around", 4096, 8192, 100, UINT32_MAX - 50 );
+    ok &= refuses_copy( "copy past the image", 4096, 1000, 0, 2000 );
+    ok &= refuses_copy( "empty copy", 4096, 8192, 0, 0 );
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
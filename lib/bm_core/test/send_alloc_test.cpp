@@ -0,0 +1,136 @@
+// Checks that sending a BCMP message does not touch the heap once the interface is up and its header template warm.
+//
+// Needs CAP_NET_RAW for the packet socket; without it the test is skipped. Runs on the loopback interface unless
+// another one is named on the command line.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bm_core/bcmp_messages.hpp"
+#include "bm_core/node.hpp"
+
+extern "C" void* __libc_malloc( size_t size );
+extern "C" void* __libc_calloc( size_t count, size_t size );
+extern "C" void* __libc_realloc( void* ptr, size_t size );
+
+namespace {
+
+// Per thread, so the receive workers handling our own frames are not counted
+thread_local bool counting = false;
+size_t allocations = 0;
+
+constexpr int SKIPPED = 77;
+constexpr int SENDS = 10000;
+
+}
+
+extern "C" void* malloc( size_t size )
+{
+    if( counting ) {
+        allocations++;
+    }
+    return __libc_malloc( size );
+}
+
+extern "C" void* calloc( size_t count, size_t size )
+{
+    if( counting ) {
+        allocations++;
+    }
+    return __libc_calloc( count, size );
+}
+
+extern "C" void* realloc( void* ptr, size_t size )
+{
+    if( counting ) {
+        allocations++;
+    }
+    return __libc_realloc( ptr, size );
+}
+
+void* operator new( size_t size )
+{
+    void* p = malloc( size );
+    if( !p ) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[]( size_t size )
+{
+    return operator new( size );
+}
+
+void operator delete( void* p ) noexcept
+{
+    free( p );
+}
+
+void operator delete[]( void* p ) noexcept
+{
+    free( p );
+}
+
+void operator delete( void* p, size_t ) noexcept
+{
+    free( p );
+}
+
+void operator delete[]( void* p, size_t ) noexcept
+{
+    free( p );
+}
+
+int main( int argc, char* argv[] )
+{
+    using namespace bm::core;
+
+    std::string interface = argc > 1 ? argv[ 1 ] : "lo";
+    std::unique_ptr<Node> node;
+    try {
+        node = std::make_unique<Node>( 1, std::vector<std::string>{ interface } );
+    }
+    catch( const std::exception& e ) {
+        std::printf( "SKIP: no BM interface on %s (%s)\n", interface.c_str(), e.what() );
+        return SKIPPED;
+    }
+
+    static const in6_addr all_nodes{ { { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01 } } };
+    bcmp_heartbeat_t heartbeat{};
+    heartbeat.liveliness_lease_dur_s = 10;
+
+    // The first send builds the cached header template
+    if( node->net().send_bcmp_message( all_nodes, BCMP_HEARTBEAT, &heartbeat, sizeof( heartbeat ) ) <= 0 ) {
+        std::printf( "FAIL: warm-up send failed: %s\n", std::strerror( errno ) );
+        return EXIT_FAILURE;
+    }
+
+    int sent = 0;
+    counting = true;
+    for( int i = 0; i < SENDS; i++ ) {
+        heartbeat.time_since_boot_us = i;
+        if( node->net().send_bcmp_message( all_nodes, BCMP_HEARTBEAT, &heartbeat, sizeof( heartbeat ) ) > 0 ) {
+            sent++;
+        }
+    }
+    counting = false;
+
+    std::printf( "%d of %d sends, %zu heap allocations\n", sent, SENDS, allocations );
+    if( sent == 0 ) {
+        std::printf( "FAIL: nothing was sent\n" );
+        return EXIT_FAILURE;
+    }
+    if( allocations != 0 ) {
+        std::printf( "FAIL: send_bcmp_message allocated\n" );
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}